@@ -1,23 +1,155 @@
 /*
  * sh - shell
- * Usage: up to you
+ * Usage: sh
+ *
+ * Reads one command per line, splits it on whitespace, and runs it,
+ * waiting for it to finish. A command without a '/' or ':' is looked
+ * up in /bin. The only builtin is "exit [code]".
+ *
+ * Commands are started with spawn() rather than fork() + execv(), so
+ * launching a program costs one load_elf instead of first copying the
+ * whole shell address space only to throw it away.
  */
 
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
+#include <err.h>
+
 #ifdef HOST
 #include "hostcompat.h"
 #endif
 
+#define CMDLINE_MAX  1024
+#define MAXCMDARGS   128
+
+/*
+ * Read a line from the console, echoing it and handling backspace.
+ * Returns -1 on end of file.
+ */
+static
+int
+getcmd(char *buf, size_t len)
+{
+	size_t pos = 0;
+	int ch;
+
+	while (1) {
+		ch = getchar();
+		if (ch == EOF) {
+			return -1;
+		}
+		if (ch == '\r' || ch == '\n') {
+			putchar('\n');
+			break;
+		}
+		if (ch == '\b' || ch == 127) {
+			if (pos > 0) {
+				putchar('\b');
+				putchar(' ');
+				putchar('\b');
+				pos--;
+			}
+		}
+		else if (ch >= 32 && ch < 127 && pos < len-1) {
+			buf[pos++] = ch;
+			putchar(ch);
+		}
+		else {
+			/* beep */
+			putchar('\a');
+		}
+	}
+	buf[pos] = 0;
+	return 0;
+}
+
+/*
+ * Start the program and wait for it.
+ */
+static
+void
+runcmd(char **args)
+{
+	char progname[PATH_MAX];
+	const char *prog;
+	int pid, status;
+
+	prog = args[0];
+	if (strchr(prog, '/') == NULL && strchr(prog, ':') == NULL) {
+		snprintf(progname, sizeof(progname), "/bin/%s", prog);
+		prog = progname;
+	}
+
+#ifdef HOST
+	pid = fork();
+	if (pid == 0) {
+		execv(prog, args);
+		warn("%s", args[0]);
+		_exit(1);
+	}
+#else
+	pid = spawn(prog, args);
+#endif
+	if (pid < 0) {
+		warn("%s", args[0]);
+		return;
+	}
+
+	if (waitpid(pid, &status, 0) < 0) {
+		warn("waitpid for %d", pid);
+	}
+	else if (status != 0) {
+		printf("%s: exit %d\n", args[0], status);
+	}
+}
+
 int
 main(int argc, char *argv[])
 {
+	char buf[CMDLINE_MAX];
+	char *args[MAXCMDARGS];
+	char *word, *context;
+	int nargs;
+
 #ifdef HOST
 	hostcompat_init(argc, argv);
 #endif
 
-	/* Write this */
-
 	(void)argc;
 	(void)argv;
 
-	return 1;
+	while (1) {
+		printf("OS/161$ ");
+		if (getcmd(buf, sizeof(buf)) < 0) {
+			break;
+		}
+
+		nargs = 0;
+		for (word = strtok_r(buf, " \t", &context);
+		     word != NULL;
+		     word = strtok_r(NULL, " \t", &context)) {
+			if (nargs >= MAXCMDARGS-1) {
+				break;
+			}
+			args[nargs++] = word;
+		}
+		if (word != NULL) {
+			warnx("too many arguments (max %d)", MAXCMDARGS-1);
+			continue;
+		}
+		if (nargs == 0) {
+			continue;
+		}
+		args[nargs] = NULL;
+
+		if (!strcmp(args[0], "exit")) {
+			exit(nargs > 1 ? atoi(args[1]) : 0);
+		}
+		runcmd(args);
+	}
+
+	return 0;
 }
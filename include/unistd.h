@@ -123,6 +123,12 @@ time_t __time(time_t *seconds, unsigned long *nanoseconds);
 int __getcwd(char *buf, size_t buflen);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
+/*
+ * spawn is fork+execv in one call: the child gets a fresh address
+ * space with PROG loaded and never sees a copy of the parent. Returns
+ * the child's pid, like fork in the parent.
+ */
+pid_t spawn(const char *prog, char *const *args);
 
 /*
  * These are not themselves system calls, but wrapper routines in libc.
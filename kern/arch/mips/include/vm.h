@@ -86,6 +86,14 @@ paddr_t ram_stealmem(unsigned long npages);
  */
 paddr_t ram_allocmem(unsigned long npages, int status);
 paddr_t as_ram_allocmem(unsigned long npages, int status, struct addrspace *as);
+paddr_t as_ram_allocmem_zeroed(int status, struct addrspace *as);
+
+/*
+ * ram_prezero clears one free page for the zero-fill pool, if it needs
+ * one, and returns whether it did. The scheduler calls it when idle.
+ */
+int ram_prezero(void);
+void ram_zeropool_stats(void);
 
 void ram_getsize(paddr_t *lo, paddr_t *hi);
 
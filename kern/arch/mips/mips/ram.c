@@ -5,6 +5,7 @@
 #include <machine/pcb.h>  /* for mips_ramsize */
 #include <addrspace.h>
 #include <vm_helper.h>
+#include <buf.h>
 
 #define RAMSTEALMEM 0
 #define RAMDB 0
@@ -15,23 +16,36 @@ u_int32_t firstfree;   /* first free virtual address; set by start.S */
 static u_int32_t firstpaddr;  /* address of first free physical page */
 static u_int32_t lastpaddr;   /* one past end of last free physical page */
 
+/*
+ * Pool of free frames that have already been cleared, for zero-fill
+ * faults. The scheduler tops it up with ram_prezero when it has
+ * nothing to run, and as_ram_allocmem_zeroed takes from it. Pooled
+ * frames are PPAGE_ZEROED in the coremap, so nothing else allocates
+ * them, but they are the first thing given back when memory runs out.
+ */
+#define ZEROPOOL_MAX 32
+
+static int zeropool[ZEROPOOL_MAX];	/* coremap indexes */
+static int nzeroed;
+static unsigned zeropool_hits, zeropool_misses;
+
 void coremap_bootstrap() {
-	ram_npages = (lastpaddr - firstpaddr)/PAGE_SIZE;
-	/*
-	 * assume coremap will not occupy more than 1 page
-	 * page size is 4k, size of (int + struct addrspace*) is 8, we cannot have more than hundreds of pages
-	 */
-	ram_npages -- ;
+	u_int32_t maxpages = (lastpaddr - firstpaddr)/PAGE_SIZE;
 	kprintf("size of ptr: %d\n", sizeof(struct addrspace *));
-	int size = sizeof(int) + sizeof(struct addrspace *) + sizeof(vaddr_t);
+	int size = sizeof(int) + sizeof(struct addrspace *) + sizeof(vaddr_t)
+		+ sizeof(struct pageref *);
 	/*
-	 * kmalloc may not nessarily allocate a new page, it may do sub-page alloc
-	 * even that happens, doing (ram_npages --) in the above line will at worst
-	 * cause wastage of one page, without other harm. 
+	 * the coremap takes size bytes per frame, which is more than one
+	 * page once there are a few hundred frames. size it for every
+	 * frame there is now, then count only the frames left over after
+	 * it: that is at most a few entries too many, never too few.
 	 */
-	coremap_entry = (int *)kmalloc_dumb(ram_npages*size);
+	coremap_entry = (int *)kmalloc_dumb(maxpages*size);
+	ram_npages = (lastpaddr - firstpaddr)/PAGE_SIZE;
+	assert(ram_npages <= maxpages);
 	cmap_as_entry = (struct addrspace **)(coremap_entry + ram_npages);
 	cmap_pte_entry = (vaddr_t **)(cmap_as_entry + ram_npages);
+	cmap_pageref_entry = (struct pageref **)(cmap_pte_entry + ram_npages);
 
 	firstpaddr_init = firstpaddr;	
 
@@ -47,6 +61,7 @@ void coremap_bootstrap() {
 		 */
 		*(cmap_as_entry+i) = NULL;
 		*(cmap_pte_entry+i) = NULL;
+		*(cmap_pageref_entry+i) = NULL;
 		//kprintf("%u: %d\n", i, *((int *)coremap_entry+i));
 	}
 	LRU_ptr = 0;
@@ -163,6 +178,117 @@ int find_contiguous_pages(unsigned long npages) {
 	return -1;
 }
 
+/*
+ * Clear one free frame and put it in the zero pool, if the pool is
+ * short. Returns 1 if it did, 0 if there was nothing to do.
+ * Called from the idle loop, with interrupts off.
+ */
+int
+ram_prezero(void)
+{
+	int page_num, limit;
+
+	assert(curspl > 0);
+
+	/* don't sit on more than a sixteenth of memory */
+	limit = ram_npages / 16;
+	if (limit > ZEROPOOL_MAX) {
+		limit = ZEROPOOL_MAX;
+	}
+	if (nzeroed >= limit) {
+		return 0;
+	}
+
+	page_num = find_contiguous_pages(1);
+	if (page_num < 0) {
+		return 0;
+	}
+	*(coremap_entry + page_num) = PPAGE_ZEROED + 10;
+	bzero_page((void *)PADDR_TO_KVADDR(firstpaddr_init + page_num*PAGE_SIZE));
+	zeropool[nzeroed++] = page_num;
+	return 1;
+}
+
+/*
+ * Give one frame in the zero pool back to the free pages.
+ * Returns 1 if there was one.
+ */
+static
+int
+zeropool_release(void)
+{
+	int page_num;
+
+	if (nzeroed == 0) {
+		return 0;
+	}
+	page_num = zeropool[--nzeroed];
+	assert(*(coremap_entry + page_num) == PPAGE_ZEROED + 10);
+	*(coremap_entry + page_num) = PPAGE_AVAILABLE;
+	return 1;
+}
+
+/*
+ * as_ram_allocmem for one page that must come back cleared: from the
+ * zero pool if it has any, otherwise allocated and cleared now.
+ */
+paddr_t
+as_ram_allocmem_zeroed(int status, struct addrspace *as)
+{
+	int page_num;
+	paddr_t pbase;
+
+	assert(curspl > 0);
+
+	if (nzeroed > 0) {
+		zeropool_hits++;
+		page_num = zeropool[--nzeroed];
+		assert(*(coremap_entry + page_num) == PPAGE_ZEROED + 10);
+		*(coremap_entry + page_num) = status + 10;
+		*(cmap_as_entry + page_num) = as;
+		return firstpaddr_init + page_num * PAGE_SIZE;
+	}
+
+	zeropool_misses++;
+	pbase = as_ram_allocmem(1, status, as);
+	if (pbase != 0) {
+		bzero_page((void *)PADDR_TO_KVADDR(pbase));
+	}
+	return pbase;
+}
+
+void
+ram_zeropool_stats(void)
+{
+	kprintf("zero pool: %d pages, %u hits, %u misses\n",
+		nzeroed, zeropool_hits, zeropool_misses);
+}
+
+/*
+ * find_contiguous_pages, giving up pre-zeroed frames, clean cached
+ * disk blocks and cached free kernel objects until the run turns up.
+ * These are all cheaper to give up than any page. A single page
+ * turns up as soon as anything is freed, but a longer run may never
+ * form, so don't empty the caches chasing one: after RAM_MAXRECLAIM
+ * tries the caller falls back to eviction or kseg2 instead.
+ */
+#define RAM_MAXRECLAIM 16
+
+static
+int
+find_pages_reclaim(unsigned long npages)
+{
+	int page_num = find_contiguous_pages(npages);
+	int tries = 0;
+
+	while (page_num < 0 &&
+	       (npages == 1 || tries++ < RAM_MAXRECLAIM) &&
+	       (zeropool_release() || buf_reclaim() || kmem_reclaim())) {
+		page_num = find_contiguous_pages(npages);
+	}
+	return page_num;
+}
+
 /*
  * this is only called by kmalloc -- kernel level
  * version to be used based on info of coremap
@@ -180,7 +306,7 @@ paddr_t ram_allocmem(unsigned long npages, int status) {
 	 * interrupt has been set off 
 	 */
 	assert(curspl > 0);
-	int page_num = find_contiguous_pages(npages);
+	int page_num = find_pages_reclaim(npages);
 	if (page_num < 0 && npages > 1) {
 		/*
 		 * failed to find mem with size npages
@@ -188,9 +314,9 @@ paddr_t ram_allocmem(unsigned long npages, int status) {
 		/*
 		 * ram_allocmem is called by kmalloc
 		 * eviction does not support evict contiguous 
-		 * pages yet. so just return 0
+		 * pages yet. so just return 0: kmalloc then
+		 * builds the block out of single pages in kseg2
 		 */
-		kprintf("****** ram_allocmem (in kmalloc), failed to alloc %lu pages\n", npages);
 		return 0;
 	} else if (page_num < 0) {
 
@@ -233,7 +359,7 @@ paddr_t as_ram_allocmem(unsigned long npages, int status, struct addrspace *as)
 	/*
 	 * interrupt has been set off 
 	 */
-	int page_num = find_contiguous_pages(npages);
+	int page_num = find_pages_reclaim(npages);
 	if (page_num < 0 && npages > 1) {
 		/*
 		 * failed to find mem with size npages
@@ -6,6 +6,7 @@
 #include <machine/trapframe.h>
 #include <kern/callno.h>
 #include <syscall.h>
+#include <clock.h>
 
 
 /*
@@ -45,6 +46,172 @@
  * arch/mips/include/types.h.)
  */
 
+/*
+ * Syscall table.
+ *
+ * Each handler gets the trapframe and the retval slot and pulls its own
+ * arguments out of a0-a3; sc_nargs is how many of them it uses. Calls
+ * with no entry (or a NULL handler) fail with ENOSYS.
+ *
+ * Per-syscall counters are kept alongside: number of calls, number of
+ * error returns, and total/max latency. There is no cycle counter on
+ * the r3000, so latency is taken from the rtclock via gettime() and
+ * kept in microseconds. _exit and a successful execv never return, so
+ * they are counted but not timed.
+ */
+
+static int sc_reboot(struct trapframe *tf, int32_t *retval);
+static int sc_write(struct trapframe *tf, int32_t *retval);
+static int sc_read(struct trapframe *tf, int32_t *retval);
+static int sc_exit(struct trapframe *tf, int32_t *retval);
+static int sc_fork(struct trapframe *tf, int32_t *retval);
+static int sc_getpid(struct trapframe *tf, int32_t *retval);
+static int sc_waitpid(struct trapframe *tf, int32_t *retval);
+static int sc_execv(struct trapframe *tf, int32_t *retval);
+static int sc_sbrk(struct trapframe *tf, int32_t *retval);
+static int sc_spawn(struct trapframe *tf, int32_t *retval);
+static int sc_time(struct trapframe *tf, int32_t *retval);
+
+#define NSYSCALLS (SYS_spawn+1)
+
+static const struct {
+	int (*sc_handler)(struct trapframe *tf, int32_t *retval);
+	int sc_nargs;
+	const char *sc_name;
+} syscalltable[NSYSCALLS] = {
+	[SYS__exit]	= { sc_exit,	1, "_exit" },
+	[SYS_execv]	= { sc_execv,	2, "execv" },
+	[SYS_fork]	= { sc_fork,	0, "fork" },
+	[SYS_waitpid]	= { sc_waitpid,	3, "waitpid" },
+	[SYS_read]	= { sc_read,	3, "read" },
+	[SYS_write]	= { sc_write,	3, "write" },
+	[SYS_reboot]	= { sc_reboot,	1, "reboot" },
+	[SYS_sbrk]	= { sc_sbrk,	1, "sbrk" },
+	[SYS_getpid]	= { sc_getpid,	0, "getpid" },
+	[SYS___time]	= { sc_time,	2, "__time" },
+	[SYS_spawn]	= { sc_spawn,	2, "spawn" },
+};
+
+static struct {
+	u_int32_t ss_calls;
+	u_int32_t ss_errors;
+	u_int32_t ss_totalusec;
+	u_int32_t ss_maxusec;
+} syscallstats[NSYSCALLS];
+
+static
+int
+sc_reboot(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_reboot(tf->tf_a0);
+}
+
+static
+int
+sc_write(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_write(tf->tf_a0, (void*)(tf->tf_a1), tf->tf_a2);
+}
+
+static
+int
+sc_read(struct trapframe *tf, int32_t *retval)
+{
+	return sys_read(tf->tf_a0, (void*)(tf->tf_a1), tf->tf_a2, retval);
+}
+
+static
+int
+sc_exit(struct trapframe *tf, int32_t *retval)
+{
+	return sys__exit(tf, retval, tf->tf_a0);
+}
+
+static
+int
+sc_fork(struct trapframe *tf, int32_t *retval)
+{
+	return sys_fork(tf, retval);
+}
+
+static
+int
+sc_getpid(struct trapframe *tf, int32_t *retval)
+{
+	(void)tf;
+	return sys_getpid(retval);
+}
+
+static
+int
+sc_waitpid(struct trapframe *tf, int32_t *retval)
+{
+	return sys_waitpid(tf->tf_a0, tf, retval);
+}
+
+static
+int
+sc_execv(struct trapframe *tf, int32_t *retval)
+{
+	return sys_execv((char *)tf->tf_a0, (char *const *)tf->tf_a1, retval);
+}
+
+static
+int
+sc_sbrk(struct trapframe *tf, int32_t *retval)
+{
+	return sys_sbrk(tf->tf_a0, retval);
+}
+
+static
+int
+sc_time(struct trapframe *tf, int32_t *retval)
+{
+	return sys___time((time_t *)tf->tf_a0, (unsigned long *)tf->tf_a1,
+			  retval);
+}
+
+static
+int
+sc_spawn(struct trapframe *tf, int32_t *retval)
+{
+	return sys_spawn((char *)tf->tf_a0, (char *const *)tf->tf_a1, retval);
+}
+
+/*
+ * Print the per-syscall counters. Called from the "syscallstats" menu
+ * command.
+ */
+void
+syscall_printstats(void)
+{
+	int i, spl;
+	u_int32_t calls, errors, total, max;
+
+	kprintf("%-10s %10s %8s %12s %10s %10s\n", "syscall", "calls",
+		"errors", "total(us)", "avg(us)", "max(us)");
+	for (i=0; i<NSYSCALLS; i++) {
+		if (syscalltable[i].sc_handler == NULL) {
+			continue;
+		}
+		spl = splhigh();
+		calls = syscallstats[i].ss_calls;
+		errors = syscallstats[i].ss_errors;
+		total = syscallstats[i].ss_totalusec;
+		max = syscallstats[i].ss_maxusec;
+		splx(spl);
+
+		kprintf("%-10s %10lu %8lu %12lu %10lu %10lu\n",
+			syscalltable[i].sc_name,
+			(unsigned long) calls, (unsigned long) errors,
+			(unsigned long) total,
+			(unsigned long) (calls ? total/calls : 0),
+			(unsigned long) max);
+	}
+}
+
 // syscall (trap) is an exception, so userprogram will invoke exception.S first
 // then exception.S will generate tf, and after that, mips_syscall() is called,
 // with tf as argument passed in.
@@ -56,6 +223,9 @@ mips_syscall(struct trapframe *tf)
 	int callno;
 	int32_t retval;
 	int err;
+	int spl;
+	time_t beforesecs, aftersecs, secs;
+	u_int32_t beforensecs, afternsecs, nsecs, usecs;
 	// interrupt is on now (as curspl should be 0 in user level)
 	// and we do not need to turn off interrupt for handling syscall
 	// as all are loocal variables (tf is on the user stack)
@@ -74,44 +244,33 @@ mips_syscall(struct trapframe *tf)
 
 	retval = 0;
 
-	switch (callno) {
-	    case SYS_reboot:
-		err = sys_reboot(tf->tf_a0);
-		break;
-	    case SYS_write:
-		// TODO: how to treat errno and return val?
-		// from my guess, when user prog calls write( , , ), 
-		// it will directly be translate to a syscall to sys_write( , , )
-		// so i don't need to implement write( , , ), 
-		// but i have to finish sys_write( , , )
-		err = sys_write(tf->tf_a0, (void*)(tf->tf_a1), tf->tf_a2);
-		break;
-	    case SYS_read:
-		// TODO: errno and return val?
-		err = sys_read(tf->tf_a0, (void*)(tf->tf_a1), tf->tf_a2, &retval);
-		break;
-	    case SYS__exit:
-		sys__exit(tf, &retval, tf->tf_a0);
-		break;
-	    case SYS_fork:
-		err = sys_fork(tf, &retval);
-		break;
-	    case SYS_getpid:
-		err = sys_getpid(&retval);
-		break;
-	    case SYS_waitpid:
-		err = sys_waitpid(tf->tf_a0, tf, &retval);
-		break;
-	    case SYS_execv:
-		err = sys_execv(tf->tf_a0, tf->tf_a1, &retval);
-		break;
-	    case SYS_sbrk:
-		err = sys_sbrk(tf->tf_a0, &retval);
-		break;
-	    default:
+	if (callno < 0 || callno >= NSYSCALLS ||
+	    syscalltable[callno].sc_handler == NULL) {
 		kprintf("Unknown syscall %d\n", callno);
 		err = ENOSYS;
-		break;
+	}
+	else {
+		spl = splhigh();
+		syscallstats[callno].ss_calls++;
+		splx(spl);
+
+		gettime(&beforesecs, &beforensecs);
+		err = syscalltable[callno].sc_handler(tf, &retval);
+		gettime(&aftersecs, &afternsecs);
+		getinterval(beforesecs, beforensecs,
+			    aftersecs, afternsecs,
+			    &secs, &nsecs);
+		usecs = secs*1000000 + nsecs/1000;
+
+		spl = splhigh();
+		if (err) {
+			syscallstats[callno].ss_errors++;
+		}
+		syscallstats[callno].ss_totalusec += usecs;
+		if (usecs > syscallstats[callno].ss_maxusec) {
+			syscallstats[callno].ss_maxusec = usecs;
+		}
+		splx(spl);
 	}
 
 
@@ -134,6 +134,11 @@ sfs_io.o: ${S}/fs/sfs/sfs_io.c
 SRCS+=${S}/fs/sfs/sfs_io.c
 OBJS+=sfs_io.o
 
+sfs_journal.o: ${S}/fs/sfs/sfs_journal.c
+	${COMPILE.c} ${S}/fs/sfs/sfs_journal.c
+SRCS+=${S}/fs/sfs/sfs_journal.c
+OBJS+=sfs_journal.o
+
 cache_mips1.o: ${S}/arch/mips/mips/cache_mips1.S
 	${COMPILE.S} ${S}/arch/mips/mips/cache_mips1.S
 SRCS+=${S}/arch/mips/mips/cache_mips1.S
@@ -219,6 +224,16 @@ bitmap.o: ${S}/lib/bitmap.c
 SRCS+=${S}/lib/bitmap.c
 OBJS+=bitmap.o
 
+hash.o: ${S}/lib/hash.c
+	${COMPILE.c} ${S}/lib/hash.c
+SRCS+=${S}/lib/hash.c
+OBJS+=hash.o
+
+list.o: ${S}/lib/list.c
+	${COMPILE.c} ${S}/lib/list.c
+SRCS+=${S}/lib/list.c
+OBJS+=list.o
+
 queue.o: ${S}/lib/queue.c
 	${COMPILE.c} ${S}/lib/queue.c
 SRCS+=${S}/lib/queue.c
@@ -349,6 +364,11 @@ vnode.o: ${S}/fs/vfs/vnode.c
 SRCS+=${S}/fs/vfs/vnode.c
 OBJS+=vnode.o
 
+buf.o: ${S}/fs/vfs/buf.c
+	${COMPILE.c} ${S}/fs/vfs/buf.c
+SRCS+=${S}/fs/vfs/buf.c
+OBJS+=buf.o
+
 devnull.o: ${S}/fs/vfs/devnull.c
 	${COMPILE.c} ${S}/fs/vfs/devnull.c
 SRCS+=${S}/fs/vfs/devnull.c
@@ -429,6 +449,16 @@ bitmaptest.o: ${S}/test/bitmaptest.c
 SRCS+=${S}/test/bitmaptest.c
 OBJS+=bitmaptest.o
 
+hashtest.o: ${S}/test/hashtest.c
+	${COMPILE.c} ${S}/test/hashtest.c
+SRCS+=${S}/test/hashtest.c
+OBJS+=hashtest.o
+
+listtest.o: ${S}/test/listtest.c
+	${COMPILE.c} ${S}/test/listtest.c
+SRCS+=${S}/test/listtest.c
+OBJS+=listtest.o
+
 queuetest.o: ${S}/test/queuetest.c
 	${COMPILE.c} ${S}/test/queuetest.c
 SRCS+=${S}/test/queuetest.c
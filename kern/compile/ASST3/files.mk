@@ -129,6 +129,11 @@ sfs_io.o: ${S}/fs/sfs/sfs_io.c
 SRCS+=${S}/fs/sfs/sfs_io.c
 OBJS+=sfs_io.o
 
+sfs_journal.o: ${S}/fs/sfs/sfs_journal.c
+	${COMPILE.c} ${S}/fs/sfs/sfs_journal.c
+SRCS+=${S}/fs/sfs/sfs_journal.c
+OBJS+=sfs_journal.o
+
 addrspace.o: ${S}/vm/addrspace.c
 	${COMPILE.c} ${S}/vm/addrspace.c
 SRCS+=${S}/vm/addrspace.c
@@ -224,6 +229,16 @@ bitmap.o: ${S}/lib/bitmap.c
 SRCS+=${S}/lib/bitmap.c
 OBJS+=bitmap.o
 
+hash.o: ${S}/lib/hash.c
+	${COMPILE.c} ${S}/lib/hash.c
+SRCS+=${S}/lib/hash.c
+OBJS+=hash.o
+
+list.o: ${S}/lib/list.c
+	${COMPILE.c} ${S}/lib/list.c
+SRCS+=${S}/lib/list.c
+OBJS+=list.o
+
 queue.o: ${S}/lib/queue.c
 	${COMPILE.c} ${S}/lib/queue.c
 SRCS+=${S}/lib/queue.c
@@ -354,6 +369,11 @@ vnode.o: ${S}/fs/vfs/vnode.c
 SRCS+=${S}/fs/vfs/vnode.c
 OBJS+=vnode.o
 
+buf.o: ${S}/fs/vfs/buf.c
+	${COMPILE.c} ${S}/fs/vfs/buf.c
+SRCS+=${S}/fs/vfs/buf.c
+OBJS+=buf.o
+
 devnull.o: ${S}/fs/vfs/devnull.c
 	${COMPILE.c} ${S}/fs/vfs/devnull.c
 SRCS+=${S}/fs/vfs/devnull.c
@@ -439,6 +459,16 @@ bitmaptest.o: ${S}/test/bitmaptest.c
 SRCS+=${S}/test/bitmaptest.c
 OBJS+=bitmaptest.o
 
+hashtest.o: ${S}/test/hashtest.c
+	${COMPILE.c} ${S}/test/hashtest.c
+SRCS+=${S}/test/hashtest.c
+OBJS+=hashtest.o
+
+listtest.o: ${S}/test/listtest.c
+	${COMPILE.c} ${S}/test/listtest.c
+SRCS+=${S}/test/listtest.c
+OBJS+=listtest.o
+
 queuetest.o: ${S}/test/queuetest.c
 	${COMPILE.c} ${S}/test/queuetest.c
 SRCS+=${S}/test/queuetest.c
@@ -23,6 +23,8 @@
 #include <emufs.h>
 #include <lamebus/emu.h>
 #include <machine/bus.h>
+#include <machine/spl.h>
+#include <thread.h>
 #include "autoconf.h"
 
 /* Register offsets */
@@ -89,17 +91,75 @@ emu_wreg(struct emu_softc *sc, u_int32_t reg, u_int32_t val)
 }
 
 /*
- * Called by the underlying bus code when an interrupt happens
+ * Hand a request to the device. If it writes data, copy that into the
+ * device buffer first. Called at splhigh, with the device idle.
+ */
+static
+void
+emu_start(struct emu_softc *sc, struct emu_req *r)
+{
+	assert(curspl > 0);
+	assert(sc->e_cur == NULL);
+
+	switch (r->er_op) {
+	    case EMU_OP_OPEN:
+	    case EMU_OP_CREATE:
+	    case EMU_OP_EXCLCREATE:
+	    case EMU_OP_WRITE:
+		memcpy(sc->e_iobuf, r->er_buf, r->er_len);
+		break;
+	}
+
+	sc->e_cur = r;
+	emu_wreg(sc, REG_HANDLE, r->er_handle);
+	emu_wreg(sc, REG_IOLEN, r->er_len);
+	emu_wreg(sc, REG_OFFSET, r->er_offset);
+	emu_wreg(sc, REG_OPER, r->er_op);
+}
+
+/*
+ * Called by the underlying bus code when an interrupt happens.
+ *
+ * Pick up the results of the current request, copying out any data it
+ * read so the device buffer is free again, wake up whoever is waiting
+ * for it, and start the next request in the queue straight away.
  */
 void
 emu_irq(void *dev)
 {
 	struct emu_softc *sc = dev;
+	struct emu_req *r = sc->e_cur;
+	u_int32_t result;
 
-	sc->e_result = emu_rreg(sc, REG_RESULT);
+	result = emu_rreg(sc, REG_RESULT);
 	emu_wreg(sc, REG_RESULT, 0);
 
-	V(sc->e_sem);
+	if (r == NULL) {
+		kprintf("emu%d: stray interrupt\n", sc->e_unit);
+		return;
+	}
+	sc->e_cur = NULL;
+
+	r->er_result = result;
+	r->er_handle = emu_rreg(sc, REG_HANDLE);
+	r->er_offset = emu_rreg(sc, REG_OFFSET);
+	r->er_len = emu_rreg(sc, REG_IOLEN);
+	if (result == EMU_RES_SUCCESS &&
+	    (r->er_op == EMU_OP_READ || r->er_op == EMU_OP_READDIR)) {
+		assert(r->er_len <= EMU_MAXIO);
+		memcpy(r->er_buf, sc->e_iobuf, r->er_len);
+	}
+	r->er_done = 1;
+	thread_wakeup(r);
+
+	if (sc->e_qhead != NULL) {
+		r = sc->e_qhead;
+		sc->e_qhead = r->er_next;
+		if (sc->e_qhead == NULL) {
+			sc->e_qtail = NULL;
+		}
+		emu_start(sc, r);
+	}
 }
 
 /*
@@ -131,14 +191,91 @@ translate_err(struct emu_softc *sc, u_int32_t code)
 }
 
 /*
- * Wait for an operation to complete, and return an errno for the result.
+ * Get a free request slot. If NOWAIT is set, return NULL instead of
+ * waiting for one.
+ */
+static
+struct emu_req *
+emu_getreq(struct emu_softc *sc, int nowait)
+{
+	struct emu_req *r;
+	int i, spl;
+
+	spl = splhigh();
+	while (1) {
+		for (i=0; i<EMU_NSLOTS; i++) {
+			r = &sc->e_slots[i];
+			if (!r->er_inuse) {
+				r->er_inuse = 1;
+				splx(spl);
+				return r;
+			}
+		}
+		if (nowait) {
+			splx(spl);
+			return NULL;
+		}
+		thread_sleep(sc->e_slots);
+	}
+}
+
+/*
+ * Give a request slot back.
+ */
+static
+void
+emu_putreq(struct emu_softc *sc, struct emu_req *r)
+{
+	int spl;
+
+	spl = splhigh();
+	assert(r->er_inuse);
+	r->er_inuse = 0;
+	thread_wakeup_one(sc->e_slots);
+	splx(spl);
+}
+
+/*
+ * Queue a filled-in request for the device, starting it at once if
+ * the device is idle.
+ */
+static
+void
+emu_submit(struct emu_softc *sc, struct emu_req *r)
+{
+	int spl;
+
+	spl = splhigh();
+	r->er_done = 0;
+	r->er_next = NULL;
+	if (sc->e_cur == NULL) {
+		emu_start(sc, r);
+	}
+	else if (sc->e_qtail == NULL) {
+		sc->e_qhead = sc->e_qtail = r;
+	}
+	else {
+		sc->e_qtail->er_next = r;
+		sc->e_qtail = r;
+	}
+	splx(spl);
+}
+
+/*
+ * Wait for a request to complete, and return an errno for the result.
  */
 static
 int
-emu_waitdone(struct emu_softc *sc)
+emu_waitdone(struct emu_softc *sc, struct emu_req *r)
 {
-	P(sc->e_sem);
-	return translate_err(sc, sc->e_result);
+	int spl;
+
+	spl = splhigh();
+	while (!r->er_done) {
+		thread_sleep(r);
+	}
+	splx(spl);
+	return translate_err(sc, r->er_result);
 }
 
 /*
@@ -152,6 +289,7 @@ int
 emu_open(struct emu_softc *sc, u_int32_t handle, const char *name,
 	 int create, int excl, u_int32_t *newhandle, int *newisdir)
 {
+	struct emu_req *r;
 	u_int32_t op;
 	int result;
 
@@ -169,20 +307,21 @@ emu_open(struct emu_softc *sc, u_int32_t handle, const char *name,
 		op = EMU_OP_OPEN;
 	}
 
-	lock_acquire(sc->e_lock);
-
-	strcpy(sc->e_iobuf, name);
-	emu_wreg(sc, REG_IOLEN, strlen(name));
-	emu_wreg(sc, REG_HANDLE, handle);
-	emu_wreg(sc, REG_OPER, op);
-	result = emu_waitdone(sc);
+	r = emu_getreq(sc, 0);
+	strcpy(r->er_buf, name);
+	r->er_op = op;
+	r->er_handle = handle;
+	r->er_offset = 0;
+	r->er_len = strlen(name);
+	emu_submit(sc, r);
+	result = emu_waitdone(sc, r);
 
 	if (result==0) {
-		*newhandle = emu_rreg(sc, REG_HANDLE);
-		*newisdir = emu_rreg(sc, REG_IOLEN)>0;
+		*newhandle = r->er_handle;
+		*newisdir = r->er_len>0;
 	}
 
-	lock_release(sc->e_lock);
+	emu_putreq(sc, r);
 	return result;
 }
 
@@ -195,21 +334,21 @@ static
 int
 emu_close(struct emu_softc *sc, u_int32_t handle)
 {
+	struct emu_req *r;
 	int result;
-	int mine;
 	int retries=0;
 
-	mine = lock_do_i_hold(sc->e_lock);
-	if (!mine) {
-		lock_acquire(sc->e_lock);
-	}
+	r = emu_getreq(sc, 0);
 
 	while (1) {
 		/* Retry operation up to 10 times */
 
-		emu_wreg(sc, REG_HANDLE, handle);
-		emu_wreg(sc, REG_OPER, EMU_OP_CLOSE);
-		result = emu_waitdone(sc);
+		r->er_op = EMU_OP_CLOSE;
+		r->er_handle = handle;
+		r->er_offset = 0;
+		r->er_len = 0;
+		emu_submit(sc, r);
+		result = emu_waitdone(sc, r);
 
 		if (result==EIO && retries < 10) {
 			kprintf("emu%d: I/O error on close, retrying\n", 
@@ -220,53 +359,140 @@ emu_close(struct emu_softc *sc, u_int32_t handle)
 		break;
 	}
 
-	if (!mine) {
-		lock_release(sc->e_lock);
-	}
+	emu_putreq(sc, r);
 	return result;
 }
 
 /*
- * Common code for read and readdir.
+ * Start reading LEN bytes at OFFSET into a request slot.
+ */
+static
+void
+emu_startread(struct emu_softc *sc, struct emu_req *r, u_int32_t handle,
+	      u_int32_t op, u_int32_t offset, u_int32_t len)
+{
+	r->er_op = op;
+	r->er_handle = handle;
+	r->er_offset = offset;
+	r->er_len = len;
+	emu_submit(sc, r);
+}
+
+/*
+ * Common code for read and readdir. This does one request of at most
+ * LEN bytes; the data is copied out of the request slot after the
+ * device has moved on, so a slow uiomove (one that has to page in the
+ * user buffer, say) doesn't hold anyone else up.
  */
 static
 int
 emu_doread(struct emu_softc *sc, u_int32_t handle, u_int32_t len,
 	   u_int32_t op, struct uio *uio)
 {
+	struct emu_req *r;
 	int result;
 
 	assert(uio->uio_rw == UIO_READ);
 
-	lock_acquire(sc->e_lock);
-
-	emu_wreg(sc, REG_HANDLE, handle);
-	emu_wreg(sc, REG_IOLEN, len);
-	emu_wreg(sc, REG_OFFSET, uio->uio_offset);
-	emu_wreg(sc, REG_OPER, op);
-	result = emu_waitdone(sc);
+	r = emu_getreq(sc, 0);
+	emu_startread(sc, r, handle, op, uio->uio_offset, len);
+	result = emu_waitdone(sc, r);
 	if (result) {
 		goto out;
 	}
 	
-	result = uiomove(sc->e_iobuf, emu_rreg(sc, REG_IOLEN), uio);
+	result = uiomove(r->er_buf, r->er_len, uio);
 
-	uio->uio_offset = emu_rreg(sc, REG_OFFSET);
+	uio->uio_offset = r->er_offset;
 
  out:
-	lock_release(sc->e_lock);
+	emu_putreq(sc, r);
 	return result;
 }
 
 /*
- * Read from a hardware-level file handle.
+ * Read from a hardware-level file handle, until the uio is full or
+ * end of file.
+ *
+ * Large reads are done in EMU_MAXIO chunks, with the request for the
+ * next chunk queued before the current one is copied out, so the
+ * device is reading while we copy. This needs a second slot; if none
+ * is free we just go one chunk at a time.
  */
 static
 int
-emu_read(struct emu_softc *sc, u_int32_t handle, u_int32_t len,
-	 struct uio *uio)
+emu_read(struct emu_softc *sc, u_int32_t handle, struct uio *uio)
 {
-	return emu_doread(sc, handle, len, EMU_OP_READ, uio);
+	struct emu_req *cur, *next;
+	u_int32_t pos, left, len, nextlen;
+	int result;
+
+	assert(uio->uio_rw == UIO_READ);
+
+	if (uio->uio_resid <= EMU_MAXIO) {
+		return emu_doread(sc, handle, uio->uio_resid, EMU_OP_READ, uio);
+	}
+
+	pos = uio->uio_offset;
+	left = uio->uio_resid;
+
+	cur = emu_getreq(sc, 0);
+	len = EMU_MAXIO;
+	emu_startread(sc, cur, handle, EMU_OP_READ, pos, len);
+	pos += len;
+	left -= len;
+
+	while (1) {
+		/* queue the next chunk while this one is being read */
+		next = NULL;
+		nextlen = 0;
+		if (left > 0) {
+			next = emu_getreq(sc, 1);
+		}
+		if (next != NULL) {
+			nextlen = left < EMU_MAXIO ? left : EMU_MAXIO;
+			emu_startread(sc, next, handle, EMU_OP_READ, pos, nextlen);
+			pos += nextlen;
+			left -= nextlen;
+		}
+
+		result = emu_waitdone(sc, cur);
+		if (result == 0) {
+			result = uiomove(cur->er_buf, cur->er_len, uio);
+		}
+		if (result || cur->er_len < len) {
+			/* error, or end of file */
+			break;
+		}
+		uio->uio_offset = cur->er_offset;
+
+		if (next != NULL) {
+			emu_putreq(sc, cur);
+			cur = next;
+			len = nextlen;
+		}
+		else if (left > 0) {
+			/* no second slot free: carry on one chunk at a time */
+			len = left < EMU_MAXIO ? left : EMU_MAXIO;
+			emu_startread(sc, cur, handle, EMU_OP_READ, pos, len);
+			pos += len;
+			left -= len;
+		}
+		else {
+			break;
+		}
+	}
+
+	if (result == 0) {
+		uio->uio_offset = cur->er_offset;
+	}
+	if (next != NULL) {
+		/* read ahead past the end or an error; let it finish */
+		emu_waitdone(sc, next);
+		emu_putreq(sc, next);
+	}
+	emu_putreq(sc, cur);
+	return result;
 }
 
 /*
@@ -281,33 +507,36 @@ emu_readdir(struct emu_softc *sc, u_int32_t handle, u_int32_t len,
 }
 
 /*
- * Write to a hardware-level file handle.
+ * Write to a hardware-level file handle. The data is copied into a
+ * request slot before the request is queued, so again nobody waits
+ * on our uiomove.
  */
 static
 int
 emu_write(struct emu_softc *sc, u_int32_t handle, u_int32_t len,
 	  struct uio *uio)
 {
+	struct emu_req *r;
 	int result;
 
 	assert(uio->uio_rw == UIO_WRITE);
 
-	lock_acquire(sc->e_lock);
-
-	emu_wreg(sc, REG_HANDLE, handle);
-	emu_wreg(sc, REG_IOLEN, len);
-	emu_wreg(sc, REG_OFFSET, uio->uio_offset);
+	r = emu_getreq(sc, 0);
+	r->er_op = EMU_OP_WRITE;
+	r->er_handle = handle;
+	r->er_offset = uio->uio_offset;
+	r->er_len = len;
 
-	result = uiomove(sc->e_iobuf, len, uio);
+	result = uiomove(r->er_buf, len, uio);
 	if (result) {
 		goto out;
 	}
 
-	emu_wreg(sc, REG_OPER, EMU_OP_WRITE);
-	result = emu_waitdone(sc);
+	emu_submit(sc, r);
+	result = emu_waitdone(sc, r);
 
  out:
-	lock_release(sc->e_lock);
+	emu_putreq(sc, r);
 	return result;
 }
 
@@ -318,18 +547,21 @@ static
 int
 emu_getsize(struct emu_softc *sc, u_int32_t handle, off_t *retval)
 {
+	struct emu_req *r;
 	int result;
 
-	lock_acquire(sc->e_lock);
-
-	emu_wreg(sc, REG_HANDLE, handle);
-	emu_wreg(sc, REG_OPER, EMU_OP_GETSIZE);
-	result = emu_waitdone(sc);
+	r = emu_getreq(sc, 0);
+	r->er_op = EMU_OP_GETSIZE;
+	r->er_handle = handle;
+	r->er_offset = 0;
+	r->er_len = 0;
+	emu_submit(sc, r);
+	result = emu_waitdone(sc, r);
 	if (result==0) {
-		*retval = emu_rreg(sc, REG_IOLEN);
+		*retval = r->er_len;
 	}
 
-	lock_release(sc->e_lock);
+	emu_putreq(sc, r);
 	return result;
 }
 
@@ -340,16 +572,18 @@ static
 int
 emu_trunc(struct emu_softc *sc, u_int32_t handle, off_t len)
 {
+	struct emu_req *r;
 	int result;
 
-	lock_acquire(sc->e_lock);
+	r = emu_getreq(sc, 0);
+	r->er_op = EMU_OP_TRUNC;
+	r->er_handle = handle;
+	r->er_offset = 0;
+	r->er_len = len;
+	emu_submit(sc, r);
+	result = emu_waitdone(sc, r);
 
-	emu_wreg(sc, REG_HANDLE, handle);
-	emu_wreg(sc, REG_IOLEN, len);
-	emu_wreg(sc, REG_OPER, EMU_OP_TRUNC);
-	result = emu_waitdone(sc);
-
-	lock_release(sc->e_lock);
+	emu_putreq(sc, r);
 	return result;
 }
 
@@ -490,21 +724,15 @@ int
 emufs_read(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
-	u_int32_t amt;
 	size_t oldresid;
 	int result;
 
 	assert(uio->uio_rw==UIO_READ);
 
 	while (uio->uio_resid > 0) {
-		amt = uio->uio_resid;
-		if (amt > EMU_MAXIO) {
-			amt = EMU_MAXIO;
-		}
-
 		oldresid = uio->uio_resid;
 
-		result = emu_read(ev->ev_emu, ev->ev_handle, amt, uio);
+		result = emu_read(ev->ev_emu, ev->ev_handle, uio);
 		if (result) {
 			return result;
 		}
@@ -1092,17 +1320,25 @@ int
 config_emu(struct emu_softc *sc, int emuno)
 {
 	char name[32];
+	int i;
 
 	sc->e_lock = lock_create("emufs-lock");
 	if (sc->e_lock == NULL) {
 		return ENOMEM;
 	}
-	sc->e_sem = sem_create("emufs-sem", 0);
-	if (sc->e_sem == NULL) {
-		lock_destroy(sc->e_lock);
-		sc->e_lock = NULL;
-		return ENOMEM;
+	for (i=0; i<EMU_NSLOTS; i++) {
+		sc->e_slots[i].er_buf = kmalloc(EMU_MAXIO);
+		if (sc->e_slots[i].er_buf == NULL) {
+			while (i-- > 0) {
+				kfree(sc->e_slots[i].er_buf);
+			}
+			lock_destroy(sc->e_lock);
+			sc->e_lock = NULL;
+			return ENOMEM;
+		}
+		sc->e_slots[i].er_inuse = 0;
 	}
+	sc->e_cur = sc->e_qhead = sc->e_qtail = NULL;
 	sc->e_iobuf = bus_map_area(sc->e_busdata, sc->e_buspos, EMU_BUFFER);
 
 	snprintf(name, sizeof(name), "emu%d", emuno);
@@ -4,6 +4,30 @@
 #define EMU_MAXIO       16384
 #define EMU_ROOTHANDLE  0
 
+/*
+ * Number of requests that can be outstanding at once. The device only
+ * works on one at a time; the rest wait in a queue, and the interrupt
+ * handler starts the next one as soon as the current one finishes.
+ */
+#define EMU_NSLOTS      4
+
+/*
+ * One request to the device. er_buf holds the data for writes (and
+ * the name for opens) on the way in, and the data for reads on the
+ * way out, so callers never touch the shared device buffer.
+ */
+struct emu_req {
+	u_int32_t er_op;		/* EMU_OP_* */
+	u_int32_t er_handle;		/* in; new handle out for opens */
+	u_int32_t er_offset;		/* in; new offset out */
+	u_int32_t er_len;		/* in; length/size/isdir out */
+	void *er_buf;			/* EMU_MAXIO bytes */
+	u_int32_t er_result;		/* EMU_RES_*, set on completion */
+	int er_done;			/* set on completion */
+	int er_inuse;			/* slot allocated */
+	struct emu_req *er_next;	/* queue of requests to start */
+};
+
 /*
  * The per-device data used by the emufs device driver.
  * (Note that this is only a small portion of its actual data;
@@ -17,12 +41,14 @@ struct emu_softc {
 	int e_unit;
 
 	/* Initialized by config_emu() */
-	struct lock *e_lock;
-	struct semaphore *e_sem;
+	struct lock *e_lock;		/* protects the emufs vnode table */
 	void *e_iobuf;
+	struct emu_req e_slots[EMU_NSLOTS];
 
-	/* Written by the interrupt handler */
-	u_int32_t e_result;
+	/* Protected by splhigh; the interrupt handler changes them */
+	struct emu_req *e_cur;		/* request the device is working on */
+	struct emu_req *e_qhead;	/* requests waiting for the device */
+	struct emu_req *e_qtail;
 };
 
 /* Functions called by lower-level drivers */
@@ -4,9 +4,10 @@
 
 #include <types.h>
 #include <lib.h>
-#include <synch.h>
 #include <kern/errno.h>
 #include <machine/bus.h>
+#include <machine/spl.h>
+#include <thread.h>
 #include <uio.h>
 #include <vfs.h>
 #include <lamebus/lhd.h>
@@ -66,15 +67,131 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 }
 
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Start the card on the next sector. If no request is in progress,
+ * pick the next one off the queue in C-LOOK order: the lowest sector
+ * at or after the last one started, or, if there is none, the lowest
+ * sector overall. Called at splhigh.
+ */
+static
+void
+lhd_start(struct lhd_softc *lh)
+{
+	struct devreq *req, **pp, **best;
+	u_int32_t sector, statval;
+
+	if (lh->lh_cur == NULL) {
+		if (lh->lh_queue == NULL) {
+			return;
+		}
+		best = &lh->lh_queue;
+		for (pp = &lh->lh_queue; *pp != NULL; pp = &(*pp)->dr_next) {
+			if ((*pp)->dr_block >= lh->lh_headpos) {
+				best = pp;
+				break;
+			}
+		}
+		req = *best;
+		*best = req->dr_next;
+		req->dr_next = NULL;
+
+		lh->lh_cur = req;
+		lh->lh_curdone = 0;
+	}
+
+	req = lh->lh_cur;
+	sector = req->dr_block + lh->lh_curdone;
+	statval = LHD_WORKING;
+
+	/* Writes go through the on-card buffer. */
+	if (req->dr_write) {
+		memcpy(lh->lh_buf,
+		       (char *)req->dr_data + lh->lh_curdone*LHD_SECTSIZE,
+		       LHD_SECTSIZE);
+		statval |= LHD_ISWRITE;
+	}
+
+	/* Tell it what sector we want, and start the operation. */
+	lhd_wreg(lh, LHD_REG_SECT, sector);
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+	lh->lh_headpos = sector;
+}
+
+/*
+ * Record that a sector has completed. Move on to the next sector of
+ * the request, or finish the request and start the next one.
+ * Called from the interrupt handler.
  */
 static
 void
 lhd_iodone(struct lhd_softc *lh, int err)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	struct devreq *req = lh->lh_cur;
+
+	if (req == NULL) {
+		kprintf("lhd%d: Spurious completion\n", lh->lh_unit);
+		return;
+	}
+
+	/* Reads come back through the on-card buffer. */
+	if (err==0 && !req->dr_write) {
+		memcpy((char *)req->dr_data + lh->lh_curdone*LHD_SECTSIZE,
+		       lh->lh_buf, LHD_SECTSIZE);
+	}
+
+	lh->lh_curdone++;
+	if (err==0 && lh->lh_curdone < req->dr_nblocks) {
+		lhd_start(lh);
+		return;
+	}
+
+	lh->lh_cur = NULL;
+	req->dr_result = err;
+	req->dr_busy = 0;
+	if (req->dr_done != NULL) {
+		req->dr_done(req);
+	}
+	thread_wakeup(req);
+
+	lhd_start(lh);
+}
+
+/*
+ * Queue a request. This is d_strategy.
+ */
+static
+int
+lhd_strategy(struct device *d, struct devreq *req)
+{
+	struct lhd_softc *lh = d->d_data;
+	struct devreq **pp;
+	int spl;
+
+	/* Don't allow I/O past the end of the disk. */
+	if (req->dr_nblocks == 0 ||
+	    req->dr_block + req->dr_nblocks > lh->lh_dev.d_blocks ||
+	    req->dr_block + req->dr_nblocks < req->dr_block) {
+		return EINVAL;
+	}
+
+	assert(req->dr_busy);
+
+	spl = splhigh();
+
+	/* Keep the queue sorted by sector */
+	for (pp = &lh->lh_queue; *pp != NULL; pp = &(*pp)->dr_next) {
+		if ((*pp)->dr_block > req->dr_block) {
+			break;
+		}
+	}
+	req->dr_next = *pp;
+	*pp = req;
+
+	if (lh->lh_cur == NULL) {
+		lhd_start(lh);
+	}
+
+	splx(spl);
+	return 0;
 }
 
 /*
@@ -164,22 +281,53 @@ lhd_reset(struct lhd_softc *lh)
 }
 #endif
 
+/*
+ * Queue a request and wait for it.
+ */
+static
+int
+lhd_syncio(struct lhd_softc *lh, struct devreq *req)
+{
+	int spl, result;
+
+	req->dr_done = NULL;
+	req->dr_busy = 1;
+
+	spl = splhigh();
+	result = lhd_strategy(&lh->lh_dev, req);
+	if (result == 0) {
+		while (req->dr_busy) {
+			thread_sleep(req);
+		}
+		result = req->dr_result;
+	}
+	splx(spl);
+
+	return result;
+}
+
 /*
  * I/O function (for both reads and writes)
+ *
+ * A request may cover any number of sectors, and goes into the queue
+ * as one request so the sectors are done back to back. Kernel buffers
+ * are handed to the device as they are; user buffers are copied
+ * through a bounce buffer one sector at a time.
  */
 static
 int
 lhd_io(struct device *d, struct uio *uio)
 {
 	struct lhd_softc *lh = d->d_data;
+	struct devreq req;
+	char *bounce;
 
 	u_int32_t sector = uio->uio_offset / LHD_SECTSIZE;
 	u_int32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
 	u_int32_t len = uio->uio_resid / LHD_SECTSIZE;
 	u_int32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
 	u_int32_t i;
-	u_int32_t statval = LHD_WORKING;
-	int result;
+	int result = 0;
 
 	/* Don't allow I/O that isn't sector-aligned. */
 	if (sectoff != 0 || lenoff != 0) {
@@ -191,59 +339,63 @@ lhd_io(struct device *d, struct uio *uio)
 		return EINVAL;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
+	if (len == 0) {
+		return 0;
 	}
 
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
+	req.dr_write = (uio->uio_rw == UIO_WRITE);
 
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
+	if (uio->uio_segflg == UIO_SYSSPACE) {
+		assert(uio->uio_iovec.iov_len >= uio->uio_resid);
 
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
-		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-			if (result) {
-				V(lh->lh_clear);
-				return result;
-			}
+		req.dr_block = sector;
+		req.dr_nblocks = len;
+		req.dr_data = uio->uio_iovec.iov_kbase;
+		result = lhd_syncio(lh, &req);
+		if (result) {
+			return result;
 		}
 
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
-
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
-
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
+		/* Account for the transfer as uiomove would have */
+		uio->uio_iovec.iov_kbase = (char *)uio->uio_iovec.iov_kbase
+			+ len*LHD_SECTSIZE;
+		uio->uio_iovec.iov_len -= len*LHD_SECTSIZE;
+		uio->uio_offset += len*LHD_SECTSIZE;
+		uio->uio_resid -= len*LHD_SECTSIZE;
+		return 0;
+	}
 
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
+	bounce = kmalloc(LHD_SECTSIZE);
+	if (bounce == NULL) {
+		return ENOMEM;
+	}
 
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
+	for (i=0; i<len; i++) {
+		if (req.dr_write) {
+			result = uiomove(bounce, LHD_SECTSIZE, uio);
+			if (result) {
+				break;
+			}
 		}
 
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
-
-		/* If we failed, return the error. */
+		req.dr_block = sector+i;
+		req.dr_nblocks = 1;
+		req.dr_data = bounce;
+		result = lhd_syncio(lh, &req);
 		if (result) {
-			return result;
+			break;
+		}
+
+		if (!req.dr_write) {
+			result = uiomove(bounce, LHD_SECTSIZE, uio);
+			if (result) {
+				break;
+			}
 		}
 	}
 
-	return 0;
+	kfree(bounce);
+	return result;
 }
 
 /*
@@ -260,23 +412,18 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
-		return ENOMEM;
-	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
-		return ENOMEM;
-	}
+	/* Nothing queued yet. */
+	lh->lh_queue = NULL;
+	lh->lh_cur = NULL;
+	lh->lh_curdone = 0;
+	lh->lh_headpos = 0;
 
 	/* Set up the VFS device structure. */
 	lh->lh_dev.d_open = lhd_open;
 	lh->lh_dev.d_close = lhd_close;
 	lh->lh_dev.d_io = lhd_io;
 	lh->lh_dev.d_ioctl = lhd_ioctl;
+	lh->lh_dev.d_strategy = lhd_strategy;
 	lh->lh_dev.d_blocks = bus_read_register(lh->lh_busdata, lh->lh_buspos,
 						LHD_REG_NSECT);
 	lh->lh_dev.d_blocksize = LHD_SECTSIZE;
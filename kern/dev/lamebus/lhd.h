@@ -22,9 +22,15 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+
+	/*
+	 * Request queue, protected by splhigh. lh_queue is kept sorted
+	 * by sector; lh_cur is the request the card is working on.
+	 */
+	struct devreq *lh_queue;	/* waiting requests */
+	struct devreq *lh_cur;		/* request in progress, or NULL */
+	u_int32_t lh_curdone;		/* sectors of lh_cur finished */
+	u_int32_t lh_headpos;		/* last sector started */
 
 	struct device lh_dev;		/* VFS device structure */
 };
@@ -7,30 +7,28 @@
 #include <types.h>
 #include <lib.h>
 #include <kern/errno.h>
+#include <synch.h>
 #include <array.h>
 #include <bitmap.h>
 #include <uio.h>
 #include <dev.h>
+#include <buf.h>
 #include <sfs.h>
 #include <vfs.h>
 
-/* Shortcuts for the size macros in kern/sfs.h */
-#define SFS_FS_BITMAPSIZE(sfs)  SFS_BITMAPSIZE((sfs)->sfs_super.sp_nblocks)
-#define SFS_FS_BITBLOCKS(sfs)   SFS_BITBLOCKS((sfs)->sfs_super.sp_nblocks)
-
 /*
  * Routine for doing I/O (reads or writes) on the free block bitmap.
- * We always do the whole bitmap at once; writing individual sectors
- * might or might not be a worthwhile optimization.
+ * Reads load the whole bitmap; writes only write the sectors marked
+ * in sfs_mapdirty, since most syncs touch only one or two of them.
  *
- * The free block bitmap consists of SFS_BITBLOCKS 512-byte sectors of
- * bits, one bit for each sector on the filesystem. The number of
- * blocks in the bitmap is thus rounded up to the nearest multiple of
- * 512*8 = 4096. (This rounded number is SFS_BITMAPSIZE.) This means
- * that the bitmap will (in general) contain space for some number of
- * invalid sectors that are actually beyond the end of the disk
- * device. This is ok. These sectors are supposed to be marked "in
- * use" by mksfs and never get marked "free".
+ * The free block bitmap consists of SFS_BITBLOCKS blocks of bits, one
+ * bit for each block on the filesystem. The number of blocks in the
+ * bitmap is thus rounded up to the nearest multiple of the bits in a
+ * block (512*8 = 4096 with 512-byte blocks). (This rounded number is
+ * SFS_BITMAPSIZE.) This means that the bitmap will (in general)
+ * contain space for some number of invalid blocks that are actually
+ * beyond the end of the disk device. This is ok. These blocks are
+ * supposed to be marked "in use" by mksfs and never get marked "free".
  *
  * The sectors used by the superblock and the bitmap itself are
  * likewise marked in use by mksfs.
@@ -54,14 +52,20 @@ sfs_mapio(struct sfs_fs *sfs, enum uio_rw rw)
 	for (j=0; j<mapsize; j++) {
 
 		/* Get a pointer to its data */
-		void *ptr = bitdata + j*SFS_BLOCKSIZE;
+		void *ptr = bitdata + j*sfs->sfs_blocksize;
 
 		/* and read or write it. The bitmap starts at sector 2. */ 
 		if (rw == UIO_READ) {
 			result = sfs_rblock(sfs, ptr, SFS_MAP_LOCATION+j);
 		}
-		else {
+		else if (bitmap_isset(sfs->sfs_mapdirty, j)) {
 			result = sfs_wblock(sfs, ptr, SFS_MAP_LOCATION+j);
+			if (result == 0) {
+				bitmap_unmark(sfs->sfs_mapdirty, j);
+			}
+		}
+		else {
+			result = 0;
 		}
 
 		/* If we failed, stop. */
@@ -72,6 +76,22 @@ sfs_mapio(struct sfs_fs *sfs, enum uio_rw rw)
 	return 0;
 }
 
+/*
+ * Read or write the superblock. It is always the first 512 bytes of
+ * the volume, whatever the block size, so it can be read before the
+ * block size is known.
+ */
+static
+int
+sfs_superio(struct sfs_fs *sfs, enum uio_rw rw)
+{
+	struct uio ku;
+
+	mk_kuio(&ku, &sfs->sfs_super, sizeof(struct sfs_super),
+		((off_t)SFS_SB_LOCATION)*sfs->sfs_blocksize, rw);
+	return sfs_rwblock(sfs, &ku);
+}
+
 /*
  * Sync routine. This is what gets invoked if you do FS_SYNC on the
  * sfs filesystem structure.
@@ -116,15 +136,57 @@ sfs_sync(struct fs *fs)
 
 	sfs = fs->fs_data;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
-	num = array_getnum(sfs->sfs_vnodes);
-	for (i=0; i<num; i++) {
-		struct sfs_vnode *sv = array_getguy(sfs->sfs_vnodes, i);
-		VOP_FSYNC(&sv->sv_v);
+	/*
+	 * Go over the array of loaded vnodes, syncing as we go. On a
+	 * journaled volume, the metadata is committed all at once below
+	 * rather than file by file.
+	 *
+	 * Syncing a file sleeps, and meanwhile other vnodes may be reclaimed,
+	 * which moves the last one in the array into the hole. Going
+	 * from the end down means that one has already been synced, so
+	 * nothing is missed; just don't run off the end. Hold a
+	 * reference so the vnode itself doesn't go away underneath us.
+	 */
+	for (i=array_getnum(sfs->sfs_vnodes)-1; i>=0; i--) {
+		struct sfs_vnode *sv;
+
+		num = array_getnum(sfs->sfs_vnodes);
+		if (i >= num) {
+			i = num;
+			continue;
+		}
+		sv = array_getguy(sfs->sfs_vnodes, i);
+		VOP_INCREF(&sv->sv_v);
+		sfs_syncfile(sv);
+		VOP_DECREF(&sv->sv_v);
+	}
+
+	/*
+	 * Write back whatever else is dirty in the buffer cache:
+	 * directories and inodes of files that are no longer loaded.
+	 * Metadata on a journaled volume stays put until committed.
+	 */
+	result = buf_sync(sfs->sfs_device);
+	if (result) {
+		return result;
 	}
 
-	/* If the free block map needs to be written, write it. */
-	if (sfs->sfs_freemapdirty) {
+	if (SFS_JOURNALED(sfs)) {
+		/*
+		 * Commit the metadata and the freemap, then write it
+		 * all in place, so the log starts out empty next time.
+		 */
+		result = sfs_jcommit(sfs);
+		if (result) {
+			return result;
+		}
+		result = sfs_jcheckpoint(sfs);
+		if (result) {
+			return result;
+		}
+	}
+	else if (sfs->sfs_freemapdirty) {
+		/* The free block map needs to be written; write it. */
 		result = sfs_mapio(sfs, UIO_WRITE);
 		if (result) {
 			return result;
@@ -134,7 +196,7 @@ sfs_sync(struct fs *fs)
 
 	/* If the superblock needs to be written, write it. */
 	if (sfs->sfs_superdirty) {
-		result = sfs_wblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
+		result = sfs_superio(sfs, UIO_WRITE);
 		if (result) {
 			return result;
 		}
@@ -178,7 +240,11 @@ sfs_unmount(struct fs *fs)
 	assert(sfs->sfs_freemapdirty==0);
 
 	/* Once we start nuking stuff we can't fail. */
+	buf_invalidate(sfs->sfs_device);
+	buf_setblocksize(sfs->sfs_device, 0);
+	sfs_jcleanup(sfs);
 	array_destroy(sfs->sfs_vnodes);
+	bitmap_destroy(sfs->sfs_mapdirty);
 	bitmap_destroy(sfs->sfs_freemap);
 	
 	/* The vfs layer takes care of the device for us */
@@ -223,14 +289,11 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_dir) == 0);
 
 	/*
-	 * We can't mount on devices with the wrong sector size.
-	 *
-	 * (Note: for all intents and purposes here, "sector" and
-	 * "block" are interchangeable terms. Technically a filesystem
-	 * block may be composed of several hardware sectors, but we
-	 * don't do that in sfs.)
+	 * We can't mount on devices with the wrong sector size. A
+	 * filesystem block is a whole number of sectors: exactly one
+	 * on a version 1 volume, and maybe more on a version 2 one.
 	 */
-	if (dev->d_blocksize != SFS_BLOCKSIZE) {
+	if (SFS_BLOCKSIZE % dev->d_blocksize != 0) {
 		return ENXIO;
 	}
 
@@ -246,12 +309,14 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		kfree(sfs);
 		return ENOMEM;
 	}
+	bzero(sfs->sfs_vnhash, sizeof(sfs->sfs_vnhash));
 
-	/* Set the device so we can use sfs_rblock() */
+	/* Set the device so we can use sfs_rwblock() */
 	sfs->sfs_device = dev;
+	sfs->sfs_blocksize = SFS_BLOCKSIZE;
 
 	/* Load superblock */
-	result = sfs_rblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
+	result = sfs_superio(sfs, UIO_READ);
 	if (result) {
 		array_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
@@ -260,33 +325,82 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 
 	/* Make some simple sanity checks */
 
-	if (sfs->sfs_super.sp_magic != SFS_MAGIC) {
+	if (sfs->sfs_super.sp_magic == SFS_MAGIC) {
+		sfs->sfs_dindirect = 0;
+	}
+	else if (sfs->sfs_super.sp_magic == SFS_MAGIC2) {
+		sfs->sfs_blocksize = sfs->sfs_super.sp_blocksize;
+		sfs->sfs_dindirect = 1;
+	}
+	else {
 		kprintf("sfs: Wrong magic number in superblock "
-			"(0x%x, should be 0x%x)\n", 
+			"(0x%x, should be 0x%x or 0x%x)\n", 
 			sfs->sfs_super.sp_magic,
-			SFS_MAGIC);
+			SFS_MAGIC, SFS_MAGIC2);
 		array_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
 		return EINVAL;
 	}
-	
-	if (sfs->sfs_super.sp_nblocks > dev->d_blocks) {
+
+	/* a power of 2, made of whole sectors, that the cache can hold */
+	if (sfs->sfs_blocksize < SFS_BLOCKSIZE ||
+	    sfs->sfs_blocksize > SFS_MAXBLOCKSIZE ||
+	    (sfs->sfs_blocksize & (sfs->sfs_blocksize-1)) != 0 ||
+	    sfs->sfs_blocksize % dev->d_blocksize != 0) {
+		kprintf("sfs: Bad block size %u in superblock\n",
+			sfs->sfs_blocksize);
+		array_destroy(sfs->sfs_vnodes);
+		kfree(sfs);
+		return EINVAL;
+	}
+	sfs->sfs_dbperidb = SFS_DBPERBLOCK(sfs->sfs_blocksize);
+
+	if (sfs->sfs_super.sp_nblocks >
+	    dev->d_blocks / (sfs->sfs_blocksize / dev->d_blocksize)) {
 		kprintf("sfs: warning - fs has %u blocks, device has %u\n",
-			sfs->sfs_super.sp_nblocks, dev->d_blocks);
+			sfs->sfs_super.sp_nblocks,
+			dev->d_blocks / (sfs->sfs_blocksize / dev->d_blocksize));
 	}
 
+	/* From here on the cache deals in our blocks */
+	buf_setblocksize(dev, sfs->sfs_blocksize);
+
 	/* Ensure null termination of the volume name */
 	sfs->sfs_super.sp_volname[sizeof(sfs->sfs_super.sp_volname)-1] = 0;
 
+	/* Finish any metadata updates that were cut off by a crash */
+	result = sfs_jreplay(sfs);
+	if (result) {
+		buf_setblocksize(dev, 0);
+		array_destroy(sfs->sfs_vnodes);
+		kfree(sfs);
+		return result;
+	}
+
 	/* Load free space bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_BITMAPSIZE(sfs));
 	if (sfs->sfs_freemap == NULL) {
+		buf_setblocksize(dev, 0);
+		array_destroy(sfs->sfs_vnodes);
+		kfree(sfs);
+		return ENOMEM;
+	}
+	sfs->sfs_mapdirty = bitmap_create(SFS_FS_BITBLOCKS(sfs));
+	if (sfs->sfs_mapdirty == NULL) {
+		buf_setblocksize(dev, 0);
+		bitmap_destroy(sfs->sfs_freemap);
 		array_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
 		return ENOMEM;
 	}
 	result = sfs_mapio(sfs, UIO_READ);
+	if (result == 0) {
+		result = sfs_jinit(sfs);
+	}
 	if (result) {
+		buf_invalidate(dev);
+		buf_setblocksize(dev, 0);
+		bitmap_destroy(sfs->sfs_mapdirty);
 		bitmap_destroy(sfs->sfs_freemap);
 		array_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
@@ -317,5 +431,11 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 int
 sfs_mount(const char *device)
 {
+	int result;
+
+	result = sfs_initcache();
+	if (result) {
+		return result;
+	}
 	return vfs_mount(device, NULL, sfs_domount);
 }
@@ -12,7 +12,15 @@
 // Note: sfs_rblock is used to read the superblock
 // early in mount, before sfs is fully (or even mostly)
 // initialized, and so may not use anything from sfs
-// except sfs_device.
+// except sfs_device and sfs_blocksize.
+//
+// Only the superblock and the free block bitmap are read and
+// written with these directly. Inodes, directories, indirect blocks,
+// and file data all go through the buffer cache (see buf.h), and
+// must not be accessed here or the cache will go stale. The
+// exception is the journal (sfs_journal.c), which writes committed
+// copies of metadata in place when the cache either doesn't have
+// the block or has newer contents for it that aren't committed.
 
 int
 sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
@@ -22,7 +30,7 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 
 	DEBUG(DB_SFS, "sfs: %s %u\n", 
 	      uio->uio_rw == UIO_READ ? "read" : "write",
-	      uio->uio_offset / SFS_BLOCKSIZE);
+	      uio->uio_offset / sfs->sfs_blocksize);
 
  retry:
 	result = sfs->sfs_device->d_io(sfs->sfs_device, uio);
@@ -38,7 +46,7 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 		if (tries == 0) {
 			tries++;
 			kprintf("sfs: block %u I/O error, retrying\n",
-				uio->uio_offset / SFS_BLOCKSIZE);
+				uio->uio_offset / sfs->sfs_blocksize);
 			goto retry;
 		}
 		else if (tries < 10) {
@@ -48,7 +56,7 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 		else {
 			kprintf("sfs: block %u I/O error, giving up after "
 				"%d retries\n",
-				uio->uio_offset / SFS_BLOCKSIZE, tries);
+				uio->uio_offset / sfs->sfs_blocksize, tries);
 		}
 	}
 	return result;
@@ -58,7 +66,7 @@ int
 sfs_rblock(struct sfs_fs *sfs, void *data, u_int32_t block)
 {
 	struct uio ku;
-	SFSUIO(&ku, data, block, UIO_READ);
+	SFSUIO(sfs, &ku, data, block, UIO_READ);
 	return sfs_rwblock(sfs, &ku);
 }
 
@@ -66,6 +74,6 @@ int
 sfs_wblock(struct sfs_fs *sfs, void *data, u_int32_t block)
 {
 	struct uio ku;
-	SFSUIO(&ku, data, block, UIO_WRITE);
+	SFSUIO(sfs, &ku, data, block, UIO_WRITE);
 	return sfs_rwblock(sfs, &ku);
 }
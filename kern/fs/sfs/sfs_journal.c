@@ -0,0 +1,703 @@
+/*
+ * SFS filesystem
+ *
+ * Write-ahead journal for metadata.
+ *
+ * Inodes, indirect blocks, directories, and the free block bitmap are
+ * not written in place as they change. Instead, sfs_jcommit copies
+ * the changed blocks into the log as one transaction (see kern/sfs.h
+ * for the layout), and only once its commit block is on disk are the
+ * blocks allowed to go to their home locations. If we crash partway
+ * through an update, sfs_jreplay copies every committed transaction
+ * to its home locations at the next mount, so the disk always holds
+ * either all of an update or none of it.
+ *
+ * The buffer cache holds metadata back until it is committed (see
+ * buf_markmeta). The freemap isn't in the buffer cache, so we keep
+ * our own copy of the freemap blocks as last committed and write
+ * those in place.
+ *
+ * The log is filled from the start. sfs_jcheckpoint writes every
+ * committed block in place and then empties the log, which is done
+ * on each sync and whenever the next transaction wouldn't fit.
+ *
+ * A block with a copy in the log must not be reused until the log is
+ * emptied: if it were reused for file data, which is written in
+ * place, replay after a crash would copy the old metadata over it.
+ * So when such a block is freed, sfs_jholdfree keeps it marked in use
+ * and it is only really freed by the next checkpoint.
+ *
+ * A transaction must hold whole operations: a create that sleeps
+ * between allocating the inode and linking it into the directory
+ * can't be logged halfway. The vnode operations that change metadata
+ * are bracketed by sfs_opbegin and sfs_opend, and a commit waits for
+ * those in progress to finish (holding off new ones meanwhile) before
+ * it looks at anything. It then copies the loaded inodes into the
+ * buffer cache, since that is where it finds the blocks to log.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <bitmap.h>
+#include <machine/spl.h>
+#include <thread.h>
+#include <uio.h>
+#include <dev.h>
+#include <buf.h>
+#include <sfs.h>
+
+/* Where the log is: everything in the journal after the header */
+#define SFS_JLOGSTART(sfs)  ((sfs)->sfs_super.sp_jstart + 1)
+#define SFS_JLOGSIZE(sfs)   ((sfs)->sfs_super.sp_jblocks - 1)
+
+/*
+ * Check that a block named in a descriptor is one the journal could
+ * have put there: not the superblock, nor part of the journal itself.
+ */
+static
+int
+sfs_jtarget_ok(struct sfs_fs *sfs, u_int32_t block)
+{
+	struct sfs_super *sp = &sfs->sfs_super;
+
+	if (block == SFS_SB_LOCATION || block >= sp->sp_nblocks) {
+		return 0;
+	}
+	if (block >= sp->sp_jstart && block < sp->sp_jstart + sp->sp_jblocks) {
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Write the journal header, which empties the log of every
+ * transaction numbered before SEQ.
+ */
+static
+int
+sfs_jwriteheader(struct sfs_fs *sfs, void *buf, u_int32_t seq)
+{
+	struct sfs_jheader *jh = buf;
+
+	bzero(jh, sfs->sfs_blocksize);
+	jh->jh_magic = SFS_JHDR_MAGIC;
+	jh->jh_seq = seq;
+	return sfs_wblock(sfs, jh, sfs->sfs_super.sp_jstart);
+}
+
+/*
+ * Go through the committed transactions in the log, starting with
+ * transaction number SEQ at the start of the log, and copy the blocks
+ * in them to their home locations. If HELDONLY is set, only blocks
+ * the buffer cache is holding back for the journal are copied; the
+ * cache has newer contents for them that can't be written yet.
+ *
+ * BUF is two blocks of scratch space. The number of transactions
+ * found is handed back in NTX.
+ */
+static
+int
+sfs_jscan(struct sfs_fs *sfs, void *buf, u_int32_t seq, int heldonly,
+	  u_int32_t *ntx)
+{
+	struct sfs_jdesc *jd = buf;
+	struct sfs_jcommit *jc = (void *)((char *)buf + sfs->sfs_blocksize);
+	u_int32_t logstart, logsize, pos, n, i, target;
+	int result;
+
+	logstart = SFS_JLOGSTART(sfs);
+	logsize = SFS_JLOGSIZE(sfs);
+	*ntx = 0;
+
+	for (pos = 0; pos + 2 <= logsize; pos += n + 2) {
+		result = sfs_rblock(sfs, jd, logstart + pos);
+		if (result) {
+			return result;
+		}
+		n = jd->jd_nblocks;
+		if (jd->jd_magic != SFS_JDESC_MAGIC || jd->jd_seq != seq ||
+		    n == 0 || n > SFS_JDESC_MAX || pos + n + 2 > logsize) {
+			/* End of the log */
+			break;
+		}
+
+		result = sfs_rblock(sfs, jc, logstart + pos + n + 1);
+		if (result) {
+			return result;
+		}
+		if (jc->jc_magic != SFS_JCOMMIT_MAGIC || jc->jc_seq != seq ||
+		    jc->jc_nblocks != n) {
+			/* Never committed; ignore it */
+			break;
+		}
+
+		for (i=0; i<n; i++) {
+			target = jd->jd_blocks[i];
+			if (!sfs_jtarget_ok(sfs, target)) {
+				kprintf("sfs: journal transaction %u has "
+					"bad block number %u\n", seq, target);
+				return EINVAL;
+			}
+			if (heldonly && !buf_isheld(sfs->sfs_device, target)) {
+				continue;
+			}
+
+			/* The commit block is done with; reuse its space */
+			result = sfs_rblock(sfs, jc, logstart + pos + 1 + i);
+			if (result) {
+				return result;
+			}
+			result = sfs_wblock(sfs, jc, target);
+			if (result) {
+				return result;
+			}
+		}
+
+		seq++;
+		(*ntx)++;
+	}
+
+	return 0;
+}
+
+/*
+ * Mount-time recovery. Called before the freemap is loaded, since
+ * the journal may hold newer freemap blocks than their home
+ * locations do.
+ */
+int
+sfs_jreplay(struct sfs_fs *sfs)
+{
+	struct sfs_super *sp = &sfs->sfs_super;
+	struct sfs_jheader *jh;
+	u_int32_t mapblocks, seq, ntx;
+	void *buf;
+	int result;
+
+	if (!SFS_JOURNALED(sfs)) {
+		return 0;
+	}
+
+	mapblocks = SFS_FS_BITBLOCKS(sfs);
+	if (sp->sp_jstart < SFS_MAP_LOCATION + mapblocks ||
+	    sp->sp_jstart + sp->sp_jblocks > sp->sp_nblocks ||
+	    sp->sp_jblocks - 1 < mapblocks + 3 ||
+	    mapblocks + 1 > SFS_JDESC_MAX) {
+		kprintf("sfs: %s: bad journal location %u (%u blocks)\n",
+			sp->sp_volname, sp->sp_jstart, sp->sp_jblocks);
+		return EINVAL;
+	}
+
+	buf = kmalloc(2*sfs->sfs_blocksize);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
+	jh = buf;
+	result = sfs_rblock(sfs, jh, sp->sp_jstart);
+	if (result) {
+		kfree(buf);
+		return result;
+	}
+	if (jh->jh_magic != SFS_JHDR_MAGIC) {
+		kprintf("sfs: %s: bad journal header\n", sp->sp_volname);
+		kfree(buf);
+		return EINVAL;
+	}
+	seq = jh->jh_seq;
+
+	result = sfs_jscan(sfs, buf, seq, 0, &ntx);
+	if (result) {
+		kfree(buf);
+		return result;
+	}
+
+	if (ntx > 0) {
+		kprintf("sfs: %s: replayed %u journal transaction%s\n",
+			sp->sp_volname, ntx, ntx == 1 ? "" : "s");
+		seq += ntx;
+		result = sfs_jwriteheader(sfs, buf, seq);
+		if (result) {
+			kfree(buf);
+			return result;
+		}
+	}
+
+	kfree(buf);
+
+	sfs->sfs_jfirst = seq;
+	sfs->sfs_jseq = seq;
+	sfs->sfs_jhead = 0;
+	return 0;
+}
+
+/*
+ * Set up the in-memory journal state. Called after sfs_jreplay and
+ * after the freemap is loaded.
+ */
+int
+sfs_jinit(struct sfs_fs *sfs)
+{
+	u_int32_t mapbytes;
+
+	sfs->sfs_jlock = NULL;
+	sfs->sfs_nops = 0;
+	sfs->sfs_opwait = 0;
+	sfs->sfs_mapckpt = NULL;
+	sfs->sfs_mapstage = NULL;
+	sfs->sfs_mapcommit = NULL;
+	sfs->sfs_jbuf = NULL;
+	sfs->sfs_jlogged = NULL;
+	sfs->sfs_jfreed = NULL;
+
+	if (!SFS_JOURNALED(sfs)) {
+		return 0;
+	}
+
+	mapbytes = SFS_FS_BITBLOCKS(sfs) * sfs->sfs_blocksize;
+
+	sfs->sfs_jlock = lock_create("sfs journal");
+	sfs->sfs_mapckpt = bitmap_create(SFS_FS_BITBLOCKS(sfs));
+	sfs->sfs_mapstage = kmalloc(mapbytes);
+	sfs->sfs_mapcommit = kmalloc(mapbytes);
+	sfs->sfs_jbuf = kmalloc(2*sfs->sfs_blocksize);
+	sfs->sfs_jlogged = bitmap_create(SFS_FS_BITMAPSIZE(sfs));
+	sfs->sfs_jfreed = bitmap_create(SFS_FS_BITMAPSIZE(sfs));
+	if (sfs->sfs_jlock == NULL || sfs->sfs_mapckpt == NULL ||
+	    sfs->sfs_mapstage == NULL || sfs->sfs_mapcommit == NULL ||
+	    sfs->sfs_jbuf == NULL || sfs->sfs_jlogged == NULL ||
+	    sfs->sfs_jfreed == NULL) {
+		sfs_jcleanup(sfs);
+		return ENOMEM;
+	}
+
+	return 0;
+}
+
+void
+sfs_jcleanup(struct sfs_fs *sfs)
+{
+	if (sfs->sfs_jlock != NULL) {
+		lock_destroy(sfs->sfs_jlock);
+		sfs->sfs_jlock = NULL;
+	}
+	if (sfs->sfs_mapckpt != NULL) {
+		bitmap_destroy(sfs->sfs_mapckpt);
+		sfs->sfs_mapckpt = NULL;
+	}
+	if (sfs->sfs_mapstage != NULL) {
+		kfree(sfs->sfs_mapstage);
+		sfs->sfs_mapstage = NULL;
+	}
+	if (sfs->sfs_mapcommit != NULL) {
+		kfree(sfs->sfs_mapcommit);
+		sfs->sfs_mapcommit = NULL;
+	}
+	if (sfs->sfs_jbuf != NULL) {
+		kfree(sfs->sfs_jbuf);
+		sfs->sfs_jbuf = NULL;
+	}
+	if (sfs->sfs_jlogged != NULL) {
+		bitmap_destroy(sfs->sfs_jlogged);
+		sfs->sfs_jlogged = NULL;
+	}
+	if (sfs->sfs_jfreed != NULL) {
+		bitmap_destroy(sfs->sfs_jfreed);
+		sfs->sfs_jfreed = NULL;
+	}
+}
+
+/*
+ * Called when BLOCK is freed. If it has a copy in the log, keep it
+ * from being reused until the next checkpoint, and return 1; the
+ * caller must then leave it marked in use for now.
+ */
+int
+sfs_jholdfree(struct sfs_fs *sfs, u_int32_t block)
+{
+	if (!SFS_JOURNALED(sfs) || !bitmap_isset(sfs->sfs_jlogged, block)) {
+		return 0;
+	}
+	if (!bitmap_isset(sfs->sfs_jfreed, block)) {
+		bitmap_mark(sfs->sfs_jfreed, block);
+	}
+	return 1;
+}
+
+/*
+ * Start an operation that changes metadata. If a commit is waiting
+ * for the ones in progress, wait for it instead of holding it up.
+ * Operations mustn't nest, or one could wait on a commit that is
+ * waiting on it.
+ */
+void
+sfs_opbegin(struct sfs_fs *sfs)
+{
+	int spl;
+
+	if (!SFS_JOURNALED(sfs)) {
+		return;
+	}
+
+	spl = splhigh();
+	while (sfs->sfs_opwait) {
+		thread_sleep(&sfs->sfs_opwait);
+	}
+	sfs->sfs_nops++;
+	splx(spl);
+}
+
+void
+sfs_opend(struct sfs_fs *sfs)
+{
+	int spl;
+
+	if (!SFS_JOURNALED(sfs)) {
+		return;
+	}
+
+	spl = splhigh();
+	assert(sfs->sfs_nops > 0);
+	sfs->sfs_nops--;
+	if (sfs->sfs_nops == 0 && sfs->sfs_opwait) {
+		thread_wakeup(&sfs->sfs_nops);
+	}
+	splx(spl);
+}
+
+/*
+ * Take sfs_jlock and wait until no operation is in progress; new
+ * ones wait until sfs_jresume.
+ */
+static
+void
+sfs_jquiesce(struct sfs_fs *sfs)
+{
+	int spl;
+
+	lock_acquire(sfs->sfs_jlock);
+
+	spl = splhigh();
+	sfs->sfs_opwait = 1;
+	while (sfs->sfs_nops > 0) {
+		thread_sleep(&sfs->sfs_nops);
+	}
+	splx(spl);
+}
+
+static
+void
+sfs_jresume(struct sfs_fs *sfs)
+{
+	int spl;
+
+	spl = splhigh();
+	sfs->sfs_opwait = 0;
+	thread_wakeup(&sfs->sfs_opwait);
+	splx(spl);
+
+	lock_release(sfs->sfs_jlock);
+}
+
+/*
+ * Now that the log is empty, really free the blocks sfs_jholdfree
+ * held on to, and forget what was in the log.
+ */
+static
+void
+sfs_jreleasefreed(struct sfs_fs *sfs)
+{
+	unsigned char *freed = bitmap_getdata(sfs->sfs_jfreed);
+	u_int32_t nbytes = SFS_FS_BITMAPSIZE(sfs) / CHAR_BIT;
+	u_int32_t i, j, block, mapblock;
+
+	/*
+	 * Nothing is in the log any more. The map is never allocated
+	 * from, so it can just be cleared.
+	 */
+	bzero(bitmap_getdata(sfs->sfs_jlogged), nbytes);
+
+	for (i=0; i<nbytes; i++) {
+		if (freed[i] == 0) {
+			continue;
+		}
+		for (j=0; j<CHAR_BIT; j++) {
+			if ((freed[i] & (1 << j)) == 0) {
+				continue;
+			}
+			block = i*CHAR_BIT + j;
+			bitmap_unmark(sfs->sfs_jfreed, block);
+
+			/* as in sfs_bfree; this may sleep */
+			buf_discard(sfs->sfs_device, block);
+
+			bitmap_unmark(sfs->sfs_freemap, block);
+			mapblock = block / SFS_BLOCKBITS(sfs->sfs_blocksize);
+			if (!bitmap_isset(sfs->sfs_mapdirty, mapblock)) {
+				bitmap_mark(sfs->sfs_mapdirty, mapblock);
+			}
+			sfs->sfs_freemapdirty = 1;
+		}
+	}
+}
+
+/*
+ * Write one transaction at the head of the log: the descriptor in
+ * sfs_jbuf, which lists NMAP freemap blocks (staged in sfs_mapstage)
+ * followed by NMETA blocks from the buffer cache, then a copy of each
+ * of those blocks, and last the commit block.
+ */
+static
+int
+sfs_jwrite(struct sfs_fs *sfs, u_int32_t nmap, u_int32_t nmeta)
+{
+	struct sfs_jdesc *jd = sfs->sfs_jbuf;
+	struct sfs_jcommit *jc;
+	struct buf *b;
+	u_int32_t pos, n, i, j;
+	int result;
+
+	n = nmap + nmeta;
+	pos = SFS_JLOGSTART(sfs) + sfs->sfs_jhead;
+
+	jd->jd_magic = SFS_JDESC_MAGIC;
+	jd->jd_seq = sfs->sfs_jseq;
+	jd->jd_nblocks = n;
+	result = sfs_wblock(sfs, jd, pos);
+	if (result) {
+		return result;
+	}
+
+	for (i=0; i<nmap; i++) {
+		j = jd->jd_blocks[i] - SFS_MAP_LOCATION;
+		result = sfs_wblock(sfs,
+				    sfs->sfs_mapstage + j*sfs->sfs_blocksize,
+				    pos + 1 + i);
+		if (result) {
+			return result;
+		}
+	}
+
+	for (i=nmap; i<n; i++) {
+		result = buf_read(sfs->sfs_device, jd->jd_blocks[i], &b);
+		if (result) {
+			return result;
+		}
+		result = sfs_wblock(sfs, b->b_data, pos + 1 + i);
+		buf_release(b);
+		if (result) {
+			return result;
+		}
+	}
+
+	/* Only now does the transaction count */
+	jc = (void *)((char *)sfs->sfs_jbuf + sfs->sfs_blocksize);
+	bzero(jc, sfs->sfs_blocksize);
+	jc->jc_magic = SFS_JCOMMIT_MAGIC;
+	jc->jc_seq = sfs->sfs_jseq;
+	jc->jc_nblocks = n;
+	return sfs_wblock(sfs, jc, pos + 1 + n);
+}
+
+/*
+ * Checkpoint, with sfs_jlock held and no operation in progress.
+ */
+static
+int
+sfs_docheckpoint(struct sfs_fs *sfs)
+{
+	u_int32_t mapblocks, j, ntx;
+	int result;
+
+	if (sfs->sfs_jhead == 0) {
+		return 0;
+	}
+
+	/*
+	 * Blocks that changed again since they were committed are held
+	 * in the cache; put their committed contents in place from the
+	 * log. Then write back everything else.
+	 */
+	result = sfs_jscan(sfs, sfs->sfs_jbuf, sfs->sfs_jfirst, 1, &ntx);
+	if (result) {
+		return result;
+	}
+	assert(ntx == sfs->sfs_jseq - sfs->sfs_jfirst);
+
+	result = buf_sync(sfs->sfs_device);
+	if (result) {
+		return result;
+	}
+
+	mapblocks = SFS_FS_BITBLOCKS(sfs);
+	for (j=0; j<mapblocks; j++) {
+		if (!bitmap_isset(sfs->sfs_mapckpt, j)) {
+			continue;
+		}
+		result = sfs_wblock(sfs,
+				    sfs->sfs_mapcommit + j*sfs->sfs_blocksize,
+				    SFS_MAP_LOCATION + j);
+		if (result) {
+			return result;
+		}
+		bitmap_unmark(sfs->sfs_mapckpt, j);
+	}
+
+	/* Everything in the log is in place now. */
+	result = sfs_jwriteheader(sfs, sfs->sfs_jbuf, sfs->sfs_jseq);
+	if (result) {
+		return result;
+	}
+	sfs->sfs_jfirst = sfs->sfs_jseq;
+	sfs->sfs_jhead = 0;
+	sfs_jreleasefreed(sfs);
+	return 0;
+}
+
+/*
+ * Commit, with sfs_jlock held and no operation in progress.
+ *
+ * One transaction holds at most SFS_JDESC_MAX blocks, so this keeps
+ * going until a transaction comes up short of full.
+ */
+static
+int
+sfs_docommit(struct sfs_fs *sfs)
+{
+	struct sfs_jdesc *jd = sfs->sfs_jbuf;
+	char *bitdata;
+	u_int32_t mapblocks, logsize, room, nmap, max, i, j;
+	int nmeta, result;
+
+	mapblocks = SFS_FS_BITBLOCKS(sfs);
+	logsize = SFS_JLOGSIZE(sfs);
+	bitdata = bitmap_getdata(sfs->sfs_freemap);
+
+	/* Changed inodes are only in their vnodes until this */
+	result = sfs_syncinodes(sfs);
+	if (result) {
+		return result;
+	}
+
+	while (1) {
+		/*
+		 * Blocks in files' preallocation windows are marked in
+		 * the live freemap but belong to nobody on disk; give
+		 * them back before it is logged so a crash can't leak
+		 * them.
+		 */
+		sfs_prealloc_releaseall(sfs);
+		nmap = bitmap_count(sfs->sfs_mapdirty);
+
+		/* Make room if we can't log the freemap and one more */
+		if (logsize - sfs->sfs_jhead < nmap + 3) {
+			result = sfs_docheckpoint(sfs);
+			if (result) {
+				return result;
+			}
+			/* that can free blocks, and we may have slept */
+			nmap = bitmap_count(sfs->sfs_mapdirty);
+		}
+		room = logsize - sfs->sfs_jhead - 2;
+		max = (room < SFS_JDESC_MAX ? room : SFS_JDESC_MAX) - nmap;
+
+		/*
+		 * Take a snapshot of the changed freemap blocks. Changes
+		 * made while we're writing mark them dirty again.
+		 */
+		i = 0;
+		for (j=0; j<mapblocks; j++) {
+			if (bitmap_isset(sfs->sfs_mapdirty, j)) {
+				bitmap_unmark(sfs->sfs_mapdirty, j);
+				memcpy(sfs->sfs_mapstage + j*sfs->sfs_blocksize,
+				       bitdata + j*sfs->sfs_blocksize,
+				       sfs->sfs_blocksize);
+				jd->jd_blocks[i++] = SFS_MAP_LOCATION + j;
+			}
+		}
+		assert(i == nmap);
+		sfs->sfs_freemapdirty = 0;
+
+		nmeta = buf_getmeta(sfs->sfs_device, &jd->jd_blocks[nmap], max);
+		if (nmap + nmeta == 0) {
+			return 0;
+		}
+
+		/*
+		 * From here on these may be in the log. Note it before
+		 * writing, since writing sleeps and they could be freed
+		 * meanwhile.
+		 */
+		for (i=nmap; i<nmap+nmeta; i++) {
+			if (!bitmap_isset(sfs->sfs_jlogged, jd->jd_blocks[i])) {
+				bitmap_mark(sfs->sfs_jlogged, jd->jd_blocks[i]);
+			}
+		}
+
+		result = sfs_jwrite(sfs, nmap, nmeta);
+		if (result) {
+			for (i=0; i<nmap; i++) {
+				j = jd->jd_blocks[i] - SFS_MAP_LOCATION;
+				if (!bitmap_isset(sfs->sfs_mapdirty, j)) {
+					bitmap_mark(sfs->sfs_mapdirty, j);
+				}
+			}
+			sfs->sfs_freemapdirty = 1;
+			return result;
+		}
+
+		/* Committed. */
+		buf_commitmeta(sfs->sfs_device, &jd->jd_blocks[nmap], nmeta);
+		for (i=0; i<nmap; i++) {
+			j = jd->jd_blocks[i] - SFS_MAP_LOCATION;
+			memcpy(sfs->sfs_mapcommit + j*sfs->sfs_blocksize,
+			       sfs->sfs_mapstage + j*sfs->sfs_blocksize,
+			       sfs->sfs_blocksize);
+			if (!bitmap_isset(sfs->sfs_mapckpt, j)) {
+				bitmap_mark(sfs->sfs_mapckpt, j);
+			}
+		}
+		sfs->sfs_jhead += nmap + nmeta + 2;
+		sfs->sfs_jseq++;
+
+		if ((u_int32_t)nmeta < max) {
+			return 0;
+		}
+	}
+}
+
+/*
+ * Commit all the metadata changed since the last commit.
+ */
+int
+sfs_jcommit(struct sfs_fs *sfs)
+{
+	int result;
+
+	assert(SFS_JOURNALED(sfs));
+
+	sfs_jquiesce(sfs);
+	result = sfs_docommit(sfs);
+	sfs_jresume(sfs);
+
+	return result;
+}
+
+/*
+ * Write every committed block in place and empty the log.
+ */
+int
+sfs_jcheckpoint(struct sfs_fs *sfs)
+{
+	int result;
+
+	assert(SFS_JOURNALED(sfs));
+
+	sfs_jquiesce(sfs);
+	result = sfs_docheckpoint(sfs);
+	sfs_jresume(sfs);
+
+	return result;
+}
@@ -13,6 +13,7 @@
 #include <kern/unistd.h>
 #include <uio.h>
 #include <dev.h>
+#include <buf.h>
 #include <sfs.h>
 
 /* At bottom of file */
@@ -20,72 +21,374 @@ static int
 sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int type,
 		 struct sfs_vnode **ret);
 
+/* Near the bottom; sfs_reclaim uses it */
+static int sfs_dotruncate(struct sfs_vnode *sv, off_t len);
+
+/*
+ * Counters for the loaded-inode table, summed over all SFS volumes.
+ * A hit is sfs_loadvnode finding the inode already in memory.
+ */
+static struct {
+	u_int32_t vs_hits;
+	u_int32_t vs_misses;
+	u_int32_t vs_loaded;            /* vnodes in memory now */
+	u_int32_t vs_maxloaded;         /* most ever at once */
+} sfs_vnstats;
+
+#define SFS_VNHASHFN(ino)  ((ino) & (SFS_VNHASH-1))
+
+/* Where sfs_vnodes come from, for all SFS volumes */
+static struct kmem_cache *sfs_vnode_cache;
+
+/*
+ * Set up sfs_vnode_cache. Called on each mount; only the first one
+ * does anything.
+ */
+int
+sfs_initcache(void)
+{
+	if (sfs_vnode_cache == NULL) {
+		sfs_vnode_cache = kmem_cache_create("sfs_vnode",
+						    sizeof(struct sfs_vnode),
+						    NULL, NULL);
+		if (sfs_vnode_cache == NULL) {
+			return ENOMEM;
+		}
+	}
+	return 0;
+}
+
 ////////////////////////////////////////////////////////////
 //
 // Simple stuff
 
+/*
+ * Mark a cached block changed. On a journaled volume, metadata
+ * (inodes, indirect blocks, and directories) waits for sfs_jcommit
+ * instead of going straight back to disk.
+ */
+static
+void
+sfs_dirtybuf(struct sfs_fs *sfs, struct buf *b, int meta)
+{
+	if (meta && SFS_JOURNALED(sfs)) {
+		buf_markmeta(b);
+	}
+	else {
+		buf_markdirty(b);
+	}
+}
+
 /* Zero out a disk block. */
 static
 int
 sfs_clearblock(struct sfs_fs *sfs, u_int32_t block)
 {
-	/* static -> automatically initialized to zero */
-	static char zeros[SFS_BLOCKSIZE];
-	return sfs_wblock(sfs, zeros, block);
+	struct buf *b;
+	int result;
+
+	/* No need to read it in; we're overwriting all of it */
+	result = buf_get(sfs->sfs_device, block, &b);
+	if (result) {
+		return result;
+	}
+	bzero(b->b_data, sfs->sfs_blocksize);
+	buf_markdirty(b);
+	buf_release(b);
+	return 0;
 }
 
-/* Write an on-disk inode structure back out to disk. */
+/*
+ * Copy an on-disk inode structure back into its block. This only
+ * goes as far as the buffer cache; sfs_flushfile puts it on disk.
+ */
 static
 int
 sfs_sync_inode(struct sfs_vnode *sv)
 {
 	if (sv->sv_dirty) {
 		struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
-		int result = sfs_wblock(sfs, &sv->sv_i, sv->sv_ino);
+		struct buf *b;
+		int result;
+
+		result = buf_get(sfs->sfs_device, sv->sv_ino, &b);
 		if (result) {
 			return result;
 		}
+		memcpy(b->b_data, &sv->sv_i, sizeof(struct sfs_inode));
+		/* the rest of a bigger block is unused; keep it clean */
+		bzero((char *)b->b_data + sizeof(struct sfs_inode),
+		      sfs->sfs_blocksize - sizeof(struct sfs_inode));
+		sfs_dirtybuf(sfs, b, 1);
+		buf_release(b);
 		sv->sv_dirty = 0;
 	}
 	return 0;
 }
 
+/*
+ * Copy the inodes of all loaded vnodes back into their blocks, for
+ * sfs_jcommit. No operation is in progress then, so none of them can
+ * be reclaimed; but buf_get sleeps and more may be loaded meanwhile,
+ * so go from the end down as sfs_sync does. Those are clean anyway.
+ */
+int
+sfs_syncinodes(struct sfs_fs *sfs)
+{
+	int i, num, result;
+
+	for (i=array_getnum(sfs->sfs_vnodes)-1; i>=0; i--) {
+		num = array_getnum(sfs->sfs_vnodes);
+		if (i >= num) {
+			i = num;
+			continue;
+		}
+		result = sfs_sync_inode(array_getguy(sfs->sfs_vnodes, i));
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Write back the blocks an indirect block points to, then the indirect
+ * block itself. LEVEL is 1 for a block of data block numbers and 2 for
+ * a double indirect block.
+ */
+static
+int
+sfs_flushind(struct sfs_fs *sfs, u_int32_t idblock, int level)
+{
+	struct device *dev = sfs->sfs_device;
+	struct buf *idb;
+	u_int32_t *idbuf;
+	u_int32_t i;
+	int result;
+
+	result = buf_read(dev, idblock, &idb);
+	if (result) {
+		return result;
+	}
+	idbuf = idb->b_data;
+	for (i=0; i<sfs->sfs_dbperidb; i++) {
+		if (idbuf[i] == 0) {
+			continue;
+		}
+		if (level > 1) {
+			result = sfs_flushind(sfs, idbuf[i], level-1);
+		}
+		else {
+			result = buf_flush(dev, idbuf[i]);
+		}
+		if (result) {
+			buf_release(idb);
+			return result;
+		}
+	}
+	buf_release(idb);
+
+	return buf_flush(dev, idblock);
+}
+
+/*
+ * Write back any dirty cached blocks belonging to a file: its data
+ * blocks, its indirect blocks, and the block its inode lives in.
+ */
+static
+int
+sfs_flushfile(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct device *dev = sfs->sfs_device;
+	u_int32_t i;
+	int result;
+
+	for (i=0; i<SFS_NDIRECT; i++) {
+		if (sv->sv_i.sfi_direct[i] != 0) {
+			result = buf_flush(dev, sv->sv_i.sfi_direct[i]);
+			if (result) {
+				return result;
+			}
+		}
+	}
+
+	if (sv->sv_i.sfi_indirect != 0) {
+		result = sfs_flushind(sfs, sv->sv_i.sfi_indirect, 1);
+		if (result) {
+			return result;
+		}
+	}
+
+	if (sfs->sfs_dindirect && sv->sv_i.sfi_dindirect != 0) {
+		result = sfs_flushind(sfs, sv->sv_i.sfi_dindirect, 2);
+		if (result) {
+			return result;
+		}
+	}
+
+	return buf_flush(dev, sv->sv_ino);
+}
+
 ////////////////////////////////////////////////////////////
 //
 // Space allocation
 
+/* Values for the DOALLOC argument of sfs_bmap */
+#define SFS_NOALLOC   0   /* don't allocate; a hole comes back as 0 */
+#define SFS_ALLOC     1   /* allocate a zero-filled block */
+#define SFS_ALLOCRAW  2   /* allocate; the caller overwrites all of it */
+
+/*
+ * Note that the freemap bit for BLOCK changed, so the freemap block
+ * holding it has to be written (or journaled) on the next sync.
+ */
+static
+void
+sfs_mapchanged(struct sfs_fs *sfs, u_int32_t block)
+{
+	u_int32_t mapblock = block / SFS_BLOCKBITS(sfs->sfs_blocksize);
+
+	if (!bitmap_isset(sfs->sfs_mapdirty, mapblock)) {
+		bitmap_mark(sfs->sfs_mapdirty, mapblock);
+	}
+	sfs->sfs_freemapdirty = 1;
+}
+
 /*
- * Allocate a block.
+ * Allocate a block, taking the first free one at or after GOAL.
+ * The block is not cleared.
+ *
+ * If the disk looks full, the blocks held in files' preallocation
+ * windows are given back and we try once more.
  */
 static
 int
-sfs_balloc(struct sfs_fs *sfs, u_int32_t *diskblock)
+sfs_balloc(struct sfs_fs *sfs, u_int32_t goal, u_int32_t *diskblock)
 {
 	int result;
 
-	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+	result = bitmap_alloc_from(sfs->sfs_freemap, goal, diskblock);
+	if (result == ENOSPC) {
+		sfs_prealloc_releaseall(sfs);
+		result = bitmap_alloc_from(sfs->sfs_freemap, goal, diskblock);
+	}
 	if (result) {
 		return result;
 	}
-	sfs->sfs_freemapdirty = 1;
+	sfs_mapchanged(sfs, *diskblock);
 
 	if (*diskblock >= sfs->sfs_super.sp_nblocks) {
 		panic("sfs: balloc: invalid block %u\n", *diskblock);
 	}
 
-	/* Clear block before returning it */
-	return sfs_clearblock(sfs, *diskblock);
+	return 0;
 }
 
 /*
- * Free a block.
+ * Free a block. A block the journal has a copy of stays in use until
+ * the next checkpoint; see sfs_journal.c.
  */
 static
 void
 sfs_bfree(struct sfs_fs *sfs, u_int32_t diskblock)
 {
+	if (sfs_jholdfree(sfs, diskblock)) {
+		return;
+	}
+
+	/*
+	 * Drop any cached copy, so it isn't written back over the
+	 * block once it belongs to someone else.
+	 */
+	buf_discard(sfs->sfs_device, diskblock);
+
 	bitmap_unmark(sfs->sfs_freemap, diskblock);
-	sfs->sfs_freemapdirty = 1;
+	sfs_mapchanged(sfs, diskblock);
+}
+
+/*
+ * Give back the unused blocks in a file's preallocation window.
+ */
+static
+void
+sfs_prealloc_release(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+
+	while (sv->sv_npreal > 0) {
+		sv->sv_npreal--;
+		sfs_bfree(sfs, sv->sv_prealloc + sv->sv_npreal);
+	}
+}
+
+void
+sfs_prealloc_releaseall(struct sfs_fs *sfs)
+{
+	int i, num;
+
+	num = array_getnum(sfs->sfs_vnodes);
+	for (i=0; i<num; i++) {
+		sfs_prealloc_release(array_getguy(sfs->sfs_vnodes, i));
+	}
+}
+
+/*
+ * Allocate a block for a file (a data block or its indirect block),
+ * near GOAL, and zero it if CLEAR is set.
+ *
+ * Each allocation also reserves up to SFS_PREALLOC free blocks right
+ * behind it as the file's preallocation window. As long as the file
+ * keeps growing in order it is handed the next block of the window,
+ * so it ends up contiguous on disk even while other files are being
+ * written at the same time. The goal may be one block behind the
+ * window, because the block just before it may have gone to the
+ * indirect block rather than the previous data block. Any other goal
+ * means the file isn't being written in order; the window is given
+ * back and we start again at the goal.
+ *
+ * Windows are held only in the in-memory freemap and are given back
+ * at fsync and reclaim time, so they never reach the disk.
+ */
+static
+int
+sfs_balloc_file(struct sfs_vnode *sv, u_int32_t goal, int clear,
+		u_int32_t *diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	u_int32_t next;
+	int result;
+
+	if (sv->sv_npreal > 0 &&
+	    goal + 1 >= sv->sv_prealloc &&
+	    goal < sv->sv_prealloc + sv->sv_npreal) {
+		*diskblock = sv->sv_prealloc++;
+		sv->sv_npreal--;
+	}
+	else {
+		sfs_prealloc_release(sv);
+
+		result = sfs_balloc(sfs, goal, diskblock);
+		if (result) {
+			return result;
+		}
+
+		/* Reserve the free blocks right after it */
+		sv->sv_prealloc = *diskblock + 1;
+		next = sv->sv_prealloc;
+		while (sv->sv_npreal < SFS_PREALLOC &&
+		       next < sfs->sfs_super.sp_nblocks &&
+		       !bitmap_isset(sfs->sfs_freemap, next)) {
+			bitmap_mark(sfs->sfs_freemap, next);
+			sv->sv_npreal++;
+			next++;
+		}
+	}
+
+	if (clear) {
+		return sfs_clearblock(sfs, *diskblock);
+	}
+	return 0;
 }
 
 /*
@@ -106,34 +409,76 @@ sfs_bused(struct sfs_fs *sfs, u_int32_t diskblock)
 //
 // Block mapping/inode maintenance
 
+/*
+ * Look up entry IDOFF of indirect block IDBLOCK, allocating a block
+ * for it if it's empty and DOALLOC is set. A new block goes right
+ * after the one in the entry before, or at GOAL if this is the first.
+ */
+static
+int
+sfs_bmap_slot(struct sfs_vnode *sv, u_int32_t idblock, u_int32_t idoff,
+	      int doalloc, u_int32_t goal, u_int32_t *ret)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct buf *idb;
+	u_int32_t *idbuf;
+	u_int32_t block, prev;
+	int result;
+
+	/*
+	 * Load the indirect block. One we just allocated was zeroed by
+	 * sfs_clearblock and is sitting in the cache already.
+	 */
+	result = buf_read(sfs->sfs_device, idblock, &idb);
+	if (result) {
+		return result;
+	}
+	idbuf = idb->b_data;
+
+	/* Get the block out of the indirect block buffer */
+	block = idbuf[idoff];
+
+	/* If there's no block there, allocate one */
+	if (block==0 && doalloc) {
+		prev = idoff>0 ? idbuf[idoff-1] : 0;
+		result = sfs_balloc_file(sv, prev ? prev+1 : goal,
+					 doalloc==SFS_ALLOC, &block);
+		if (result) {
+			buf_release(idb);
+			return result;
+		}
+
+		/* Remember the block we allocated */
+		idbuf[idoff] = block;
+
+		/* The indirect block is now dirty */
+		sfs_dirtybuf(sfs, idb, 1);
+	}
+	buf_release(idb);
+
+	*ret = block;
+	return 0;
+}
+
 /*
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
  * file. If DOALLOC is set, and no such block exists, one will be
- * allocated.
+ * allocated (see SFS_ALLOC and SFS_ALLOCRAW above), as close as
+ * possible after the file's previous block.
  */
 static
 int
 sfs_bmap(struct sfs_vnode *sv, u_int32_t fileblock, int doalloc,
 	    u_int32_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static u_int32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
-	u_int32_t block;
+	u_int32_t dbperidb = sfs->sfs_dbperidb;
+	u_int32_t block, prev;
 	u_int32_t idblock;
 	u_int32_t idnum, idoff;
 	int result;
 
-	assert(sizeof(idbuf)==SFS_BLOCKSIZE);
-
 	/*
 	 * If the block we want is one of the direct blocks...
 	 */
@@ -147,7 +492,10 @@ sfs_bmap(struct sfs_vnode *sv, u_int32_t fileblock, int doalloc,
 		 * Do we need to allocate?
 		 */
 		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
+			prev = fileblock>0 ? sv->sv_i.sfi_direct[fileblock-1] : 0;
+			result = sfs_balloc_file(sv, 
+					prev ? prev+1 : sv->sv_ino+1,
+					doalloc==SFS_ALLOC, &block);
 			if (result) {
 				return result;
 			}
@@ -176,76 +524,96 @@ sfs_bmap(struct sfs_vnode *sv, u_int32_t fileblock, int doalloc,
 
 	fileblock -= SFS_NDIRECT;
 
-	/* Get the indirect block number and offset w/i that indirect block */
-	idnum = fileblock / SFS_DBPERIDB;
-	idoff = fileblock % SFS_DBPERIDB;
+	if (fileblock < dbperidb) {
+		/* Get the disk block number of the indirect block. */
+		idblock = sv->sv_i.sfi_indirect;
+
+		if (idblock==0 && !doalloc) {
+			/*
+			 * There's no indirect block allocated. We weren't
+			 * asked to allocate anything, so pretend the
+			 * indirect block was filled with all zeros.
+			 */
+			*diskblock = 0;
+			return 0;
+		}
+		else if (idblock==0) {
+			/*
+			 * There's no indirect block allocated, but we need
+			 * to allocate a block whose number needs to be
+			 * stored in the indirect block. Thus, we need to
+			 * allocate an indirect block. It has to start out
+			 * zeroed.
+			 */
+			prev = sv->sv_i.sfi_direct[SFS_NDIRECT-1];
+			result = sfs_balloc_file(sv,
+						 prev ? prev+1 : sv->sv_ino+1,
+						 1, &idblock);
+			if (result) {
+				return result;
+			}
 
-	/*
-	 * We only have one indirect block. If the offset we were asked for
-	 * is too large, we can't handle it, so fail.
-	 */
-	if (idnum > 0) {
-		return EINVAL;
-	}
+			/* Remember the block we just allocated */
+			sv->sv_i.sfi_indirect = idblock;
 
-	/* Get the disk block number of the indirect block. */
-	idblock = sv->sv_i.sfi_indirect;
+			/* Mark the inode dirty */
+			sv->sv_dirty = 1;
+		}
 
-	if (idblock==0 && !doalloc) {
-		/*
-		 * There's no indirect block allocated. We weren't
-		 * asked to allocate anything, so pretend the indirect
-		 * block was filled with all zeros.
-		 */
-		*diskblock = 0;
-		return 0;
-	}
-	else if (idblock==0) {
-		/*
-		 * There's no indirect block allocated, but we need to
-		 * allocate a block whose number needs to be stored in
-		 * the indirect block. Thus, we need to allocate an
-		 * indirect block.
-		 */
-		result = sfs_balloc(sfs, &idblock);
+		result = sfs_bmap_slot(sv, idblock, fileblock, doalloc,
+				       idblock+1, &block);
 		if (result) {
 			return result;
 		}
-
-		/* Remember the block we just allocated */
-		sv->sv_i.sfi_indirect = idblock;
-
-		/* Mark the inode dirty */
-		sv->sv_dirty = 1;
-
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
 	}
 	else {
 		/*
-		 * We already have an indirect block allocated; load it.
+		 * Past the indirect block: go through the double indirect
+		 * block, which only version 2 volumes have. Each of its
+		 * entries is an indirect block covering DBPERIDB blocks.
 		 */
-		result = sfs_rblock(sfs, idbuf, idblock);
-		if (result) {
-			return result;
+		fileblock -= dbperidb;
+		idnum = fileblock / dbperidb;
+		idoff = fileblock % dbperidb;
+
+		if (!sfs->sfs_dindirect || idnum >= dbperidb) {
+			/* The file can't get this big. */
+			return EINVAL;
 		}
-	}
 
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+		idblock = sv->sv_i.sfi_dindirect;
 
-	/* If there's no block there, allocate one */
-	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
+		if (idblock==0 && !doalloc) {
+			*diskblock = 0;
+			return 0;
+		}
+		else if (idblock==0) {
+			prev = sv->sv_i.sfi_indirect;
+			result = sfs_balloc_file(sv,
+						 prev ? prev+1 : sv->sv_ino+1,
+						 1, &idblock);
+			if (result) {
+				return result;
+			}
+			sv->sv_i.sfi_dindirect = idblock;
+			sv->sv_dirty = 1;
+		}
+
+		/* Find (or make, zeroed) the indirect block... */
+		result = sfs_bmap_slot(sv, idblock, idnum,
+				       doalloc ? SFS_ALLOC : SFS_NOALLOC,
+				       idblock+1, &idblock);
 		if (result) {
 			return result;
 		}
+		if (idblock == 0) {
+			*diskblock = 0;
+			return 0;
+		}
 
-		/* Remember the block we allocated */
-		idbuf[idoff] = block;
-
-		/* The indirect block is now dirty; write it back */
-		result = sfs_wblock(sfs, idbuf, idblock);
+		/* ...and then the block in it. */
+		result = sfs_bmap_slot(sv, idblock, idoff, doalloc,
+				       idblock+1, &block);
 		if (result) {
 			return result;
 		}
@@ -266,8 +634,8 @@ sfs_bmap(struct sfs_vnode *sv, u_int32_t fileblock, int doalloc,
 
 /*
  * Do I/O to a block of a file that doesn't cover the whole block.  We
- * need to read in the original block first, even if we're writing, so
- * we don't clobber the portion of the block we're not intending to
+ * need the original block in the cache first, even if we're writing,
+ * so we don't clobber the portion of the block we're not intending to
  * write over.
  *
  * skipstart is the number of bytes to skip past at the beginning of
@@ -279,27 +647,19 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      u_int32_t skipstart, u_int32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct buf *b;
 	u_int32_t diskblock;
 	u_int32_t fileblock;
 	int result;
 	
 	/* Allocate missing blocks if and only if we're writing */
-	int doalloc = (uio->uio_rw==UIO_WRITE);
+	int doalloc = (uio->uio_rw==UIO_WRITE) ? SFS_ALLOC : SFS_NOALLOC;
 
-	assert(skipstart + len <= SFS_BLOCKSIZE);
+	assert(skipstart + len <= sfs->sfs_blocksize);
 
 	/* Compute the block offset of this block in the file */
-	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
+	fileblock = uio->uio_offset / sfs->sfs_blocksize;
 
 	/* Get the disk block number */
 	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
@@ -310,40 +670,32 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * Read zeros.
 		 */
 		assert(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
-	}
-	else {
-		/*
-		 * Read the block.
-		 */
-		result = sfs_rblock(sfs, iobuf, diskblock);
-		if (result) {
-			return result;
-		}
+		return uiomovezeros(len, uio);
 	}
 
 	/*
-	 * Now perform the requested operation into/out of the buffer.
+	 * Get the block.
 	 */
-	result = uiomove(iobuf+skipstart, len, uio);
+	result = buf_read(sfs->sfs_device, diskblock, &b);
 	if (result) {
 		return result;
 	}
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * Now perform the requested operation into/out of the buffer.
+	 * If it was a write, the cached block is now dirty (even if
+	 * uiomove failed partway).
 	 */
+	result = uiomove((char *)b->b_data + skipstart, len, uio);
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_wblock(sfs, iobuf, diskblock);
-		if (result) {
-			return result;
-		}
+		sfs_dirtybuf(sfs, b, sv->sv_i.sfi_type == SFS_TYPE_DIR);
 	}
+	buf_release(b);
 
-	return 0;
+	return result;
 }
 
 /*
@@ -354,24 +706,33 @@ int
 sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 {
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct buf *b;
 	u_int32_t diskblock;
 	u_int32_t fileblock;
 	int result;
-	int doalloc = (uio->uio_rw==UIO_WRITE);
-	off_t saveoff;
-	off_t diskoff;
-	off_t saveres;
-	off_t diskres;
+	int fresh = 0;
 
 	/* Get the block number within the file */
-	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
+	fileblock = uio->uio_offset / sfs->sfs_blocksize;
 
 	/* Look up the disk block number */
-	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
+	result = sfs_bmap(sv, fileblock, SFS_NOALLOC, &diskblock);
 	if (result) {
 		return result;
 	}
 
+	/*
+	 * Writing into a hole: allocate a block, without clearing it
+	 * since we're about to overwrite all of it.
+	 */
+	if (diskblock == 0 && uio->uio_rw == UIO_WRITE) {
+		result = sfs_bmap(sv, fileblock, SFS_ALLOCRAW, &diskblock);
+		if (result) {
+			return result;
+		}
+		fresh = 1;
+	}
+
 	if (diskblock == 0) {
 		/*
 		 * No block - fill with zeros.
@@ -380,7 +741,106 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 		 * allocated a block for us.
 		 */
 		assert(uio->uio_rw == UIO_READ);
-		return uiomovezeros(SFS_BLOCKSIZE, uio);
+		return uiomovezeros(sfs->sfs_blocksize, uio);
+	}
+
+	/*
+	 * Go through the buffer cache. A write replaces the whole
+	 * block, so there's no need to read the old contents in.
+	 */
+	assert(uio->uio_resid >= sfs->sfs_blocksize);
+	if (uio->uio_rw == UIO_READ) {
+		result = buf_read(sfs->sfs_device, diskblock, &b);
+	}
+	else {
+		result = buf_get(sfs->sfs_device, diskblock, &b);
+	}
+	if (result) {
+		return result;
+	}
+
+	result = uiomove(b->b_data, sfs->sfs_blocksize, uio);
+
+	/*
+	 * If a write failed partway into a block we didn't have
+	 * cached, the buffer is garbage; releasing it without marking
+	 * it dirty throws it away. That leaves the old contents on
+	 * disk, which is right unless the block was only just
+	 * allocated: then it already belongs to the file and the disk
+	 * holds whatever some freed file left there, so write zeros.
+	 */
+	if (result != 0 && fresh && !(b->b_flags & B_VALID)) {
+		bzero(b->b_data, sfs->sfs_blocksize);
+	}
+	if (uio->uio_rw == UIO_WRITE && 
+	    (result == 0 || fresh || (b->b_flags & B_VALID))) {
+		sfs_dirtybuf(sfs, b, sv->sv_i.sfi_type == SFS_TYPE_DIR);
+	}
+	buf_release(b);
+
+	return result;
+}
+
+/*
+ * Read a run of whole blocks, at most MAXBLOCKS of them, that lie
+ * next to each other on disk, as a single device request. Hands back
+ * the number of blocks done in NDONE.
+ *
+ * The buffer cache has to stay authoritative. A read stops at any
+ * block that is cached (it might be dirty), and such a block, or a
+ * hole in the file, is done on its own through sfs_blockio.
+ *
+ * Writes always go through sfs_blockio, a block at a time, and stay
+ * in the cache until the syncer or an fsync writes them back.
+ */
+static
+int
+sfs_runio(struct sfs_vnode *sv, struct uio *uio, u_int32_t maxblocks,
+	  u_int32_t *ndone)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct device *dev = sfs->sfs_device;
+	u_int32_t fileblock, diskblock, nextblock;
+	u_int32_t n;
+	int result;
+	off_t saveoff;
+	off_t diskoff;
+	off_t saveres;
+	off_t diskres;
+
+	if (uio->uio_rw == UIO_WRITE) {
+		*ndone = 1;
+		return sfs_blockio(sv, uio);
+	}
+
+	fileblock = uio->uio_offset / sfs->sfs_blocksize;
+
+	result = sfs_bmap(sv, fileblock, SFS_NOALLOC, &diskblock);
+	if (result) {
+		return result;
+	}
+
+	if (diskblock == 0 || buf_incore(dev, diskblock)) {
+		*ndone = 1;
+		return sfs_blockio(sv, uio);
+	}
+
+	/*
+	 * Extend the run as far as the following file blocks follow
+	 * on disk. If mapping one fails, just stop here; the error
+	 * will come back when the next run tries that block.
+	 */
+	if (maxblocks > SFS_MAXRUN) {
+		maxblocks = SFS_MAXRUN;
+	}
+	for (n=1; n<maxblocks; n++) {
+		result = sfs_bmap(sv, fileblock+n, SFS_NOALLOC, &nextblock);
+		if (result || nextblock != diskblock+n) {
+			break;
+		}
+		if (buf_incore(dev, nextblock)) {
+			break;
+		}
 	}
 
 	/*
@@ -388,17 +848,17 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	 * and substitute one that makes sense to the device.
 	 */
 	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
+	diskoff = diskblock * sfs->sfs_blocksize;
 	uio->uio_offset = diskoff;
 
 	/*
-	 * Temporarily set the residue to be one block size.
+	 * Temporarily set the residue to be the length of the run.
 	 */
-	assert(uio->uio_resid >= SFS_BLOCKSIZE);
+	assert(uio->uio_resid >= n*sfs->sfs_blocksize);
 	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
+	diskres = n*sfs->sfs_blocksize;
 	uio->uio_resid = diskres;
-	
+
 	result = sfs_rwblock(sfs, uio);
 
 	/*
@@ -408,6 +868,7 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
 	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
 
+	*ndone = n;
 	return result;
 }
 
@@ -418,8 +879,9 @@ static
 int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
 {
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 	u_int32_t blkoff;
-	u_int32_t nblocks, i;
+	u_int32_t nblocks, done;
 	int result = 0;
 	u_int32_t extraresid = 0;
 
@@ -447,13 +909,13 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	/*
 	 * First, do any leading partial block.
 	 */
-	blkoff = uio->uio_offset % SFS_BLOCKSIZE;
+	blkoff = uio->uio_offset % sfs->sfs_blocksize;
 	if (blkoff != 0) {
 		/* Number of bytes at beginning of block to skip */
 		u_int32_t skip = blkoff;
 
 		/* Number of bytes to read/write after that point */
-		u_int32_t len = SFS_BLOCKSIZE - blkoff;
+		u_int32_t len = sfs->sfs_blocksize - blkoff;
 
 		/* ...which might be less than the rest of the block */
 		if (len > uio->uio_resid) {
@@ -473,21 +935,23 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	}
 
 	/*
-	 * Now we should be block-aligned. Do the remaining whole blocks.
+	 * Now we should be block-aligned. Do the remaining whole blocks,
+	 * a contiguous run at a time.
 	 */
-	assert(uio->uio_offset % SFS_BLOCKSIZE == 0);
-	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
-	for (i=0; i<nblocks; i++) {
-		result = sfs_blockio(sv, uio);
+	assert(uio->uio_offset % sfs->sfs_blocksize == 0);
+	nblocks = uio->uio_resid / sfs->sfs_blocksize;
+	while (nblocks > 0) {
+		result = sfs_runio(sv, uio, nblocks, &done);
 		if (result) {
 			goto out;
 		}
+		nblocks -= done;
 	}
 
 	/*
 	 * Now do any remaining partial block at the end.
 	 */
-	assert(uio->uio_resid < SFS_BLOCKSIZE);
+	assert(uio->uio_resid < sfs->sfs_blocksize);
 
 	if (uio->uio_resid > 0) {
 		result = sfs_partialio(sv, uio, 0, uio->uio_resid);
@@ -516,6 +980,10 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 //
 // Directory I/O
 
+/* Below, with the directory index */
+static void sfs_dirindex_update(struct sfs_vnode *sv, struct sfs_dir *sd,
+				int slot);
+
 /*
  * Read the directory entry out of slot SLOT of a directory vnode.
  * The "slot" is the index of the directory entry, starting at 0.
@@ -534,75 +1002,410 @@ sfs_readdir(struct sfs_vnode *sv, struct sfs_dir *sd, int slot)
 	/* Set up a uio to do the read */ 
 	mk_kuio(&ku, sd, sizeof(struct sfs_dir), actualpos, UIO_READ);
 
-	/* do it */
-	result = sfs_io(sv, &ku);
+	/* do it */
+	result = sfs_io(sv, &ku);
+	if (result) {
+		return result;
+	}
+
+	/* We should not hit EOF in the middle of a directory entry */
+	if (ku.uio_resid > 0) {
+		panic("sfs: readdir: Short entry (inode %u)\n", sv->sv_ino);
+	}
+
+	/* Done */
+	return 0;
+}
+
+/*
+ * Write (overwrite) the directory entry in slot SLOT of a directory
+ * vnode.
+ */
+static
+int
+sfs_writedir(struct sfs_vnode *sv, struct sfs_dir *sd, int slot)
+{
+	struct uio ku;
+	off_t actualpos;
+	int result;
+
+	/* Compute the actual position in the directory. */
+	assert(slot>=0);
+	actualpos = slot * sizeof(struct sfs_dir);
+
+	/* Set up a uio to do the write */ 
+	mk_kuio(&ku, sd, sizeof(struct sfs_dir), actualpos, UIO_WRITE);
+
+	/* do it */
+	result = sfs_io(sv, &ku);
+	if (result) {
+		return result;
+	}
+
+	/* Should not end up with a partial entry! */
+	if (ku.uio_resid > 0) {
+		panic("sfs: writedir: Short write (ino %u)\n", sv->sv_ino);
+	}
+
+	/* Keep the index in step */
+	sfs_dirindex_update(sv, sd, slot);
+
+	/* Done */
+	return 0;
+}
+
+/*
+ * Compute the number of entries in a directory.
+ * This actually computes the number of existing slots, and does not
+ * account for empty slots.
+ */
+static
+int
+sfs_dir_nentries(struct sfs_vnode *sv)
+{
+	off_t size;
+
+	assert(sv->sv_i.sfi_type == SFS_TYPE_DIR);
+
+	size = sv->sv_i.sfi_size;
+	if (size % sizeof(struct sfs_dir) != 0) {
+		panic("sfs: directory %u: Invalid size %u\n",
+		      sv->sv_ino, size);
+	}
+
+	return size / sizeof(struct sfs_dir);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Directory index
+//
+// So that lookups don't have to read and compare every slot of a
+// directory, each directory vnode gets an in-memory index the first
+// time it is searched: a hash table from name to entry, the entry in
+// each slot, and a stack of the free slots. sfs_writedir keeps it in
+// step with every change to the directory. If the index can't be
+// updated for lack of memory it is simply thrown away and built
+// again on the next lookup.
+
+/* Initial number of hash chains; doubled as the directory grows */
+#define SFS_DIRHASH_INIT  16
+
+struct sfs_dirent {
+	struct sfs_dirent *de_next;     /* hash chain */
+	u_int32_t de_ino;               /* inode number */
+	int de_slot;                    /* slot in the directory */
+	char de_name[SFS_NAMELEN];      /* filename */
+};
+
+struct sfs_dirindex {
+	struct sfs_dirent **di_hash;    /* hash chains */
+	unsigned di_nbuckets;           /* number of chains */
+	unsigned di_count;              /* number of names */
+
+	struct sfs_dirent **di_slots;   /* entry in each slot, or NULL */
+	int *di_free;                   /* stack of free slots */
+	int *di_freepos;                /* where each slot is on di_free */
+	int di_nslots;                  /* slots in the directory */
+	int di_nfree;                   /* slots on di_free */
+	int di_maxslots;                /* space in the three arrays */
+};
+
+static
+unsigned
+sfs_namehash(const char *name)
+{
+	unsigned h = 5381;
+
+	while (*name) {
+		h = h*33 + (unsigned char)*name++;
+	}
+	return h;
+}
+
+static
+void
+sfs_dirindex_destroy(struct sfs_dirindex *di)
+{
+	struct sfs_dirent *de;
+	int i;
+
+	for (i=0; i<di->di_nslots; i++) {
+		de = di->di_slots[i];
+		if (de != NULL) {
+			kfree(de);
+		}
+	}
+	kfree(di->di_hash);
+	kfree(di->di_slots);
+	kfree(di->di_free);
+	kfree(di->di_freepos);
+	kfree(di);
+}
+
+static
+struct sfs_dirent *
+sfs_dirindex_find(struct sfs_dirindex *di, const char *name)
+{
+	struct sfs_dirent *de;
+
+	de = di->di_hash[sfs_namehash(name) & (di->di_nbuckets-1)];
+	for (; de != NULL; de = de->de_next) {
+		if (!strcmp(de->de_name, name)) {
+			return de;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Make room for at least NSLOTS slots.
+ */
+static
+int
+sfs_dirindex_growslots(struct sfs_dirindex *di, int nslots)
+{
+	struct sfs_dirent **nslotv;
+	int *nfree, *nfreepos;
+	int n;
+
+	if (nslots <= di->di_maxslots) {
+		return 0;
+	}
+
+	n = di->di_maxslots ? di->di_maxslots : SFS_DIRHASH_INIT;
+	while (n < nslots) {
+		n *= 2;
+	}
+
+	nslotv = kmalloc(n * sizeof(struct sfs_dirent *));
+	nfree = kmalloc(n * sizeof(int));
+	nfreepos = kmalloc(n * sizeof(int));
+	if (nslotv == NULL || nfree == NULL || nfreepos == NULL) {
+		kfree(nslotv);
+		kfree(nfree);
+		kfree(nfreepos);
+		return ENOMEM;
+	}
+	if (di->di_nslots > 0) {
+		memcpy(nslotv, di->di_slots, 
+		       di->di_nslots * sizeof(struct sfs_dirent *));
+		memcpy(nfreepos, di->di_freepos, di->di_nslots * sizeof(int));
+	}
+	if (di->di_nfree > 0) {
+		memcpy(nfree, di->di_free, di->di_nfree * sizeof(int));
+	}
+	kfree(di->di_slots);
+	kfree(di->di_free);
+	kfree(di->di_freepos);
+	di->di_slots = nslotv;
+	di->di_free = nfree;
+	di->di_freepos = nfreepos;
+	di->di_maxslots = n;
+	return 0;
+}
+
+/*
+ * Double the number of hash chains once there are more than two
+ * names per chain. Failing to is not an error; lookups just get a
+ * bit slower.
+ */
+static
+void
+sfs_dirindex_rehash(struct sfs_dirindex *di)
+{
+	struct sfs_dirent **nhash;
+	struct sfs_dirent *de;
+	unsigned nbuckets, h;
+	int i;
+
+	if (di->di_count <= 2*di->di_nbuckets) {
+		return;
+	}
+
+	nbuckets = di->di_nbuckets * 2;
+	nhash = kmalloc(nbuckets * sizeof(struct sfs_dirent *));
+	if (nhash == NULL) {
+		return;
+	}
+	bzero(nhash, nbuckets * sizeof(struct sfs_dirent *));
+
+	for (i=0; i<di->di_nslots; i++) {
+		de = di->di_slots[i];
+		if (de != NULL) {
+			h = sfs_namehash(de->de_name) & (nbuckets-1);
+			de->de_next = nhash[h];
+			nhash[h] = de;
+		}
+	}
+
+	kfree(di->di_hash);
+	di->di_hash = nhash;
+	di->di_nbuckets = nbuckets;
+}
+
+/*
+ * Put a slot on top of the free stack.
+ */
+static
+void
+sfs_dirindex_pushfree(struct sfs_dirindex *di, int slot)
+{
+	di->di_freepos[slot] = di->di_nfree;
+	di->di_free[di->di_nfree++] = slot;
+}
+
+/*
+ * Take a slot off the free stack, wherever it is, by moving the
+ * slot on top into its place.
+ */
+static
+void
+sfs_dirindex_unfree(struct sfs_dirindex *di, int slot)
+{
+	int pos = di->di_freepos[slot];
+	int last = di->di_free[--di->di_nfree];
+
+	assert(pos >= 0 && di->di_free[pos] == slot);
+	di->di_free[pos] = last;
+	di->di_freepos[last] = pos;
+	di->di_freepos[slot] = -1;
+}
+
+/*
+ * Record that slot SLOT now holds the entry SD, which may be empty.
+ */
+static
+int
+sfs_dirindex_set(struct sfs_dirindex *di, struct sfs_dir *sd, int slot)
+{
+	struct sfs_dirent *de, **pp;
+	int result;
+
+	result = sfs_dirindex_growslots(di, slot+1);
 	if (result) {
 		return result;
 	}
 
-	/* We should not hit EOF in the middle of a directory entry */
-	if (ku.uio_resid > 0) {
-		panic("sfs: readdir: Short entry (inode %u)\n", sv->sv_ino);
+	/* New slots at the end start out free */
+	while (di->di_nslots <= slot) {
+		di->di_slots[di->di_nslots] = NULL;
+		sfs_dirindex_pushfree(di, di->di_nslots++);
 	}
 
-	/* Done */
+	/* Take out whatever was there before */
+	de = di->di_slots[slot];
+	if (de != NULL) {
+		pp = &di->di_hash[sfs_namehash(de->de_name) & (di->di_nbuckets-1)];
+		while (*pp != de) {
+			pp = &(*pp)->de_next;
+		}
+		*pp = de->de_next;
+		di->di_slots[slot] = NULL;
+		di->di_count--;
+		kfree(de);
+	}
+	else {
+		/* It was free; take it off the stack */
+		sfs_dirindex_unfree(di, slot);
+	}
+
+	if (sd->sfd_ino == SFS_NOINO) {
+		sfs_dirindex_pushfree(di, slot);
+		return 0;
+	}
+
+	de = kmalloc(sizeof(struct sfs_dirent));
+	if (de == NULL) {
+		return ENOMEM;
+	}
+	de->de_ino = sd->sfd_ino;
+	de->de_slot = slot;
+	strcpy(de->de_name, sd->sfd_name);
+
+	/* Each name may legally appear only once... */
+	assert(sfs_dirindex_find(di, de->de_name) == NULL);
+
+	pp = &di->di_hash[sfs_namehash(de->de_name) & (di->di_nbuckets-1)];
+	de->de_next = *pp;
+	*pp = de;
+	di->di_slots[slot] = de;
+	di->di_count++;
+
+	sfs_dirindex_rehash(di);
 	return 0;
 }
 
 /*
- * Write (overwrite) the directory entry in slot SLOT of a directory
- * vnode.
+ * Build the index for a directory, if it doesn't have one yet.
  */
 static
 int
-sfs_writedir(struct sfs_vnode *sv, struct sfs_dir *sd, int slot)
+sfs_dirindex_load(struct sfs_vnode *sv)
 {
-	struct uio ku;
-	off_t actualpos;
-	int result;
-
-	/* Compute the actual position in the directory. */
-	assert(slot>=0);
-	actualpos = slot * sizeof(struct sfs_dir);
+	struct sfs_dirindex *di;
+	struct sfs_dir tsd;
+	int nentries, i, result;
 
-	/* Set up a uio to do the write */ 
-	mk_kuio(&ku, sd, sizeof(struct sfs_dir), actualpos, UIO_WRITE);
+	if (sv->sv_dirindex != NULL) {
+		return 0;
+	}
 
-	/* do it */
-	result = sfs_io(sv, &ku);
-	if (result) {
-		return result;
+	di = kmalloc(sizeof(struct sfs_dirindex));
+	if (di == NULL) {
+		return ENOMEM;
 	}
+	di->di_nbuckets = SFS_DIRHASH_INIT;
+	di->di_count = 0;
+	di->di_slots = NULL;
+	di->di_free = NULL;
+	di->di_freepos = NULL;
+	di->di_nslots = di->di_nfree = di->di_maxslots = 0;
+	di->di_hash = kmalloc(di->di_nbuckets * sizeof(struct sfs_dirent *));
+	if (di->di_hash == NULL) {
+		kfree(di);
+		return ENOMEM;
+	}
+	bzero(di->di_hash, di->di_nbuckets * sizeof(struct sfs_dirent *));
 
-	/* Should not end up with a partial entry! */
-	if (ku.uio_resid > 0) {
-		panic("sfs: writedir: Short write (ino %u)\n", sv->sv_ino);
+	/*
+	 * Setting the last slot first puts every slot on the free
+	 * stack. Each slot is then taken off it as it's set, and put
+	 * back on top if it's free; going backwards, the lowest free
+	 * slot is the last one put back, so it's reused first.
+	 */
+	nentries = sfs_dir_nentries(sv);
+	for (i=nentries-1; i>=0; i--) {
+		result = sfs_readdir(sv, &tsd, i);
+		if (result == 0) {
+			/* Ensure null termination, just in case */
+			tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
+			result = sfs_dirindex_set(di, &tsd, i);
+		}
+		if (result) {
+			sfs_dirindex_destroy(di);
+			return result;
+		}
 	}
 
-	/* Done */
+	sv->sv_dirindex = di;
 	return 0;
 }
 
 /*
- * Compute the number of entries in a directory.
- * This actually computes the number of existing slots, and does not
- * account for empty slots.
+ * Called by sfs_writedir after it changes a slot.
  */
 static
-int
-sfs_dir_nentries(struct sfs_vnode *sv)
+void
+sfs_dirindex_update(struct sfs_vnode *sv, struct sfs_dir *sd, int slot)
 {
-	off_t size;
-
-	assert(sv->sv_i.sfi_type == SFS_TYPE_DIR);
-
-	size = sv->sv_i.sfi_size;
-	if (size % sizeof(struct sfs_dir) != 0) {
-		panic("sfs: directory %u: Invalid size %u\n",
-		      sv->sv_ino, size);
+	if (sv->sv_dirindex == NULL) {
+		return;
+	}
+	if (sfs_dirindex_set(sv->sv_dirindex, sd, slot)) {
+		sfs_dirindex_destroy(sv->sv_dirindex);
+		sv->sv_dirindex = NULL;
 	}
-
-	return size / sizeof(struct sfs_dir);
 }
 
 /*
@@ -616,45 +1419,33 @@ int
 sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 		    u_int32_t *ino, int *slot, int *emptyslot)
 {
-	struct sfs_dir tsd;
-	int found = 0;
-	int nentries = sfs_dir_nentries(sv);
-	int i, result;
-
-	/* For each slot... */
-	for (i=0; i<nentries; i++) {
+	struct sfs_dirindex *di;
+	struct sfs_dirent *de;
+	int result;
 
-		/* Read the entry from that slot */
-		result = sfs_readdir(sv, &tsd, i);
-		if (result) {
-			return result;
-		}
-		if (tsd.sfd_ino == SFS_NOINO) {
-			/* Free slot - report it back if one was requested */
-			if (emptyslot != NULL) {
-				*emptyslot = i;
-			}
-		}
-		else {
-			/* Ensure null termination, just in case */
-			tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
-			if (!strcmp(tsd.sfd_name, name)) {
+	result = sfs_dirindex_load(sv);
+	if (result) {
+		return result;
+	}
+	di = sv->sv_dirindex;
 
-				/* Each name may legally appear only once... */
-				assert(found==0);
+	/* Report back a free slot if one was requested */
+	if (emptyslot != NULL && di->di_nfree > 0) {
+		*emptyslot = di->di_free[di->di_nfree-1];
+	}
 
-				found = 1;
-				if (slot != NULL) {
-					*slot = i;
-				}
-				if (ino != NULL) {
-					*ino = tsd.sfd_ino;
-				}
-			}
-		}
+	de = sfs_dirindex_find(di, name);
+	if (de == NULL) {
+		return ENOENT;
 	}
 
-	return found ? 0 : ENOENT;
+	if (slot != NULL) {
+		*slot = de->de_slot;
+	}
+	if (ino != NULL) {
+		*ino = de->de_ino;
+	}
+	return 0;
 }
 
 /*
@@ -770,8 +1561,13 @@ sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
 	 * number is the block number, so just get a block.)
 	 */
 
-	result = sfs_balloc(sfs, &ino);
+	result = sfs_balloc(sfs, 0, &ino);
+	if (result) {
+		return result;
+	}
+	result = sfs_clearblock(sfs, ino);
 	if (result) {
+		sfs_bfree(sfs, ino);
 		return result;
 	}
 
@@ -859,7 +1655,8 @@ sfs_reclaim(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	int ix, i, num, result;
+	struct sfs_vnode **pp, *last;
+	int ix, num, result;
 
 	/*
 	 * Make sure someone else hasn't picked up the vnode since the
@@ -877,12 +1674,18 @@ sfs_reclaim(struct vnode *v)
 		return EBUSY;
 	}
 	lock_release(v->vn_countlock);
+
+	/* Freeing the file and leaving sfs_vnodes is one operation */
+	sfs_opbegin(sfs);
 	
+	/* Give back any preallocated blocks */
+	sfs_prealloc_release(sv);
 
 	/* If there are no on-disk references to the file either, erase it. */
 	if (sv->sv_i.sfi_linkcount==0) {
-		result = VOP_TRUNCATE(&sv->sv_v, 0);
+		result = sfs_dotruncate(sv, 0);
 		if (result) {
+			sfs_opend(sfs);
 			return result;
 		}
 	}
@@ -890,6 +1693,7 @@ sfs_reclaim(struct vnode *v)
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
 	if (result) {
+		sfs_opend(sfs);
 		return result;
 	}
 
@@ -898,31 +1702,109 @@ sfs_reclaim(struct vnode *v)
 		sfs_bfree(sfs, sv->sv_ino);
 	}
 
-	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	ix = -1;
+	/* Remove the vnode structure from the tables in the struct sfs_fs. */
+	ix = sv->sv_index;
 	num = array_getnum(sfs->sfs_vnodes);
-	for (i=0; i<num; i++) {
-		struct sfs_vnode *sv2 = array_getguy(sfs->sfs_vnodes, i);
-		if (sv2==sv) {
-			ix = i;
-			break;
-		}
-	}
-	if (ix<0) {
+	if (ix<0 || ix>=num || array_getguy(sfs->sfs_vnodes, ix)!=sv) {
 		panic("sfs: reclaim vnode %u not in vnode pool\n",
 		      sv->sv_ino);
 	}
-	array_remove(sfs->sfs_vnodes, ix);
+	/* Fill the hole with the last one rather than shifting them all */
+	last = array_getguy(sfs->sfs_vnodes, num-1);
+	array_setguy(sfs->sfs_vnodes, ix, last);
+	last->sv_index = ix;
+	array_setsize(sfs->sfs_vnodes, num-1);
+
+	pp = &sfs->sfs_vnhash[SFS_VNHASHFN(sv->sv_ino)];
+	while (*pp != sv) {
+		assert(*pp != NULL);
+		pp = &(*pp)->sv_hashnext;
+	}
+	*pp = sv->sv_hashnext;
+	sfs_vnstats.vs_loaded--;
+
+	sfs_opend(sfs);
 
 	VOP_KILL(&sv->sv_v);
 
+	/* Drop the directory index, if there is one. */
+	if (sv->sv_dirindex != NULL) {
+		sfs_dirindex_destroy(sv->sv_dirindex);
+	}
+
 	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	kmem_cache_free(sfs_vnode_cache, sv);
 
 	/* Done */
 	return 0;
 }
 
+/*
+ * Sequential read-ahead.
+ *
+ * If a read picks up where the previous one left off, ask the buffer
+ * cache to fetch the next sv_rawin blocks of the file in the
+ * background, so they're there by the time the reader comes back for
+ * them. The window starts at SFS_RAMIN blocks and doubles on each
+ * sequential read up to SFS_RAMAX; a read anywhere else closes it.
+ * Blocks already requested (up to sv_raend) aren't asked for again.
+ */
+static
+void
+sfs_readahead(struct sfs_vnode *sv, struct uio *uio)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	u_int32_t first, next, end, nfileblocks;
+	u_int32_t fileblock, diskblock;
+
+	if (uio->uio_resid == 0 ||
+	    uio->uio_offset >= (off_t)sv->sv_i.sfi_size) {
+		return;
+	}
+
+	first = uio->uio_offset / sfs->sfs_blocksize;
+	next = DIVROUNDUP(uio->uio_offset + uio->uio_resid, sfs->sfs_blocksize);
+
+	/* Small reads may come back for the rest of the last block */
+	if (first == sv->sv_ranext || 
+	    (sv->sv_ranext > 0 && first == sv->sv_ranext - 1)) {
+		if (sv->sv_rawin == 0) {
+			sv->sv_rawin = SFS_RAMIN;
+		}
+		else if (sv->sv_rawin < SFS_RAMAX) {
+			sv->sv_rawin *= 2;
+		}
+	}
+	else {
+		sv->sv_rawin = 0;
+		sv->sv_raend = 0;
+	}
+	sv->sv_ranext = next;
+
+	if (sv->sv_rawin == 0) {
+		return;
+	}
+
+	end = next + sv->sv_rawin;
+	nfileblocks = DIVROUNDUP(sv->sv_i.sfi_size, sfs->sfs_blocksize);
+	if (end > nfileblocks) {
+		end = nfileblocks;
+	}
+
+	fileblock = sv->sv_raend > next ? sv->sv_raend : next;
+	for (; fileblock < end; fileblock++) {
+		if (sfs_bmap(sv, fileblock, SFS_NOALLOC, &diskblock)) {
+			break;
+		}
+		if (diskblock != 0) {
+			buf_readahead(sfs->sfs_device, diskblock);
+		}
+	}
+	if (fileblock > sv->sv_raend) {
+		sv->sv_raend = fileblock;
+	}
+}
+
 /*
  * Called for read(). sfs_io() does the work.
  */
@@ -932,6 +1814,13 @@ sfs_read(struct vnode *v, struct uio *uio)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	assert(uio->uio_rw==UIO_READ);
+
+	/*
+	 * Queue the read-ahead first, so the disk goes on to it
+	 * as soon as it has finished this read.
+	 */
+	sfs_readahead(sv, uio);
+
 	return sfs_io(sv, uio);
 }
 
@@ -943,8 +1832,16 @@ int
 sfs_write(struct vnode *v, struct uio *uio)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	int result;
+
 	assert(uio->uio_rw==UIO_WRITE);
-	return sfs_io(sv, uio);
+
+	/* It may allocate blocks and grow the file */
+	sfs_opbegin(sfs);
+	result = sfs_io(sv, uio);
+	sfs_opend(sfs);
+	return result;
 }
 
 /*
@@ -1034,6 +1931,30 @@ sfs_tryseek(struct vnode *v, off_t pos)
 	return 0;
 }
 
+/*
+ * Write back a file: everything but the journal commit. sfs_sync
+ * calls this for each loaded file and then commits once for all of
+ * them.
+ *
+ * On a journaled volume, sfs_flushfile writes only the file's data;
+ * its metadata goes into the journal as one sequential commit, and
+ * reaches its home location later, at the next checkpoint.
+ */
+int
+sfs_syncfile(struct sfs_vnode *sv)
+{
+	int result;
+
+	/* Don't let preallocated blocks reach the on-disk freemap */
+	sfs_prealloc_release(sv);
+
+	result = sfs_sync_inode(sv);
+	if (result) {
+		return result;
+	}
+	return sfs_flushfile(sv);
+}
+
 /*
  * Called for fsync(), and also on filesystem unmount, global sync(),
  * and some other cases.
@@ -1043,7 +1964,18 @@ int
 sfs_fsync(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
-	return sfs_sync_inode(sv);
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	int result;
+
+	result = sfs_syncfile(sv);
+	if (result) {
+		return result;
+	}
+
+	if (SFS_JOURNALED(sfs)) {
+		return sfs_jcommit(sfs);
+	}
+	return 0;
 }
 
 /*
@@ -1058,33 +1990,88 @@ sfs_mmap(struct vnode *v   /* add stuff as needed */)
 }
 
 /*
- * Called for ftruncate() and from sfs_reclaim.
+ * Free the blocks under indirect block IDBLOCK that are past the
+ * first BLOCKLEN blocks of the file. BASEBLOCK is the file block its
+ * first entry maps, and LEVEL is 1 for an indirect block and 2 for a
+ * double indirect block. Sets *EMPTY if nothing is left in it, in
+ * which case the caller frees IDBLOCK itself.
  */
 static
 int
-sfs_truncate(struct vnode *v, off_t len)
+sfs_truncind(struct sfs_fs *sfs, u_int32_t idblock, int level,
+	     u_int32_t baseblock, u_int32_t blocklen, int *empty)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static u_int32_t idbuf[SFS_DBPERIDB];
+	struct buf *idb;
+	u_int32_t *idbuf;
+	u_int32_t j, span, entbase;
+	int result, subempty;
+	int hasnonzero, iddirty;
 
-	struct sfs_vnode *sv = v->vn_data;
+	/* How many file blocks each entry covers */
+	span = level > 1 ? sfs->sfs_dbperidb : 1;
+
+	result = buf_read(sfs->sfs_device, idblock, &idb);
+	if (result) {
+		return result;
+	}
+	idbuf = idb->b_data;
+
+	hasnonzero = 0;
+	iddirty = 0;
+	for (j=0; j<sfs->sfs_dbperidb; j++) {
+		entbase = baseblock + j*span;
+
+		/* Discard anything that is past the new EOF */
+		if (idbuf[j] != 0 && entbase + span > blocklen) {
+			subempty = 1;
+			if (level > 1) {
+				result = sfs_truncind(sfs, idbuf[j], level-1,
+						      entbase, blocklen,
+						      &subempty);
+				if (result) {
+					buf_release(idb);
+					return result;
+				}
+			}
+			if (subempty) {
+				sfs_bfree(sfs, idbuf[j]);
+				idbuf[j] = 0;
+				iddirty = 1;
+			}
+		}
+		/* Remember if we see any nonzero blocks in here */
+		if (idbuf[j]!=0) {
+			hasnonzero=1;
+		}
+	}
+
+	if (hasnonzero && iddirty) {
+		/* The indirect block is dirty */
+		sfs_dirtybuf(sfs, idb, 1);
+	}
+	buf_release(idb);
+
+	*empty = !hasnonzero;
+	return 0;
+}
+
+/*
+ * Truncate; the work of sfs_truncate, which sfs_reclaim also calls
+ * directly since it is already inside an operation.
+ */
+static
+int
+sfs_dotruncate(struct sfs_vnode *sv, off_t len)
+{
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	u_int32_t dbperidb = sfs->sfs_dbperidb;
 
 	/* Length in blocks (divide rounding up) */
-	u_int32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
-
-	u_int32_t i, j, block;
-	u_int32_t idblock, baseblock, highblock;
-	int result;
-	int hasnonzero, iddirty;
+	u_int32_t blocklen = DIVROUNDUP(len, sfs->sfs_blocksize);
 
-	assert(sizeof(idbuf)==SFS_BLOCKSIZE);
+	u_int32_t i, block;
+	u_int32_t idblock, baseblock;
+	int result, empty;
 
 	/*
 	 * Go through the direct blocks. Discard any that are
@@ -1105,45 +2092,35 @@ sfs_truncate(struct vnode *v, off_t len)
 	/* The lowest block in the indirect block */
 	baseblock = SFS_NDIRECT;
 
-	/* The highest block in the indirect block */
-	highblock = baseblock + SFS_DBPERIDB - 1;
-
-	if (blocklen < highblock && idblock != 0) {
+	if (blocklen < baseblock + dbperidb && idblock != 0) {
 		/* We're past the proposed EOF; may need to free stuff */
-
-		/* Read the indirect block */
-		result = sfs_rblock(sfs, idbuf, idblock);
+		result = sfs_truncind(sfs, idblock, 1, baseblock, blocklen,
+				      &empty);
 		if (result) {
 			return result;
 		}
-		
-		hasnonzero = 0;
-		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
-				iddirty = 1;
-			}
-			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
-			}
-		}
-
-		if (!hasnonzero) {
+		if (empty) {
 			/* The whole indirect block is empty now; free it */
 			sfs_bfree(sfs, idblock);
 			sv->sv_i.sfi_indirect = 0;
 			sv->sv_dirty = 1;
 		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_wblock(sfs, idbuf, idblock);
-			if (result) {
-				return result;
-			}
+	}
+
+	/* Likewise the double indirect block, which follows it */
+	idblock = sfs->sfs_dindirect ? sv->sv_i.sfi_dindirect : 0;
+	baseblock += dbperidb;
+
+	if (blocklen < baseblock + dbperidb*dbperidb && idblock != 0) {
+		result = sfs_truncind(sfs, idblock, 2, baseblock, blocklen,
+				      &empty);
+		if (result) {
+			return result;
+		}
+		if (empty) {
+			sfs_bfree(sfs, idblock);
+			sv->sv_i.sfi_dindirect = 0;
+			sv->sv_dirty = 1;
 		}
 	}
 
@@ -1156,6 +2133,23 @@ sfs_truncate(struct vnode *v, off_t len)
 	return 0;
 }
 
+/*
+ * Called for ftruncate().
+ */
+static
+int
+sfs_truncate(struct vnode *v, off_t len)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	int result;
+
+	sfs_opbegin(sfs);
+	result = sfs_dotruncate(sv, len);
+	sfs_opend(sfs);
+	return result;
+}
+
 /*
  * Get the full pathname for a file. This only needs to work on directories.
  * Since we don't support subdirectories, assume it's the root directory
@@ -1212,14 +2206,18 @@ sfs_creat(struct vnode *v, const char *name, int excl, struct vnode **ret)
 	}
 
 	/* Didn't exist - create it */
+	sfs_opbegin(sfs);
 	result = sfs_makeobj(sfs, SFS_TYPE_FILE, &newguy);
 	if (result) {
+		sfs_opend(sfs);
 		return result;
 	}
 
 	/* Link it into the directory */
 	result = sfs_dir_link(sv, name, newguy->sv_ino, NULL);
 	if (result) {
+		/* Freeing it in sfs_reclaim is an operation of its own */
+		sfs_opend(sfs);
 		VOP_DECREF(&newguy->sv_v);
 		return result;
 	}
@@ -1229,6 +2227,7 @@ sfs_creat(struct vnode *v, const char *name, int excl, struct vnode **ret)
 
 	/* and consequently mark it dirty. */
 	newguy->sv_dirty = 1;
+	sfs_opend(sfs);
 
 	*ret = &newguy->sv_v;
 	
@@ -1244,6 +2243,7 @@ static
 int
 sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 {
+	struct sfs_fs *sfs = dir->vn_fs->fs_data;
 	struct sfs_vnode *sv = dir->vn_data;
 	struct sfs_vnode *f = file->vn_data;
 	int result;
@@ -1251,14 +2251,17 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 	assert(file->vn_fs == dir->vn_fs);
 
 	/* Just create a link */
+	sfs_opbegin(sfs);
 	result = sfs_dir_link(sv, name, f->sv_ino, NULL);
 	if (result) {
+		sfs_opend(sfs);
 		return result;
 	}
 
 	/* and update the link count, marking the inode dirty */
 	f->sv_i.sfi_linkcount++;
 	f->sv_dirty = 1;
+	sfs_opend(sfs);
 
 	return 0;
 }
@@ -1270,14 +2273,18 @@ static
 int
 sfs_remove(struct vnode *dir, const char *name)
 {
+	struct sfs_fs *sfs = dir->vn_fs->fs_data;
 	struct sfs_vnode *sv = dir->vn_data;
 	struct sfs_vnode *victim;
 	int slot;
 	int result;
 
+	sfs_opbegin(sfs);
+
 	/* Look for the file and fetch a vnode for it. */
 	result = sfs_lookonce(sv, name, &victim, &slot);
 	if (result) {
+		sfs_opend(sfs);
 		return result;
 	}
 
@@ -1290,7 +2297,12 @@ sfs_remove(struct vnode *dir, const char *name)
 		victim->sv_dirty = 1;
 	}
 
-	/* Discard the reference that sfs_lookonce got us */
+	sfs_opend(sfs);
+
+	/*
+	 * Discard the reference that sfs_lookonce got us. This may
+	 * reclaim the file, which is an operation of its own.
+	 */
 	VOP_DECREF(&victim->sv_v);
 
 	return result;
@@ -1307,6 +2319,7 @@ int
 sfs_rename(struct vnode *d1, const char *n1, 
 	   struct vnode *d2, const char *n2)
 {
+	struct sfs_fs *sfs = d1->vn_fs->fs_data;
 	struct sfs_vnode *sv = d1->vn_data;
 	struct sfs_vnode *g1;
 	int slot1, slot2;
@@ -1315,9 +2328,12 @@ sfs_rename(struct vnode *d1, const char *n1,
 	assert(d1==d2);
 	assert(sv->sv_ino == SFS_ROOT_LOCATION);
 
+	sfs_opbegin(sfs);
+
 	/* Look up the old name of the file and get its inode and slot number*/
 	result = sfs_lookonce(sv, n1, &g1, &slot1);
 	if (result) {
+		sfs_opend(sfs);
 		return result;
 	}
 
@@ -1354,6 +2370,7 @@ sfs_rename(struct vnode *d1, const char *n1,
 	assert(g1->sv_i.sfi_linkcount>0);
 	g1->sv_i.sfi_linkcount--;
 	g1->sv_dirty = 1;
+	sfs_opend(sfs);
 
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_v);
@@ -1373,6 +2390,8 @@ sfs_rename(struct vnode *d1, const char *n1,
 	}
 	g1->sv_i.sfi_linkcount--;
  puke:
+	sfs_opend(sfs);
+
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_v);
 	return result;
@@ -1548,16 +2567,13 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
 	struct sfs_vnode *sv;
+	struct buf *b;
 	const struct vnode_ops *ops = NULL;
-	int i, num;
 	int result;
 
 	/* Look in the vnodes table */
-	num = array_getnum(sfs->sfs_vnodes);
-
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		sv = array_getguy(sfs->sfs_vnodes, i);
+	for (sv = sfs->sfs_vnhash[SFS_VNHASHFN(ino)]; sv != NULL;
+	     sv = sv->sv_hashnext) {
 
 		/* Every inode in memory must be in an allocated block */
 		if (!sfs_bused(sfs, sv->sv_ino)) {
@@ -1573,13 +2589,15 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 
 			VOP_INCREF(&sv->sv_v);
 			*ret = sv;
+			sfs_vnstats.vs_hits++;
 			return 0;
 		}
 	}
 
 	/* Didn't have it loaded; load it */
+	sfs_vnstats.vs_misses++;
 
-	sv = kmalloc(sizeof(struct sfs_vnode));
+	sv = kmem_cache_alloc(sfs_vnode_cache);
 	if (sv==NULL) {
 		return ENOMEM;
 	}
@@ -1591,15 +2609,29 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	}
 
 	/* Read the block the inode is in */
-	result = sfs_rblock(sfs, &sv->sv_i, ino);
+	result = buf_read(sfs->sfs_device, ino, &b);
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(sfs_vnode_cache, sv);
 		return result;
 	}
+	memcpy(&sv->sv_i, b->b_data, sizeof(struct sfs_inode));
+	buf_release(b);
 
 	/* Not dirty yet */
 	sv->sv_dirty = 0;
 
+	/* Directory index is built on first lookup */
+	sv->sv_dirindex = NULL;
+
+	/* No preallocated blocks */
+	sv->sv_prealloc = 0;
+	sv->sv_npreal = 0;
+
+	/* No reads yet */
+	sv->sv_ranext = 0;
+	sv->sv_raend = 0;
+	sv->sv_rawin = 0;
+
 	/*
 	 * FORCETYPE is set if we're creating a new file, because the
 	 * block on disk will have been zeroed out and thus the type
@@ -1630,26 +2662,46 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = VOP_INIT(&sv->sv_v, ops, &sfs->sfs_absfs, sv);
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(sfs_vnode_cache, sv);
 		return result;
 	}
 
 	/* Set the other fields in our vnode structure */
 	sv->sv_ino = ino;
 
-	/* Add it to our table */
+	/* Add it to our tables */
+	sv->sv_index = array_getnum(sfs->sfs_vnodes);
 	result = array_add(sfs->sfs_vnodes, sv);
 	if (result) {
 		VOP_KILL(&sv->sv_v);
-		kfree(sv);
+		kmem_cache_free(sfs_vnode_cache, sv);
 		return result;
 	}
+	sv->sv_hashnext = sfs->sfs_vnhash[SFS_VNHASHFN(ino)];
+	sfs->sfs_vnhash[SFS_VNHASHFN(ino)] = sv;
+
+	sfs_vnstats.vs_loaded++;
+	if (sfs_vnstats.vs_loaded > sfs_vnstats.vs_maxloaded) {
+		sfs_vnstats.vs_maxloaded = sfs_vnstats.vs_loaded;
+	}
 
 	/* Hand it back */
 	*ret = sv;
 	return 0;
 }
 
+/*
+ * Print the loaded-inode table counters.
+ */
+void
+sfs_printstats(void)
+{
+	kprintf("SFS vnodes: %u loaded, at most %u at once\n",
+		sfs_vnstats.vs_loaded, sfs_vnstats.vs_maxloaded);
+	kprintf("    %u found loaded, %u read in\n",
+		sfs_vnstats.vs_hits, sfs_vnstats.vs_misses);
+}
+
 /*
  * Get vnode for the root of the filesystem.
  * The root vnode is always found in block 1 (SFS_ROOT_LOCATION).
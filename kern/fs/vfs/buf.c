@@ -0,0 +1,1027 @@
+/*
+ * Block buffer cache. See buf.h for the interface.
+ *
+ * All of the cache's own state (hash chains, LRU list, counters) is
+ * protected by splhigh. A buffer's contents are protected by B_BUSY:
+ * only the thread that set it may touch b_data or change b_flags,
+ * and anyone else who wants the buffer sleeps on it until it is
+ * released.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <machine/spl.h>
+#include <thread.h>
+#include <uio.h>
+#include <dev.h>
+#include <vm.h>
+#include <vfs.h>
+#include <buf.h>
+
+/* Number of hash chains. Must be a power of 2. */
+#define BUF_HASHSIZE  256
+
+/* The cache may grow to 1/BUF_RAMFRAC of physical memory. */
+#define BUF_RAMFRAC   8
+
+/* How many times to try a block that keeps getting EIO */
+#define BUF_MAXTRIES  10
+
+/* Number of read-ahead requests that can be waiting at once */
+#define BUF_RAQUEUE   64
+
+/* Wake the syncer early once 1/BUF_DIRTYFRAC of the cache is dirty. */
+#define BUF_DIRTYFRAC 4
+
+/* Number of devices that can have a block size set at once */
+#define BUF_MAXDEVS   8
+
+#define BUF_HASH(dev, block) \
+	((((u_int32_t)(dev) >> 4) ^ (block)) & (BUF_HASHSIZE-1))
+
+static struct buf *buf_hash[BUF_HASHSIZE];
+static struct buf *buf_lruhead;		/* most recently used */
+static struct buf *buf_lrutail;		/* least recently used */
+
+static unsigned buf_nbufs;		/* buffers in existence */
+static u_int32_t buf_bytes;		/* memory they hold */
+static u_int32_t buf_maxbytes;		/* limit on buf_bytes */
+static u_int32_t buf_dirtybytes;	/* memory in dirty buffers */
+static unsigned buf_nwaiting;		/* threads waiting in buf_alloc */
+
+/*
+ * Read-ahead requests: busy, not yet valid buffers already in the
+ * hash table, waiting for the read-ahead thread to fill them in.
+ */
+static struct buf *buf_raqueue[BUF_RAQUEUE];
+static unsigned buf_rahead, buf_racount;
+
+/* Asynchronous writes from buf_sync still in progress */
+static unsigned buf_wbpending;
+
+/* Block sizes set with buf_setblocksize */
+static struct {
+	struct device *bd_dev;
+	u_int32_t bd_size;
+} buf_devsizes[BUF_MAXDEVS];
+
+static struct {
+	unsigned bs_hits;
+	unsigned bs_misses;
+	unsigned bs_reads;
+	unsigned bs_writes;
+	unsigned bs_recycled;
+	unsigned bs_reclaimed;
+	unsigned bs_raqueued;
+	unsigned bs_rahits;
+} bufstats;
+
+static void buf_readahead_thread(void *, unsigned long);
+
+void
+buf_bootstrap(void)
+{
+	int result;
+
+	buf_maxbytes = ram_npages * PAGE_SIZE / BUF_RAMFRAC;
+
+	result = thread_fork("bufreader", NULL, 0, buf_readahead_thread, NULL);
+	if (result) {
+		panic("buf_bootstrap: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+}
+
+/*
+ * Size of the blocks the cache holds for DEV: what buf_setblocksize
+ * said, or else the device's own block size.
+ */
+static
+u_int32_t
+buf_blocksize(struct device *dev)
+{
+	int i;
+
+	for (i=0; i<BUF_MAXDEVS; i++) {
+		if (buf_devsizes[i].bd_dev == dev) {
+			return buf_devsizes[i].bd_size;
+		}
+	}
+	return dev->d_blocksize;
+}
+
+////////////////////////////////////////////////////////////
+//
+// List maintenance. Called at splhigh.
+
+static
+struct buf *
+buf_lookup(struct device *dev, u_int32_t block)
+{
+	struct buf *b;
+
+	for (b = buf_hash[BUF_HASH(dev, block)]; b != NULL; b = b->b_hashnext) {
+		if (b->b_dev == dev && b->b_block == block) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+buf_hash_add(struct buf *b)
+{
+	unsigned h = BUF_HASH(b->b_dev, b->b_block);
+
+	b->b_hashnext = buf_hash[h];
+	buf_hash[h] = b;
+}
+
+static
+void
+buf_hash_remove(struct buf *b)
+{
+	struct buf **pp;
+
+	for (pp = &buf_hash[BUF_HASH(b->b_dev, b->b_block)]; *pp != NULL;
+	     pp = &(*pp)->b_hashnext) {
+		if (*pp == b) {
+			*pp = b->b_hashnext;
+			b->b_hashnext = NULL;
+			return;
+		}
+	}
+	panic("buf: block %u not in hash table\n", b->b_block);
+}
+
+static
+void
+buf_lru_addhead(struct buf *b)
+{
+	b->b_lruprev = NULL;
+	b->b_lrunext = buf_lruhead;
+	if (buf_lruhead != NULL) {
+		buf_lruhead->b_lruprev = b;
+	}
+	else {
+		buf_lrutail = b;
+	}
+	buf_lruhead = b;
+}
+
+static
+void
+buf_lru_remove(struct buf *b)
+{
+	if (b->b_lruprev != NULL) {
+		b->b_lruprev->b_lrunext = b->b_lrunext;
+	}
+	else {
+		buf_lruhead = b->b_lrunext;
+	}
+	if (b->b_lrunext != NULL) {
+		b->b_lrunext->b_lruprev = b->b_lruprev;
+	}
+	else {
+		buf_lrutail = b->b_lruprev;
+	}
+	b->b_lruprev = b->b_lrunext = NULL;
+}
+
+/*
+ * Set or clear B_DIRTY, keeping count of how much of the cache is
+ * dirty. When that gets too high, the syncer is woken up to write it
+ * back instead of waiting for its next turn.
+ */
+static
+void
+buf_setdirty(struct buf *b)
+{
+	assert(curspl>0);
+
+	if ((b->b_flags & B_DIRTY)==0) {
+		b->b_flags |= B_DIRTY;
+		buf_dirtybytes += b->b_size;
+		if (buf_dirtybytes > buf_maxbytes / BUF_DIRTYFRAC) {
+			vfs_syncer_kick();
+		}
+	}
+}
+
+static
+void
+buf_cleardirty(struct buf *b)
+{
+	assert(curspl>0);
+
+	if (b->b_flags & B_DIRTY) {
+		b->b_flags &= ~B_DIRTY;
+		buf_dirtybytes -= b->b_size;
+	}
+}
+
+/*
+ * Free a buffer that is on neither list.
+ */
+static
+void
+buf_free(struct buf *b)
+{
+	buf_bytes -= b->b_size;
+	buf_nbufs--;
+	kfree(b->b_data);
+	kfree(b);
+}
+
+/*
+ * Clear B_BUSY and let anyone waiting for the buffer have it. A
+ * buffer that never got valid contents is thrown away.
+ */
+static
+void
+buf_unbusy(struct buf *b)
+{
+	assert(curspl>0);
+	assert(b->b_flags & B_BUSY);
+
+	b->b_flags &= ~B_BUSY;
+	thread_wakeup(b);
+
+	if ((b->b_flags & B_VALID)==0) {
+		buf_hash_remove(b);
+		buf_lru_remove(b);
+		buf_free(b);
+	}
+
+	if (buf_nwaiting > 0) {
+		thread_wakeup(&buf_nwaiting);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Disk I/O
+
+/*
+ * Read or write the block in a busy buffer.
+ */
+static
+int
+buf_doio(struct buf *b, enum uio_rw rw)
+{
+	struct uio ku;
+	int tries, result;
+
+	assert(b->b_flags & B_BUSY);
+
+	for (tries=0; tries<BUF_MAXTRIES; tries++) {
+		mk_kuio(&ku, b->b_data, b->b_size,
+			((off_t)b->b_block)*b->b_size, rw);
+		result = b->b_dev->d_io(b->b_dev, &ku);
+		if (result != EIO) {
+			break;
+		}
+	}
+	if (result == EIO) {
+		kprintf("buf: block %u I/O error, giving up after %d tries\n",
+			b->b_block, tries);
+	}
+
+	if (rw == UIO_READ) {
+		bufstats.bs_reads++;
+	}
+	else {
+		bufstats.bs_writes++;
+	}
+	return result;
+}
+
+/*
+ * Write back a busy, dirty buffer. It stays in the hash table while
+ * the write is in progress so nobody can read a stale copy of the
+ * block from disk in the meantime.
+ */
+static
+int
+buf_writeback(struct buf *b)
+{
+	int result;
+
+	assert(b->b_flags & B_DIRTY);
+
+	buf_cleardirty(b);
+	result = buf_doio(b, UIO_WRITE);
+	if (result) {
+		buf_setdirty(b);
+	}
+	return result;
+}
+
+/*
+ * Asynchronous I/O through d_strategy. The completion functions run
+ * in interrupt context, so unlike buf_unbusy they leave a buffer that
+ * failed to read in the cache, idle and invalid; buf_read will try it
+ * again, and buf_alloc or buf_reclaim will get rid of it.
+ */
+static
+void
+buf_iodone(struct buf *b)
+{
+	b->b_flags &= ~B_BUSY;
+	thread_wakeup(b);
+
+	if (buf_nwaiting > 0) {
+		thread_wakeup(&buf_nwaiting);
+	}
+}
+
+static
+void
+buf_readdone(struct devreq *req)
+{
+	struct buf *b = req->dr_arg;
+
+	if (req->dr_result == 0) {
+		b->b_flags |= B_VALID;
+	}
+	else {
+		b->b_flags &= ~B_RAHEAD;
+	}
+	bufstats.bs_reads++;
+	buf_iodone(b);
+}
+
+static
+void
+buf_writedone(struct devreq *req)
+{
+	struct buf *b = req->dr_arg;
+
+	if (req->dr_result != 0) {
+		/* buf_sync will write it again the slow way */
+		buf_setdirty(b);
+	}
+	bufstats.bs_writes++;
+	buf_iodone(b);
+
+	assert(buf_wbpending > 0);
+	buf_wbpending--;
+	if (buf_wbpending == 0) {
+		thread_wakeup(&buf_wbpending);
+	}
+}
+
+/*
+ * Hand a busy buffer to the driver. Called at splhigh.
+ */
+static
+int
+buf_startio(struct buf *b, int write, void (*done)(struct devreq *))
+{
+	struct devreq *req = &b->b_req;
+
+	assert(b->b_flags & B_BUSY);
+
+	/* the driver counts in its own blocks */
+	req->dr_nblocks = b->b_size / b->b_dev->d_blocksize;
+	req->dr_block = b->b_block * req->dr_nblocks;
+	req->dr_data = b->b_data;
+	req->dr_write = write;
+	req->dr_done = done;
+	req->dr_arg = b;
+	req->dr_busy = 1;
+
+	return b->b_dev->d_strategy(b->b_dev, req);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Buffer allocation
+
+/*
+ * Allocate a brand new busy buffer of SIZE bytes. Called at splhigh;
+ * may sleep.
+ */
+static
+int
+buf_new(u_int32_t size, struct buf **ret)
+{
+	struct buf *b;
+
+	/* Reserve the space first; kmalloc may sleep. */
+	buf_bytes += size;
+	buf_nbufs++;
+
+	b = kmalloc(sizeof(struct buf));
+	if (b != NULL) {
+		b->b_data = kmalloc(size);
+		if (b->b_data == NULL) {
+			kfree(b);
+			b = NULL;
+		}
+	}
+	if (b == NULL) {
+		buf_bytes -= size;
+		buf_nbufs--;
+		return ENOMEM;
+	}
+
+	b->b_dev = NULL;
+	b->b_block = 0;
+	b->b_size = size;
+	b->b_flags = B_BUSY;
+	b->b_hashnext = b->b_lruprev = b->b_lrunext = NULL;
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Get a busy buffer of SIZE bytes that isn't on any list, either by
+ * allocating a new one or by recycling the least recently used idle
+ * one. Called at splhigh; may sleep.
+ *
+ * Metadata that hasn't been journaled yet can't be written back, so
+ * those buffers can't be recycled. If they're all that's left, wake
+ * the syncer to commit them and go over the size limit for now
+ * rather than wait for it, since the syncer may need buffers itself.
+ */
+static
+int
+buf_alloc(u_int32_t size, struct buf **ret)
+{
+	struct buf *b;
+	int result, sawmeta;
+
+	assert(curspl>0);
+
+	if (buf_bytes + size <= buf_maxbytes && buf_new(size, ret) == 0) {
+		return 0;
+	}
+
+	/* Take the least recently used buffer nobody is holding. */
+	while (1) {
+		sawmeta = 0;
+		for (b = buf_lrutail; b != NULL; b = b->b_lruprev) {
+			if ((b->b_flags & (B_BUSY|B_META))==0) {
+				break;
+			}
+			if ((b->b_flags & B_BUSY)==0) {
+				sawmeta = 1;
+			}
+		}
+		if (b != NULL) {
+			break;
+		}
+		if (sawmeta) {
+			vfs_syncer_kick();
+			if (buf_new(size, ret) == 0) {
+				return 0;
+			}
+		}
+		if (buf_nbufs == 0) {
+			return ENOMEM;
+		}
+		buf_nwaiting++;
+		thread_sleep(&buf_nwaiting);
+		buf_nwaiting--;
+	}
+
+	b->b_flags |= B_BUSY;
+	if (b->b_flags & B_DIRTY) {
+		result = buf_writeback(b);
+		if (result) {
+			buf_unbusy(b);
+			return result;
+		}
+	}
+	buf_hash_remove(b);
+	buf_lru_remove(b);
+
+	/* Anyone waiting for the old block will now look it up again. */
+	thread_wakeup(b);
+	bufstats.bs_recycled++;
+
+	if (b->b_size != size) {
+		kfree(b->b_data);
+		buf_bytes -= b->b_size;
+		b->b_data = kmalloc(size);
+		if (b->b_data == NULL) {
+			buf_nbufs--;
+			kfree(b);
+			return ENOMEM;
+		}
+		buf_bytes += size;
+		b->b_size = size;
+	}
+
+	b->b_dev = NULL;
+	b->b_block = 0;
+	b->b_flags = B_BUSY;
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Find or create the buffer for a block and mark it busy.
+ */
+static
+int
+buf_getblk(struct device *dev, u_int32_t block, struct buf **ret)
+{
+	struct buf *b, *nb = NULL;
+	int spl, result;
+
+	spl = splhigh();
+
+	while (1) {
+		b = buf_lookup(dev, block);
+		if (b == NULL) {
+			if (nb != NULL) {
+				break;
+			}
+			result = buf_alloc(buf_blocksize(dev), &nb);
+			if (result) {
+				splx(spl);
+				return result;
+			}
+			/* buf_alloc may have slept; look again */
+			continue;
+		}
+		if (b->b_flags & B_BUSY) {
+			thread_sleep(b);
+			continue;
+		}
+		break;
+	}
+
+	if (b != NULL) {
+		bufstats.bs_hits++;
+		if (b->b_flags & B_RAHEAD) {
+			bufstats.bs_rahits++;
+			b->b_flags &= ~B_RAHEAD;
+		}
+		if (nb != NULL) {
+			/* Someone else cached it while we were allocating */
+			buf_free(nb);
+		}
+		b->b_flags |= B_BUSY;
+		buf_lru_remove(b);
+	}
+	else {
+		bufstats.bs_misses++;
+		b = nb;
+		b->b_dev = dev;
+		b->b_block = block;
+		buf_hash_add(b);
+	}
+	buf_lru_addhead(b);
+
+	splx(spl);
+	*ret = b;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Interface
+
+void
+buf_setblocksize(struct device *dev, u_int32_t size)
+{
+	int spl, i, slot = -1;
+
+	assert(size % dev->d_blocksize == 0);
+
+	spl = splhigh();
+	for (i=0; i<BUF_MAXDEVS; i++) {
+		if (buf_devsizes[i].bd_dev == dev) {
+			slot = i;
+			break;
+		}
+		if (buf_devsizes[i].bd_dev == NULL && slot < 0) {
+			slot = i;
+		}
+	}
+	if (slot < 0) {
+		panic("buf_setblocksize: too many devices\n");
+	}
+
+	if (size == 0 || size == dev->d_blocksize) {
+		buf_devsizes[slot].bd_dev = NULL;
+	}
+	else {
+		buf_devsizes[slot].bd_dev = dev;
+		buf_devsizes[slot].bd_size = size;
+	}
+	splx(spl);
+}
+
+int
+buf_read(struct device *dev, u_int32_t block, struct buf **ret)
+{
+	struct buf *b;
+	int result;
+
+	result = buf_getblk(dev, block, &b);
+	if (result) {
+		return result;
+	}
+
+	if ((b->b_flags & B_VALID)==0) {
+		result = buf_doio(b, UIO_READ);
+		if (result) {
+			buf_release(b);
+			return result;
+		}
+		b->b_flags |= B_VALID;
+	}
+
+	*ret = b;
+	return 0;
+}
+
+int
+buf_get(struct device *dev, u_int32_t block, struct buf **ret)
+{
+	return buf_getblk(dev, block, ret);
+}
+
+void
+buf_markdirty(struct buf *b)
+{
+	int spl;
+
+	assert(b->b_flags & B_BUSY);
+
+	spl = splhigh();
+	b->b_flags |= B_VALID;
+	/* it holds plain data now, even if it was metadata before */
+	b->b_flags &= ~(B_META|B_JOURNAL);
+	buf_setdirty(b);
+	splx(spl);
+}
+
+void
+buf_markmeta(struct buf *b)
+{
+	int spl;
+
+	assert(b->b_flags & B_BUSY);
+
+	spl = splhigh();
+	b->b_flags |= B_VALID | B_META;
+	b->b_flags &= ~B_JOURNAL;
+	buf_setdirty(b);
+	splx(spl);
+}
+
+/*
+ * Hand back up to MAX blocks of DEV holding metadata that has not
+ * been journaled, and remember that they are being journaled now.
+ * Blocks from a journal commit that failed are handed back again.
+ */
+int
+buf_getmeta(struct device *dev, u_int32_t *blocks, int max)
+{
+	struct buf *b;
+	int spl, n = 0;
+
+	spl = splhigh();
+	for (b = buf_lruhead; b != NULL && n < max; b = b->b_lrunext) {
+		if (b->b_dev == dev && (b->b_flags & B_META)) {
+			b->b_flags |= B_JOURNAL;
+			blocks[n++] = b->b_block;
+		}
+	}
+	splx(spl);
+
+	return n;
+}
+
+/*
+ * The journal has committed these blocks. Those that haven't changed
+ * again since buf_getmeta may now be written back like any others.
+ */
+void
+buf_commitmeta(struct device *dev, const u_int32_t *blocks, int n)
+{
+	struct buf *b;
+	int spl, i;
+
+	spl = splhigh();
+	for (i=0; i<n; i++) {
+		b = buf_lookup(dev, blocks[i]);
+		if (b != NULL && (b->b_flags & B_JOURNAL)) {
+			b->b_flags &= ~(B_META|B_JOURNAL);
+		}
+	}
+	if (buf_nwaiting > 0) {
+		thread_wakeup(&buf_nwaiting);
+	}
+	splx(spl);
+}
+
+void
+buf_release(struct buf *b)
+{
+	int spl = splhigh();
+	buf_unbusy(b);
+	splx(spl);
+}
+
+/*
+ * Queue a block to be read in the background. The buffer goes into
+ * the hash table busy right away, so anyone who wants the block
+ * before the read is done simply waits for it like any other busy
+ * buffer, instead of reading it a second time.
+ */
+void
+buf_readahead(struct device *dev, u_int32_t block)
+{
+	struct buf *b;
+	int spl;
+
+	spl = splhigh();
+
+	if (buf_racount == BUF_RAQUEUE || buf_lookup(dev, block) != NULL) {
+		splx(spl);
+		return;
+	}
+
+	if (buf_alloc(buf_blocksize(dev), &b)) {
+		splx(spl);
+		return;
+	}
+
+	/* buf_alloc may have slept; check again */
+	if (buf_racount == BUF_RAQUEUE || buf_lookup(dev, block) != NULL) {
+		buf_free(b);
+		splx(spl);
+		return;
+	}
+
+	b->b_dev = dev;
+	b->b_block = block;
+	b->b_flags |= B_RAHEAD;
+	buf_hash_add(b);
+	buf_lru_addhead(b);
+	bufstats.bs_raqueued++;
+
+	if (dev->d_strategy != NULL) {
+		if (buf_startio(b, 0, buf_readdone)) {
+			buf_unbusy(b);
+		}
+		splx(spl);
+		return;
+	}
+
+	buf_raqueue[(buf_rahead + buf_racount) % BUF_RAQUEUE] = b;
+	buf_racount++;
+	thread_wakeup(&buf_racount);
+
+	splx(spl);
+}
+
+/*
+ * The read-ahead thread, for devices without d_strategy. Fills in
+ * queued buffers one at a time and releases them, which wakes anyone
+ * already waiting for them.
+ */
+static
+void
+buf_readahead_thread(void *unused1, unsigned long unused2)
+{
+	struct buf *b;
+	int spl;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		spl = splhigh();
+		while (buf_racount == 0) {
+			thread_sleep(&buf_racount);
+		}
+		b = buf_raqueue[buf_rahead];
+		buf_rahead = (buf_rahead + 1) % BUF_RAQUEUE;
+		buf_racount--;
+		splx(spl);
+
+		if (buf_doio(b, UIO_READ) == 0) {
+			b->b_flags |= B_VALID;
+		}
+
+		/* If the read failed, this throws the buffer away */
+		buf_release(b);
+	}
+}
+
+int
+buf_incore(struct device *dev, u_int32_t block)
+{
+	int spl, ret;
+
+	spl = splhigh();
+	ret = buf_lookup(dev, block) != NULL;
+	splx(spl);
+
+	return ret;
+}
+
+int
+buf_isheld(struct device *dev, u_int32_t block)
+{
+	struct buf *b;
+	int spl, ret;
+
+	spl = splhigh();
+	b = buf_lookup(dev, block);
+	ret = b != NULL && (b->b_flags & B_META) != 0;
+	splx(spl);
+
+	return ret;
+}
+
+void
+buf_discard(struct device *dev, u_int32_t block)
+{
+	struct buf *b;
+	int spl;
+
+	spl = splhigh();
+
+	while ((b = buf_lookup(dev, block)) != NULL) {
+		if (b->b_flags & B_BUSY) {
+			thread_sleep(b);
+			continue;
+		}
+		buf_cleardirty(b);
+		buf_hash_remove(b);
+		buf_lru_remove(b);
+		buf_free(b);
+		break;
+	}
+
+	splx(spl);
+}
+
+int
+buf_flush(struct device *dev, u_int32_t block)
+{
+	struct buf *b;
+	int spl, result;
+
+	spl = splhigh();
+
+	while (1) {
+		b = buf_lookup(dev, block);
+		if (b == NULL || (b->b_flags & (B_DIRTY|B_META)) != B_DIRTY) {
+			/* Clean, or waiting to be journaled */
+			splx(spl);
+			return 0;
+		}
+		if ((b->b_flags & B_BUSY)==0) {
+			break;
+		}
+		thread_sleep(b);
+	}
+
+	b->b_flags |= B_BUSY;
+	result = buf_writeback(b);
+	buf_unbusy(b);
+
+	splx(spl);
+	return result;
+}
+
+int
+buf_sync(struct device *dev)
+{
+	struct buf *b, *next;
+	int spl, result;
+
+	spl = splhigh();
+
+	/*
+	 * If the device can queue requests, start all the writes at
+	 * once and wait for them together. Anything busy, or that
+	 * fails, is left for the loop below.
+	 */
+	if (dev->d_strategy != NULL) {
+		for (b = buf_lruhead; b != NULL; b = b->b_lrunext) {
+			if (b->b_dev != dev ||
+			    (b->b_flags & (B_DIRTY|B_BUSY|B_META)) != B_DIRTY) {
+				continue;
+			}
+			b->b_flags |= B_BUSY;
+			buf_cleardirty(b);
+			buf_wbpending++;
+			if (buf_startio(b, 1, buf_writedone)) {
+				buf_wbpending--;
+				buf_setdirty(b);
+				buf_unbusy(b);
+			}
+		}
+		while (buf_wbpending > 0) {
+			thread_sleep(&buf_wbpending);
+		}
+	}
+
+ restart:
+	for (b = buf_lruhead; b != NULL; b = next) {
+		next = b->b_lrunext;
+
+		if (b->b_dev != dev || (b->b_flags & (B_DIRTY|B_META)) != B_DIRTY) {
+			continue;
+		}
+		if (b->b_flags & B_BUSY) {
+			/* It may be gone when we wake up; start over */
+			thread_sleep(b);
+			goto restart;
+		}
+
+		b->b_flags |= B_BUSY;
+		result = buf_writeback(b);
+
+		/* Still busy, so still on the list; its successor is current */
+		next = b->b_lrunext;
+		buf_unbusy(b);
+
+		if (result) {
+			splx(spl);
+			return result;
+		}
+	}
+
+	splx(spl);
+	return 0;
+}
+
+void
+buf_invalidate(struct device *dev)
+{
+	struct buf *b, *next;
+	int spl;
+
+	spl = splhigh();
+
+ restart:
+	for (b = buf_lruhead; b != NULL; b = next) {
+		next = b->b_lrunext;
+		if (b->b_dev != dev) {
+			continue;
+		}
+		if (b->b_flags & B_BUSY) {
+			/* Only a read-ahead can still be in progress */
+			thread_sleep(b);
+			goto restart;
+		}
+		assert((b->b_flags & B_DIRTY)==0);
+		buf_hash_remove(b);
+		buf_lru_remove(b);
+		buf_free(b);
+	}
+
+	splx(spl);
+}
+
+/*
+ * Called from the page allocator with interrupts off when there are
+ * no free pages, before it resorts to evicting a user page. Clean
+ * buffers can be dropped without any I/O, so they are the cheapest
+ * memory in the system to give back.
+ */
+int
+buf_reclaim(void)
+{
+	struct buf *b;
+
+	assert(curspl>0);
+
+	for (b = buf_lrutail; b != NULL; b = b->b_lruprev) {
+		if ((b->b_flags & (B_BUSY|B_DIRTY))==0) {
+			buf_hash_remove(b);
+			buf_lru_remove(b);
+			buf_free(b);
+			bufstats.bs_reclaimed++;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void
+buf_printstats(void)
+{
+	kprintf("Buffer cache: %u buffers, %u of %u bytes, %u dirty\n",
+		buf_nbufs, buf_bytes, buf_maxbytes, buf_dirtybytes);
+	kprintf("    %u hits, %u misses, %u reads, %u writes\n",
+		bufstats.bs_hits, bufstats.bs_misses,
+		bufstats.bs_reads, bufstats.bs_writes);
+	kprintf("    %u recycled, %u reclaimed by the VM\n",
+		bufstats.bs_recycled, bufstats.bs_reclaimed);
+	kprintf("    %u read ahead, %u of them used\n",
+		bufstats.bs_raqueued, bufstats.bs_rahits);
+}
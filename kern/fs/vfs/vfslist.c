@@ -8,6 +8,9 @@
 #include <synch.h>
 #include <array.h>
 #include <kern/errno.h>
+#include <machine/spl.h>
+#include <clock.h>
+#include <thread.h>
 #include <vfs.h>
 #include <vnode.h>
 #include <fs.h>
@@ -70,6 +73,7 @@ vfs_bootstrap(void)
 	}
 
 	vfs_initbootfs();
+	vfs_initncache();
 	devnull_create();
 	// ===========================================
 	// open_file_lock = lock_create("open file lock");
@@ -99,6 +103,85 @@ vfs_sync(void)
 	return 0;
 }
 
+/*
+ * The syncer.
+ *
+ * Data and metadata written to filesystems sit in the buffer cache,
+ * and inodes and free maps in memory, until something syncs them.
+ * The syncer thread calls vfs_sync every SYNC_INTERVAL seconds, as
+ * counted by hardclock, or sooner if the buffer cache asks for it
+ * because too much of it is dirty. Callers who need their data on
+ * disk right away still use fsync.
+ */
+
+/* Seconds between syncs */
+#define SYNC_INTERVAL  5
+
+static int syncer_ticks;	/* hardclocks since the last sync */
+static int syncer_wanted;	/* set to wake the syncer */
+
+static
+void
+vfs_syncer_thread(void *unused1, unsigned long unused2)
+{
+	int spl;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		spl = splhigh();
+		while (!syncer_wanted) {
+			thread_sleep(&syncer_wanted);
+		}
+		syncer_wanted = 0;
+		syncer_ticks = 0;
+		splx(spl);
+
+		vfs_sync();
+	}
+}
+
+void
+vfs_syncer_bootstrap(void)
+{
+	int result;
+
+	result = thread_fork("syncer", NULL, 0, vfs_syncer_thread, NULL);
+	if (result) {
+		panic("vfs: Could not start syncer: %s\n", strerror(result));
+	}
+}
+
+/*
+ * Called from hardclock.
+ */
+void
+vfs_syncer_tick(void)
+{
+	syncer_ticks++;
+	if (syncer_ticks >= SYNC_INTERVAL*HZ && !syncer_wanted) {
+		syncer_wanted = 1;
+		thread_wakeup(&syncer_wanted);
+	}
+}
+
+/*
+ * Ask for a sync now.
+ */
+void
+vfs_syncer_kick(void)
+{
+	int spl;
+
+	spl = splhigh();
+	if (!syncer_wanted) {
+		syncer_wanted = 1;
+		thread_wakeup(&syncer_wanted);
+	}
+	splx(spl);
+}
+
 /*
  * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
  * back an appropriate vnode.
@@ -507,6 +590,8 @@ vfs_unmount(const char *devname)
 	assert(kd->kd_rawname != NULL);
 	assert(kd->kd_device != NULL);
 
+	vfs_ncache_purgefs(kd->kd_fs);
+
 	result = FSOP_SYNC(kd->kd_fs);
 	if (result) {
 		goto puke;
@@ -554,6 +639,8 @@ vfs_unmountall(void)
 
 		kprintf("vfs: Unmounting %s:\n", dev->kd_name);
 
+		vfs_ncache_purgefs(dev->kd_fs);
+
 		result = FSOP_SYNC(dev->kd_fs);
 		if (result) {
 			kprintf("vfs: Warning: sync failed for %s: %s, trying "
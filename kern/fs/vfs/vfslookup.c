@@ -200,6 +200,439 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 	return 0;
 }
 
+/*
+ * Name cache.
+ *
+ * Maps (directory vnode, name) to the vnode the name refers to, or to
+ * "no such file" for names that were looked up and not found. Path
+ * translation below goes one component at a time through the cache,
+ * so paths that are used over and over (swap files, programs) don't
+ * go to the filesystem at all after the first time.
+ *
+ * Each entry holds a reference to its directory and, for names that
+ * exist, to the vnode found. The operations in vfspath.c that change
+ * names call vfs_ncache_purge, and vfs_unmount calls
+ * vfs_ncache_purgefs so the references don't keep it busy.
+ *
+ * A lookup can sleep in the filesystem while a name is being changed,
+ * and come back with the answer from before the change after the
+ * purge is done. So changes are bracketed by vfs_ncache_begin and
+ * vfs_ncache_end, each of which bumps nc_gen; a lookup only enters
+ * what it found if nc_gen is what it was when the lookup started and
+ * no change is in progress.
+ *
+ * Names longer than NC_NAMELEN-1 and "." and ".." are never cached.
+ */
+
+#define NC_SIZE     64		/* number of entries */
+#define NC_HASHSIZE 32		/* number of hash chains; power of 2 */
+#define NC_NAMELEN  32		/* longest name cached, plus one */
+
+struct ncentry {
+	struct vnode *nc_dir;		/* directory; NULL if entry unused */
+	struct vnode *nc_vn;		/* what the name is; NULL if nothing */
+	char nc_name[NC_NAMELEN];
+
+	struct ncentry *nc_hashnext;	/* hash chain */
+	struct ncentry *nc_lruprev;	/* LRU list, most recent first */
+	struct ncentry *nc_lrunext;
+};
+
+static struct ncentry nc_entries[NC_SIZE];
+static struct ncentry *nc_hash[NC_HASHSIZE];
+static struct ncentry *nc_lruhead, *nc_lrutail;
+static struct lock *nc_lock;
+static u_int32_t nc_gen;		/* bumped around each change */
+static int nc_changing;			/* changes in progress */
+
+static
+unsigned
+nc_hashfunc(struct vnode *dir, const char *name)
+{
+	unsigned h = ((unsigned)dir) >> 4;
+
+	while (*name) {
+		h = h*33 + (unsigned char)*name++;
+	}
+	return h & (NC_HASHSIZE-1);
+}
+
+static
+int
+nc_cacheable(const char *name)
+{
+	if (strlen(name) >= NC_NAMELEN) {
+		return 0;
+	}
+	if (!strcmp(name, ".") || !strcmp(name, "..")) {
+		return 0;
+	}
+	return 1;
+}
+
+static
+void
+nc_lru_remove(struct ncentry *nc)
+{
+	if (nc->nc_lruprev != NULL) {
+		nc->nc_lruprev->nc_lrunext = nc->nc_lrunext;
+	}
+	else {
+		nc_lruhead = nc->nc_lrunext;
+	}
+	if (nc->nc_lrunext != NULL) {
+		nc->nc_lrunext->nc_lruprev = nc->nc_lruprev;
+	}
+	else {
+		nc_lrutail = nc->nc_lruprev;
+	}
+}
+
+static
+void
+nc_lru_addhead(struct ncentry *nc)
+{
+	nc->nc_lruprev = NULL;
+	nc->nc_lrunext = nc_lruhead;
+	if (nc_lruhead != NULL) {
+		nc_lruhead->nc_lruprev = nc;
+	}
+	else {
+		nc_lrutail = nc;
+	}
+	nc_lruhead = nc;
+}
+
+/*
+ * Take an entry out of the hash table and move it to the tail of the
+ * LRU list so it gets reused first. The caller must drop the
+ * references it held (returned in DIR and VN) after letting go of
+ * nc_lock, since that may reclaim the vnodes.
+ */
+static
+void
+nc_remove(struct ncentry *nc, struct vnode **dir, struct vnode **vn)
+{
+	struct ncentry **pp;
+
+	assert(nc->nc_dir != NULL);
+
+	pp = &nc_hash[nc_hashfunc(nc->nc_dir, nc->nc_name)];
+	while (*pp != nc) {
+		pp = &(*pp)->nc_hashnext;
+	}
+	*pp = nc->nc_hashnext;
+
+	*dir = nc->nc_dir;
+	*vn = nc->nc_vn;
+	nc->nc_dir = NULL;
+	nc->nc_vn = NULL;
+
+	nc_lru_remove(nc);
+	nc->nc_lruprev = nc_lrutail;
+	nc->nc_lrunext = NULL;
+	if (nc_lrutail != NULL) {
+		nc_lrutail->nc_lrunext = nc;
+	}
+	else {
+		nc_lruhead = nc;
+	}
+	nc_lrutail = nc;
+}
+
+static
+struct ncentry *
+nc_find(struct vnode *dir, const char *name)
+{
+	struct ncentry *nc;
+
+	for (nc = nc_hash[nc_hashfunc(dir, name)]; nc; nc = nc->nc_hashnext) {
+		if (nc->nc_dir == dir && !strcmp(nc->nc_name, name)) {
+			return nc;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+nc_release(struct vnode *dir, struct vnode *vn)
+{
+	if (vn != NULL) {
+		VOP_DECREF(vn);
+	}
+	if (dir != NULL) {
+		VOP_DECREF(dir);
+	}
+}
+
+void
+vfs_initncache(void)
+{
+	int i;
+
+	nc_lock = lock_create("ncache");
+	if (nc_lock == NULL) {
+		panic("vfs: Could not create name cache lock\n");
+	}
+
+	for (i=0; i<NC_SIZE; i++) {
+		nc_entries[i].nc_dir = NULL;
+		nc_entries[i].nc_vn = NULL;
+		nc_entries[i].nc_hashnext = NULL;
+		nc_lru_addhead(&nc_entries[i]);
+	}
+}
+
+/*
+ * Look up NAME in DIR in the cache. Returns 0 and an incref'd vnode
+ * if the name is there, ENOENT if it's known not to exist, and -1 if
+ * the cache doesn't know.
+ */
+static
+int
+nc_lookup(struct vnode *dir, const char *name, struct vnode **ret)
+{
+	struct ncentry *nc;
+	int result;
+
+	if (!nc_cacheable(name)) {
+		return -1;
+	}
+
+	lock_acquire(nc_lock);
+	nc = nc_find(dir, name);
+	if (nc == NULL) {
+		result = -1;
+	}
+	else {
+		nc_lru_remove(nc);
+		nc_lru_addhead(nc);
+		if (nc->nc_vn == NULL) {
+			result = ENOENT;
+		}
+		else {
+			VOP_INCREF(nc->nc_vn);
+			*ret = nc->nc_vn;
+			result = 0;
+		}
+	}
+	lock_release(nc_lock);
+	return result;
+}
+
+/*
+ * Return the current generation, for a lookup about to start.
+ */
+static
+u_int32_t
+nc_getgen(void)
+{
+	u_int32_t gen;
+
+	lock_acquire(nc_lock);
+	gen = nc_gen;
+	lock_release(nc_lock);
+	return gen;
+}
+
+/*
+ * Remember that NAME in DIR is VN (NULL meaning it doesn't exist),
+ * as found by a lookup that started at generation GEN.
+ */
+static
+void
+nc_enter(struct vnode *dir, const char *name, struct vnode *vn, u_int32_t gen)
+{
+	struct ncentry *nc;
+	struct vnode *olddir = NULL, *oldvn = NULL;
+	unsigned h;
+
+	if (!nc_cacheable(name)) {
+		return;
+	}
+
+	lock_acquire(nc_lock);
+
+	if (gen != nc_gen || nc_changing > 0) {
+		/* Something changed while we looked; it may be stale */
+		lock_release(nc_lock);
+		return;
+	}
+
+	nc = nc_find(dir, name);
+	if (nc != NULL) {
+		/* Someone else got here first */
+		lock_release(nc_lock);
+		return;
+	}
+
+	nc = nc_lrutail;
+	if (nc->nc_dir != NULL) {
+		nc_remove(nc, &olddir, &oldvn);
+	}
+
+	VOP_INCREF(dir);
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	nc->nc_dir = dir;
+	nc->nc_vn = vn;
+	strcpy(nc->nc_name, name);
+
+	h = nc_hashfunc(dir, name);
+	nc->nc_hashnext = nc_hash[h];
+	nc_hash[h] = nc;
+	nc_lru_remove(nc);
+	nc_lru_addhead(nc);
+
+	lock_release(nc_lock);
+
+	nc_release(olddir, oldvn);
+}
+
+/*
+ * Start and finish an operation that changes names. Nothing found by
+ * a lookup that overlaps one gets into the cache.
+ */
+void
+vfs_ncache_begin(void)
+{
+	lock_acquire(nc_lock);
+	nc_changing++;
+	nc_gen++;
+	lock_release(nc_lock);
+}
+
+void
+vfs_ncache_end(void)
+{
+	lock_acquire(nc_lock);
+	assert(nc_changing > 0);
+	nc_changing--;
+	nc_gen++;
+	lock_release(nc_lock);
+}
+
+/*
+ * Forget NAME in DIR, because it's been created, removed, or renamed.
+ * If it was a directory, forget everything cached under it as well.
+ */
+void
+vfs_ncache_purge(struct vnode *dir, const char *name)
+{
+	struct ncentry *nc;
+	struct vnode *olddir, *oldvn;
+	struct vnode *ncdir, *subdir;
+	int i;
+
+	if (!nc_cacheable(name)) {
+		return;
+	}
+
+	lock_acquire(nc_lock);
+	nc = nc_find(dir, name);
+	if (nc == NULL) {
+		lock_release(nc_lock);
+		return;
+	}
+	nc_remove(nc, &ncdir, &subdir);
+
+	/* Our reference to the old vnode keeps it from being reused */
+	if (subdir != NULL) {
+		for (i=0; i<NC_SIZE; i++) {
+			nc = &nc_entries[i];
+			if (nc->nc_dir == subdir) {
+				nc_remove(nc, &olddir, &oldvn);
+				lock_release(nc_lock);
+				nc_release(olddir, oldvn);
+				lock_acquire(nc_lock);
+			}
+		}
+	}
+	lock_release(nc_lock);
+
+	nc_release(ncdir, subdir);
+}
+
+/*
+ * Forget everything on the filesystem FS, so it can be unmounted.
+ */
+void
+vfs_ncache_purgefs(struct fs *fs)
+{
+	struct ncentry *nc;
+	struct vnode *olddir, *oldvn;
+	int i;
+
+	lock_acquire(nc_lock);
+	for (i=0; i<NC_SIZE; i++) {
+		nc = &nc_entries[i];
+		if (nc->nc_dir != NULL && nc->nc_dir->vn_fs == fs) {
+			nc_remove(nc, &olddir, &oldvn);
+			lock_release(nc_lock);
+			nc_release(olddir, oldvn);
+			lock_acquire(nc_lock);
+		}
+	}
+	lock_release(nc_lock);
+}
+
+/*
+ * Translate PATH relative to the directory DIR one component at a
+ * time, using the name cache.
+ */
+static
+int
+vfs_walk(struct vnode *dir, char *path, struct vnode **ret)
+{
+	struct vnode *cur, *vn;
+	char *next;
+	u_int32_t gen;
+	int result;
+
+	VOP_INCREF(dir);
+	cur = dir;
+
+	while (1) {
+		while (*path == '/') {
+			path++;
+		}
+		if (*path == 0) {
+			*ret = cur;
+			return 0;
+		}
+
+		next = strchr(path, '/');
+		if (next != NULL) {
+			*next++ = 0;
+		}
+
+		result = nc_lookup(cur, path, &vn);
+		if (result < 0) {
+			gen = nc_getgen();
+			result = VOP_LOOKUP(cur, path, &vn);
+			if (result == 0) {
+				nc_enter(cur, path, vn, gen);
+			}
+			else if (result == ENOENT) {
+				nc_enter(cur, path, NULL, gen);
+			}
+		}
+		VOP_DECREF(cur);
+		if (result) {
+			return result;
+		}
+
+		cur = vn;
+		if (next == NULL) {
+			*ret = cur;
+			return 0;
+		}
+		path = next;
+	}
+}
+
 /*
  * Name-to-vnode translation.
  * (In BSD, both of these are subsumed by namei().)
@@ -209,7 +642,8 @@ int
 vfs_lookparent(char *path, struct vnode **retval,
 	       char *buf, size_t buflen)
 {
-	struct vnode *startvn;
+	struct vnode *startvn, *dir;
+	char *s;
 	int result;
 
 	result = getdevice(path, &path, &startvn);
@@ -225,9 +659,18 @@ vfs_lookparent(char *path, struct vnode **retval,
 		 */
 		result = EINVAL;
 	}
-	else {
+	else if ((s = strrchr(path, '/')) == NULL) {
 		result = VOP_LOOKPARENT(startvn, path, retval, buf, buflen);
 	}
+	else {
+		/* Find the directory through the name cache */
+		*s++ = 0;
+		result = vfs_walk(startvn, path, &dir);
+		if (result == 0) {
+			result = VOP_LOOKPARENT(dir, s, retval, buf, buflen);
+			VOP_DECREF(dir);
+		}
+	}
 
 	VOP_DECREF(startvn);
 	return result;
@@ -249,7 +692,7 @@ vfs_lookup(char *path, struct vnode **retval)
 		return 0;
 	}
 
-	result = VOP_LOOKUP(startvn, path, retval);
+	result = vfs_walk(startvn, path, retval);
 
 	VOP_DECREF(startvn);
 	return result;
@@ -44,7 +44,10 @@ vfs_open(char *path, int openflags, struct vnode **ret)
 			return result;
 		}
 
+		vfs_ncache_begin();
 		result = VOP_CREAT(dir, name, excl, &vn);
+		vfs_ncache_purge(dir, name);
+		vfs_ncache_end();
 
 		VOP_DECREF(dir);
 	}
@@ -120,7 +123,10 @@ vfs_remove(char *path)
 		return result;
 	}
 
+	vfs_ncache_begin();
 	result = VOP_REMOVE(dir, name);
+	vfs_ncache_purge(dir, name);
+	vfs_ncache_end();
 	VOP_DECREF(dir);
 
 	return result;
@@ -153,7 +159,11 @@ vfs_rename(char *oldpath, char *newpath)
 		return EXDEV;
 	}
 
+	vfs_ncache_begin();
 	result = VOP_RENAME(olddir, oldname, newdir, newname);
+	vfs_ncache_purge(olddir, oldname);
+	vfs_ncache_purge(newdir, newname);
+	vfs_ncache_end();
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(olddir);
@@ -187,7 +197,10 @@ vfs_link(char *oldpath, char *newpath)
 		return EXDEV;
 	}
 
+	vfs_ncache_begin();
 	result = VOP_LINK(newdir, newname, oldfile);
+	vfs_ncache_purge(newdir, newname);
+	vfs_ncache_end();
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(oldfile);
@@ -214,7 +227,10 @@ vfs_symlink(const char *contents, char *path)
 		return result;
 	}
 
+	vfs_ncache_begin();
 	result = VOP_SYMLINK(newdir, newname, contents);
+	vfs_ncache_purge(newdir, newname);
+	vfs_ncache_end();
 	VOP_DECREF(newdir);
 
 	return result;
@@ -260,7 +276,10 @@ vfs_mkdir(char *path)
 		return result;
 	}
 
+	vfs_ncache_begin();
 	result = VOP_MKDIR(parent, name);
+	vfs_ncache_purge(parent, name);
+	vfs_ncache_end();
 
 	VOP_DECREF(parent);
 
@@ -282,7 +301,10 @@ vfs_rmdir(char *path)
 		return result;
 	}
 
+	vfs_ncache_begin();
 	result = VOP_RMDIR(parent, name);
+	vfs_ncache_purge(parent, name);
+	vfs_ncache_end();
 
 	VOP_DECREF(parent);
 
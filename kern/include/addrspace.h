@@ -8,9 +8,21 @@
 
 #define DUMBVM_STACKPAGES 12
 
+/* as_prepare_load modes: allocate a zero-filled page, or just set up the PTE */
 #define GETPAGE 1
 #define GETENTRY 0
 
+/* max number of stack pages: the last MAXSTACK pages below USERSTACK */
+#define MAXSTACK 64
+
+/*
+ * number of swap file slots per as: the offset field of a PTE is 12 bits,
+ * and stores slot+1 so that 0 means "never swapped out"
+ */
+#define SWAP_NSLOTS (SWAP_FRAME/1048576)
+
+struct bitmap;
+
 /* 
  * Address space - data structure associated with the virtual memory
  * space of a process.
@@ -69,6 +81,8 @@ struct addrspace {
 	size_t swapfilecount;
 
 	size_t swapfilesize;
+	/* swap file slots in use; freed slots are reused by eviction */
+	struct bitmap *swapmap;
 	/* heap_start is the master PT index for start of heap */
 	vaddr_t heap_start;
 	vaddr_t heap_end;
@@ -77,6 +91,9 @@ struct addrspace {
 /*
  * Functions in addrspace.c:
  *
+ *    as_bootstrap - set up the caches address spaces and page tables
+ *                come from. Called once, from vm_bootstrap.
+ *
  *    as_create - create a new empty address space. You need to make 
  *                sure this gets called in all the right places. You
  *                may find you want to change the argument list. May
@@ -106,8 +123,13 @@ struct addrspace {
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_release_pages - drop the pages in [start, end): free the frames
+ *                and swap slots behind them and clear their PTEs.
+ *                Used when the heap shrinks.
  */
 
+void              as_bootstrap(void);
 struct addrspace *as_create(void);
 int               as_copy(struct addrspace *src, struct addrspace **ret);
 void              as_activate(struct addrspace *);
@@ -122,6 +144,7 @@ int		  as_prepare_load(struct addrspace *as,
 				  int mode);
 int		  as_complete_load(struct addrspace *as, int status, int master_i, int secondary_i);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+void              as_release_pages(struct addrspace *as, vaddr_t start, vaddr_t end);
 
 /*
  * Functions in loadelf.c
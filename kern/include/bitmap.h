@@ -8,7 +8,18 @@
  *     bitmap_create  - allocate a new bitmap object.
  *                      Returns NULL on error.
  *     bitmap_getdata - return pointer to raw bit data (for I/O).
+ *                      Bits may be set through it, but not cleared,
+ *                      except by reading in the data right after
+ *                      bitmap_create.
  *     bitmap_alloc   - locate a cleared bit, set it, and return its index.
+ *                      Always the lowest cleared bit.
+ *     bitmap_alloc_from - like bitmap_alloc, but look first at the given
+ *                      index and upwards from it, wrapping around at the
+ *                      end, so allocations can be kept near a goal.
+ *     bitmap_alloc_run - locate N cleared bits in a row, set them, and
+ *                      return the index of the first. The search starts
+ *                      just past the previous run and wraps around.
+ *     bitmap_count   - return how many bits are set.
  *     bitmap_mark    - set a clear bit by its index.
  *     bitmap_unmark  - clear a set bit by its index.
  *     bitmap_isset   - return whether a particular bit is set or not.
@@ -20,6 +31,11 @@ struct bitmap;  /* Opaque. */
 struct bitmap *bitmap_create(u_int32_t nbits);
 void          *bitmap_getdata(struct bitmap *);
 int            bitmap_alloc(struct bitmap *, u_int32_t *index);
+int            bitmap_alloc_from(struct bitmap *, u_int32_t start,
+				 u_int32_t *index);
+int            bitmap_alloc_run(struct bitmap *, u_int32_t n,
+				u_int32_t *index);
+u_int32_t      bitmap_count(struct bitmap *);
 void           bitmap_mark(struct bitmap *, u_int32_t index);
 void           bitmap_unmark(struct bitmap *, u_int32_t index);
 int	       bitmap_isset(struct bitmap *, u_int32_t index);
@@ -0,0 +1,114 @@
+#ifndef _BUF_H_
+#define _BUF_H_
+
+/*
+ * Block buffer cache.
+ *
+ * Buffers are keyed by (device, block number) and hold one block
+ * each: a device block, or a filesystem block if the filesystem set a
+ * bigger size with buf_setblocksize. A buffer handed back by
+ * buf_read or buf_get is busy: nobody else can get at it until it is
+ * given back with buf_release. Changes are written back lazily - mark
+ * the buffer dirty before releasing it and it goes to disk on
+ * buf_flush or buf_sync, or when the buffer is recycled for another
+ * block.
+ *
+ * The buffers are kmalloc'd, so the cache lives in coremap pages.
+ * It grows up to a fixed fraction of RAM, and the VM can take clean
+ * buffers back with buf_reclaim when it runs out of free pages.
+ *
+ * Functions:
+ *     buf_bootstrap  - set up the cache. Called once at boot.
+ *     buf_setblocksize - make the cache deal in blocks of SIZE bytes for
+ *                      a device, rather than the device's own block
+ *                      size; block numbers then count in those units.
+ *                      SIZE must be a multiple of d_blocksize, or 0 to
+ *                      go back to it. Only call when nothing of the
+ *                      device is cached.
+ *     buf_read       - get a buffer holding the contents of a block.
+ *     buf_get        - get a buffer for a block without reading it in,
+ *                      for callers about to overwrite all of it.
+ *     buf_markdirty  - record that the contents of a buffer changed.
+ *                      The buffer holds plain data from then on, even
+ *                      if it was marked with buf_markmeta before.
+ *     buf_markmeta   - likewise, for filesystem metadata that must go
+ *                      into a journal before it is written in place.
+ *                      The buffer is not written back, by buf_sync or
+ *                      anything else, until buf_commitmeta says so.
+ *     buf_release    - give a buffer back. A buffer that was never
+ *                      read or written is discarded.
+ *     buf_readahead  - start reading a block into the cache in the
+ *                      background, if it isn't there already. This is
+ *                      only a hint and may be ignored. Devices with a
+ *                      d_strategy function are read from directly;
+ *                      others go through a helper thread.
+ *     buf_incore     - return whether a block is in the cache.
+ *     buf_isheld     - return whether a block is in the cache and held
+ *                      back by buf_markmeta.
+ *     buf_discard    - drop the cached copy of a block, dirty or not,
+ *                      because it has just been overwritten on disk or
+ *                      its contents no longer matter.
+ *     buf_flush      - write back one block, if it's cached and dirty.
+ *     buf_sync       - write back every dirty block of a device, apart
+ *                      from metadata waiting for a journal. If the
+ *                      device has d_strategy, all the writes are queued
+ *                      at once so the driver can sort them.
+ *     buf_invalidate - drop every block of a device. The caller must
+ *                      have synced it first.
+ *     buf_getmeta    - list the blocks of a device marked with
+ *                      buf_markmeta since they were last journaled.
+ *     buf_commitmeta - report that those blocks are in the journal, so
+ *                      they can be written back. Blocks changed again
+ *                      after buf_getmeta stay held.
+ *     buf_reclaim    - free one clean, idle buffer. Returns 1 if it
+ *                      found one. Does not sleep.
+ *     buf_printstats - print the cache counters.
+ */
+
+#include <dev.h>
+
+struct buf {
+	struct device *b_dev;		/* device the block is on */
+	u_int32_t b_block;		/* block number on that device */
+	u_int32_t b_size;		/* block size (see buf_setblocksize) */
+	void *b_data;			/* the block contents */
+	int b_flags;			/* B_* below */
+
+	struct buf *b_hashnext;		/* hash chain */
+	struct buf *b_lruprev;		/* LRU list, most recent first */
+	struct buf *b_lrunext;
+
+	struct devreq b_req;		/* for asynchronous I/O */
+};
+
+#define B_BUSY   0x1	/* handed out; everyone else must wait */
+#define B_VALID  0x2	/* b_data holds the block contents */
+#define B_DIRTY  0x4	/* b_data is newer than the disk */
+#define B_RAHEAD 0x8	/* read ahead, and not asked for since */
+#define B_META   0x10	/* metadata not yet journaled; don't write back */
+#define B_JOURNAL 0x20	/* being journaled, and unchanged since */
+
+void buf_bootstrap(void);
+void buf_setblocksize(struct device *dev, u_int32_t size);
+
+int  buf_read(struct device *dev, u_int32_t block, struct buf **ret);
+int  buf_get(struct device *dev, u_int32_t block, struct buf **ret);
+void buf_markdirty(struct buf *b);
+void buf_markmeta(struct buf *b);
+void buf_release(struct buf *b);
+void buf_readahead(struct device *dev, u_int32_t block);
+
+int  buf_incore(struct device *dev, u_int32_t block);
+int  buf_isheld(struct device *dev, u_int32_t block);
+void buf_discard(struct device *dev, u_int32_t block);
+int  buf_flush(struct device *dev, u_int32_t block);
+int  buf_sync(struct device *dev);
+void buf_invalidate(struct device *dev);
+
+int  buf_getmeta(struct device *dev, u_int32_t *blocks, int max);
+void buf_commitmeta(struct device *dev, const u_int32_t *blocks, int n);
+
+int  buf_reclaim(void);
+void buf_printstats(void);
+
+#endif /* _BUF_H_ */
@@ -3,15 +3,39 @@
 
 struct uio;  /* in <uio.h> */
 
+/*
+ * Asynchronous block I/O request, for devices that support d_strategy.
+ *
+ * The caller fills in everything down to dr_done and sets dr_busy,
+ * and must leave the request alone until the device clears dr_busy.
+ * The device then calls dr_done, if it isn't NULL, and does
+ * thread_wakeup on the request. Both happen in interrupt context, so
+ * dr_done must not sleep.
+ */
+struct devreq {
+	u_int32_t dr_block;		/* first block (d_blocksize units) */
+	u_int32_t dr_nblocks;		/* number of blocks */
+	void *dr_data;			/* kernel buffer */
+	int dr_write;			/* nonzero for a write */
+	void (*dr_done)(struct devreq *); /* completion function, or NULL */
+	void *dr_arg;			/* for dr_done */
+
+	volatile int dr_busy;		/* set until the I/O is finished */
+	int dr_result;			/* error code, once finished */
+	struct devreq *dr_next;		/* device's queue */
+};
+
 /*
  * Filesystem-namespace-accessible device.
  * d_io is for both reads and writes; the uio indicates which should be done.
+ * d_strategy, if not NULL, queues a devreq and returns without waiting.
  */
 struct device {
 	int (*d_open)(struct device *, int flags_from_open);
 	int (*d_close)(struct device *);
 	int (*d_io)(struct device *, struct uio *);
 	int (*d_ioctl)(struct device *, int op, userptr_t data);
+	int (*d_strategy)(struct device *, struct devreq *);
 
 	u_int32_t d_blocks;
 	u_int32_t d_blocksize;
@@ -0,0 +1,47 @@
+#ifndef _HASH_H_
+#define _HASH_H_
+
+/*
+ * Hash table from keys to void pointers, using open addressing with
+ * linear probing.
+ *
+ * Keys are pointers as well, hashed and compared by the functions
+ * given to hash_create. Usually a key points at a field inside the
+ * value, which must stay put while the entry is in the table.
+ * hash_u32 and hash_u32eq are for keys that are u_int32_t.
+ *
+ * Once the table is half full (counting deleted slots) it is replaced
+ * by one twice the size. The entries move across a few at a time on
+ * each later call, not all at once, so no single call pays for the
+ * whole resize.
+ *
+ * Functions:
+ *     hash_create  - allocate a new table. Returns NULL if out of memory.
+ *     hash_count   - return the number of entries.
+ *     hash_find    - return the value stored for a key, or NULL if there
+ *                    isn't one.
+ *     hash_add     - add a key and its value, which may not be NULL.
+ *                    Returns EEXIST if the key is already there, or
+ *                    ENOMEM.
+ *     hash_remove  - remove a key, returning its value, or NULL if it
+ *                    wasn't there.
+ *     hash_destroy - dispose of the table. If not empty, the entries
+ *                    are dropped; the values themselves are untouched.
+ *
+ * Synchronization is the caller's problem.
+ */
+
+struct hash;  /* Opaque. */
+
+struct hash *hash_create(u_int32_t (*hashfn)(const void *key),
+			 int (*eqfn)(const void *key1, const void *key2));
+u_int32_t     hash_count(struct hash *);
+void         *hash_find(struct hash *, const void *key);
+int           hash_add(struct hash *, const void *key, void *val);
+void         *hash_remove(struct hash *, const void *key);
+void          hash_destroy(struct hash *);
+
+u_int32_t     hash_u32(const void *key);
+int           hash_u32eq(const void *key1, const void *key2);
+
+#endif /* _HASH_H_ */
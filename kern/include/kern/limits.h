@@ -7,5 +7,8 @@
 /* Longest full path name */
 #define PATH_MAX   1024
 
+/* Longest argument list for execv, counting the argv pointers too */
+#define ARG_MAX    16384
+
 
 #endif /* _KERN_LIMITS_H_ */
@@ -2,7 +2,9 @@
 #define _KERN_SFS_H_
 
 #define SFS_MAGIC         0xabadf001    /* magic number identifying us */
-#define SFS_BLOCKSIZE     512           /* size of our blocks */
+#define SFS_MAGIC2        0xabadf002    /* same, version 2 format */
+#define SFS_BLOCKSIZE     512           /* size of our blocks (version 1) */
+#define SFS_MAXBLOCKSIZE  4096          /* largest version 2 block size */
 #define SFS_VOLNAME_SIZE  32            /* max length of volume name */
 #define SFS_NDIRECT       15            /* # of direct blocks in inode */
 #define SFS_DBPERIDB      128           /* # direct blks per indirect blk */
@@ -11,18 +13,33 @@
 #define SFS_ROOT_LOCATION  1            /* loc'n of the root dir inode */
 #define SFS_MAP_LOCATION   2            /* 1st block of the freemap */
 #define SFS_NOINO          0            /* inode # for free dir entry */
+#define SFS_JOURNAL_SIZE   128          /* default journal size (blocks) */
+
+/*
+ * Version 1 volumes have 512-byte blocks, and files have direct
+ * blocks and one indirect block. Version 2 volumes (SFS_MAGIC2) can
+ * have bigger blocks, up to SFS_MAXBLOCKSIZE (sp_blocksize), and
+ * files get a double-indirect block as well. The superblock, inodes
+ * and journal control blocks stay 512 bytes at the start of their
+ * block; the rest of the block is unused.
+ */
 
 /* Number of bits in a block */
-#define SFS_BLOCKBITS (SFS_BLOCKSIZE * CHAR_BIT)
+#define SFS_BLOCKBITS(bsize)   ((bsize) * CHAR_BIT)
+
+/* Number of block numbers in an indirect block */
+#define SFS_DBPERBLOCK(bsize)  ((bsize) / sizeof(u_int32_t))
 
 /* Utility macro */
-#define SFS_ROUNDUP(a,b)       ((((a)+(b)-1)/(b))*b)
+#define SFS_ROUNDUP(a,b)       ((((a)+(b)-1)/(b))*(b))
 
 /* Size of bitmap (in bits) */
-#define SFS_BITMAPSIZE(nblocks) SFS_ROUNDUP(nblocks, SFS_BLOCKBITS)
+#define SFS_BITMAPSIZE(nblocks, bsize) \
+	SFS_ROUNDUP(nblocks, SFS_BLOCKBITS(bsize))
 
 /* Size of bitmap (in blocks) */
-#define SFS_BITBLOCKS(nblocks)  (SFS_BITMAPSIZE(nblocks)/SFS_BLOCKBITS)
+#define SFS_BITBLOCKS(nblocks, bsize) \
+	(SFS_BITMAPSIZE(nblocks, bsize)/SFS_BLOCKBITS(bsize))
 
 /* File types for dfi_type */
 #define SFS_TYPE_INVAL    0       /* Should not appear on disk */
@@ -31,12 +48,18 @@
 
 /*
  * On-disk superblock
+ *
+ * sp_jblocks is 0 on volumes without a journal. sp_blocksize is only
+ * used on version 2 volumes.
  */
 struct sfs_super {
-	u_int32_t sp_magic;       /* Magic number, should be SFS_MAGIC */
+	u_int32_t sp_magic;       /* Magic number, SFS_MAGIC or SFS_MAGIC2 */
 	u_int32_t sp_nblocks;     /* Number of blocks in fs */
 	char sp_volname[SFS_VOLNAME_SIZE];  /* Name of this volume */
-	u_int32_t reserved[118];
+	u_int32_t sp_jstart;      /* First block of the journal */
+	u_int32_t sp_jblocks;     /* Number of blocks in the journal */
+	u_int32_t sp_blocksize;   /* Block size in bytes */
+	u_int32_t reserved[115];
 };
 
 /*
@@ -48,7 +71,8 @@ struct sfs_inode {
 	u_int16_t sfi_linkcount;   /* Number of hard links to this file */
 	u_int32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
 	u_int32_t sfi_indirect;			/* Indirect block */
-	u_int32_t sfi_waste[128-3-SFS_NDIRECT]; /* unused space */
+	u_int32_t sfi_dindirect;		/* Double-indirect (v2) */
+	u_int32_t sfi_waste[128-4-SFS_NDIRECT]; /* unused space */
 };
 
 /*
@@ -59,4 +83,45 @@ struct sfs_dir {
 	char sfd_name[SFS_NAMELEN];  /* Filename */
 };
 
+/*
+ * Metadata journal.
+ *
+ * The first block of the journal is a header; the rest is the log.
+ * The log holds a series of transactions, starting at the beginning
+ * of the log. Each is a descriptor block listing the blocks in the
+ * transaction, a copy of each of those blocks, and then a commit
+ * block. A transaction counts only if its commit block is there, and
+ * transactions are numbered consecutively from jh_seq, so the first
+ * block that isn't the next descriptor marks the end of the log.
+ *
+ * Once the blocks in the log have all been written in place, the log
+ * is emptied by bumping jh_seq past the last transaction.
+ */
+#define SFS_JHDR_MAGIC    0x4a6e6c48    /* journal header */
+#define SFS_JDESC_MAGIC   0x4a6e6c44    /* descriptor block */
+#define SFS_JCOMMIT_MAGIC 0x4a6e6c43    /* commit block */
+
+/* Number of blocks one transaction can hold */
+#define SFS_JDESC_MAX     125
+
+struct sfs_jheader {
+	u_int32_t jh_magic;       /* SFS_JHDR_MAGIC */
+	u_int32_t jh_seq;         /* number of the first transaction */
+	u_int32_t reserved[126];
+};
+
+struct sfs_jdesc {
+	u_int32_t jd_magic;       /* SFS_JDESC_MAGIC */
+	u_int32_t jd_seq;         /* transaction number */
+	u_int32_t jd_nblocks;     /* number of blocks that follow */
+	u_int32_t jd_blocks[SFS_JDESC_MAX];  /* where each one goes */
+};
+
+struct sfs_jcommit {
+	u_int32_t jc_magic;       /* SFS_JCOMMIT_MAGIC */
+	u_int32_t jc_seq;         /* transaction number */
+	u_int32_t jc_nblocks;     /* same as jd_nblocks */
+	u_int32_t reserved[125];
+};
+
 #endif /* _KERN_SFS_H_ */
@@ -93,6 +93,23 @@ void *kmalloc_dumb(size_t sz);
 void kfree(void *ptr);
 void kheap_printstats(void);
 
+/*
+ * Object caches, for fixed-size structures that are allocated and
+ * freed often. kmem_cache_create is normally called once, at boot.
+ * If the cache has a constructor, objects come back from
+ * kmem_cache_alloc already constructed and must be in that state
+ * again when handed to kmem_cache_free. Objects from a cache must
+ * not be passed to kfree. kmem_reclaim gives back one page of
+ * cached free objects, if there is one.
+ */
+struct kmem_cache;
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     int (*ctor)(void *obj),
+				     void (*dtor)(void *obj));
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+int kmem_reclaim(void);
+
 /*
  * C string functions. 
  *
@@ -183,6 +200,10 @@ u_int64_t htonll(u_int64_t);
  * addressing error was encountered, or (for the string versions)
  * ENAMETOOLONG if the space available was insufficient.
  *
+ * copyin_bulk and copyout_bulk do the same as copyin and copyout, but
+ * go through the page table instead of the TLB, which is faster for
+ * anything more than a page or so. uiomove uses them.
+ *
  * NOTE that the order of the arguments is the same as bcopy() or 
  * cp/mv, that is, source on the left, NOT the same as strcpy().
  *
@@ -191,6 +212,8 @@ u_int64_t htonll(u_int64_t);
  
 int copyin(const_userptr_t usersrc, void *dest, size_t len);
 int copyout(const void *src, userptr_t userdest, size_t len);
+int copyin_bulk(const_userptr_t usersrc, void *dest, size_t len);
+int copyout_bulk(const void *src, userptr_t userdest, size_t len);
 int copyinstr(const_userptr_t usersrc, char *dest, size_t len, size_t *got);
 int copyoutstr(const char *src, userptr_t userdest, size_t len, size_t *got);
 
@@ -0,0 +1,66 @@
+#ifndef _LIST_H_
+#define _LIST_H_
+
+/*
+ * Intrusive doubly linked list.
+ *
+ * Each object on a list carries its own struct list_entry, so adding
+ * and removing never allocates and never fails, and an object can be
+ * unlinked in constant time given only a pointer to it. An object can
+ * be on as many lists at once as it has entries.
+ *
+ * The list itself is a struct list, embedded wherever convenient and
+ * set up with list_init. An entry that is on no list has NULL links.
+ *
+ * Functions:
+ *     list_init     - set up an empty list.
+ *     list_empty    - return true if the list is empty.
+ *     list_count    - return the number of entries on the list.
+ *     list_addhead  - put an entry at the front of the list.
+ *     list_addtail  - put an entry at the back of the list.
+ *     list_remove   - take an entry off the list.
+ *     list_remhead  - take the first entry off the list and return it.
+ *                     Returns NULL if the list is empty.
+ *     list_first    - return the first entry, or NULL if none.
+ *     list_next     - return the entry after the given one, or NULL if
+ *                     it is the last.
+ *
+ * LIST_ITEM turns a pointer to an entry back into a pointer to the
+ * object it is embedded in:
+ *
+ *      struct thread *t = LIST_ITEM(e, struct thread, t_sleeplink);
+ *
+ * To remove entries while walking a list, fetch the next one first:
+ *
+ *      for (e = list_first(l); e != NULL; e = next) {
+ *              next = list_next(l, e);
+ *                :
+ *      }
+ *
+ * Synchronization is the caller's problem.
+ */
+
+struct list_entry {
+	struct list_entry *le_next;
+	struct list_entry *le_prev;
+};
+
+struct list {
+	struct list_entry l_head;	/* le_next is first, le_prev last */
+	int l_count;
+};
+
+#define LIST_ITEM(entry, type, member) \
+	((type *)((char *)(entry) - (size_t)&((type *)0)->member))
+
+void               list_init(struct list *);
+int                list_empty(struct list *);
+int                list_count(struct list *);
+void               list_addhead(struct list *, struct list_entry *);
+void               list_addtail(struct list *, struct list_entry *);
+void               list_remove(struct list *, struct list_entry *);
+struct list_entry *list_remhead(struct list *);
+struct list_entry *list_first(struct list *);
+struct list_entry *list_next(struct list *, struct list_entry *);
+
+#endif /* _LIST_H_ */
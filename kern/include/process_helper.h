@@ -12,6 +12,27 @@ struct fork_parent_info {
 	struct trapframe *parent_tf_cp;
 	struct addrspace *child_as;
 };
+
+struct runprogram_info;
+struct semaphore;
+
+/* Caches for what sys_fork hands the child; set up by fork_bootstrap */
+extern struct kmem_cache *trapframe_cache;
+extern struct kmem_cache *forkinfo_cache;
+void fork_bootstrap(void);
+
+/*
+ * handed from sys_spawn to spawn_child_setup.
+ * the child fills in result and V's loaded once load_program is done;
+ * after that it must not touch this struct again.
+ */
+struct spawn_info {
+	pid_t child_ppid;
+	pid_t child_pid;
+	struct runprogram_info *prog_info;
+	struct semaphore *loaded;
+	int result;
+};
 /*
  * add new child node to the parent's child_list
  */
@@ -31,14 +52,14 @@ pid_t alloc_new_pid ();
 
 void fork_child_setup(void *parent_info, unsigned long unused);
 
+void spawn_child_setup(void *info, unsigned long unused);
+
 void update_pid_occupied_list();
 
 void clearup_zombies(struct child_list *zombie_list);
 
 int menu_waitpid();
 
-vaddr_t translate_args_vaddr(vaddr_t userv, struct addrspace *as, int *index); 
-
 /*
  * the following functions are for sbrk syscall
  */
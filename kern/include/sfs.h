@@ -13,23 +13,69 @@
  */
 #include <kern/sfs.h>
 
+struct sfs_dirindex;  /* in sfs_vnode.c */
+
 struct sfs_vnode {
 	struct vnode sv_v;              /* abstract vnode structure */
 	struct sfs_inode sv_i;		/* on-disk inode */
 	u_int32_t sv_ino;               /* inode number */
 	int sv_dirty;                   /* true if sv_i modified */
+	struct sfs_vnode *sv_hashnext;  /* chain in sfs_vnhash */
+	int sv_index;                   /* position in sfs_vnodes */
+
+	struct sfs_dirindex *sv_dirindex; /* name lookup index, or NULL */
+
+	/* Preallocation window; see sfs_balloc_file */
+	u_int32_t sv_prealloc;          /* first block in the window */
+	u_int32_t sv_npreal;            /* number of blocks in it */
+
+	/* Sequential read-ahead state; see sfs_readahead */
+	u_int32_t sv_ranext;            /* block after the last read */
+	u_int32_t sv_raend;             /* block after the last read ahead */
+	u_int32_t sv_rawin;             /* current window, in blocks */
 };
 
+/* Number of chains in the loaded-inode hash table; power of 2 */
+#define SFS_VNHASH  64
+
 struct sfs_fs {
 	struct fs sfs_absfs;            /* abstract filesystem structure */
 	struct sfs_super sfs_super;	/* on-disk superblock */
 	int sfs_superdirty;             /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
+	u_int32_t sfs_blocksize;        /* block size in bytes */
+	u_int32_t sfs_dbperidb;         /* block numbers per indirect block */
+	int sfs_dindirect;              /* files may have sfi_dindirect */
 	struct array *sfs_vnodes;       /* vnodes loaded into memory */
+	struct sfs_vnode *sfs_vnhash[SFS_VNHASH]; /* same, by inode number */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	int sfs_freemapdirty;           /* true if freemap modified */
+	struct bitmap *sfs_mapdirty;    /* freemap blocks modified */
+
+	/* Metadata journal; see sfs_journal.c. Unused if sp_jblocks is 0 */
+	struct lock *sfs_jlock;         /* held while committing */
+	int sfs_nops;                   /* operations in progress */
+	int sfs_opwait;                 /* a commit is waiting for them */
+	u_int32_t sfs_jfirst;           /* first transaction in the log */
+	u_int32_t sfs_jseq;             /* number of the next transaction */
+	u_int32_t sfs_jhead;            /* next free block in the log */
+	struct bitmap *sfs_mapckpt;     /* committed, not written in place */
+	char *sfs_mapstage;             /* freemap blocks being committed */
+	char *sfs_mapcommit;            /* freemap blocks as committed */
+	void *sfs_jbuf;                 /* two blocks of scratch space */
+	struct bitmap *sfs_jlogged;     /* blocks with a copy in the log */
+	struct bitmap *sfs_jfreed;      /* of those, freed since */
 };
 
+/* Shortcuts for the size macros in kern/sfs.h */
+#define SFS_FS_BITMAPSIZE(sfs) \
+	SFS_BITMAPSIZE((sfs)->sfs_super.sp_nblocks, (sfs)->sfs_blocksize)
+#define SFS_FS_BITBLOCKS(sfs) \
+	SFS_BITBLOCKS((sfs)->sfs_super.sp_nblocks, (sfs)->sfs_blocksize)
+
+/* True if the volume has a metadata journal */
+#define SFS_JOURNALED(sfs)  ((sfs)->sfs_super.sp_jblocks > 0)
+
 /*
  * Function for mounting a sfs (calls vfs_mount)
  */
@@ -40,16 +86,52 @@ int sfs_mount(const char *device);
  * Internal functions
  */
 
+/* Longest run of contiguous blocks sfs_io hands the device at once */
+#define SFS_MAXRUN  64
+
+/* Blocks reserved ahead of a file that is being written in order */
+#define SFS_PREALLOC  16
+
+/* Read-ahead window, in blocks: starting size and largest size */
+#define SFS_RAMIN   4
+#define SFS_RAMAX   32
+
 /* Initialize uio structure */
-#define SFSUIO(uio, ptr, block, rw) \
-    mk_kuio(uio, ptr, SFS_BLOCKSIZE, ((off_t)(block))*SFS_BLOCKSIZE, rw)
+#define SFSUIO(sfs, uio, ptr, block, rw) \
+    mk_kuio(uio, ptr, (sfs)->sfs_blocksize, \
+	    ((off_t)(block))*(sfs)->sfs_blocksize, rw)
 
 /* Convenience functions for block I/O */
 int sfs_rwblock(struct sfs_fs *sfs, struct uio *uio);
 int sfs_rblock(struct sfs_fs *sfs, void *data, u_int32_t block);
 int sfs_wblock(struct sfs_fs *sfs, void *data, u_int32_t block);
 
+/* Metadata journal */
+int sfs_jreplay(struct sfs_fs *sfs);
+int sfs_jinit(struct sfs_fs *sfs);
+void sfs_jcleanup(struct sfs_fs *sfs);
+int sfs_jcommit(struct sfs_fs *sfs);
+int sfs_jcheckpoint(struct sfs_fs *sfs);
+int sfs_jholdfree(struct sfs_fs *sfs, u_int32_t block);
+void sfs_opbegin(struct sfs_fs *sfs);
+void sfs_opend(struct sfs_fs *sfs);
+
+/* Set up the cache sfs_vnodes are allocated from */
+int sfs_initcache(void);
+
 /* Get root vnode */
 struct vnode *sfs_getroot(struct fs *fs);
 
+/* fsync without the journal commit, for sfs_sync */
+int sfs_syncfile(struct sfs_vnode *sv);
+
+/* Copy every loaded inode that changed into the buffer cache */
+int sfs_syncinodes(struct sfs_fs *sfs);
+
+/* Give back every file's preallocated blocks */
+void sfs_prealloc_releaseall(struct sfs_fs *sfs);
+
+/* Print the loaded-inode table counters */
+void sfs_printstats(void);
+
 #endif /* _SFS_H_ */
@@ -10,11 +10,16 @@ int sys_reboot(int code);
 // -----------------------------
 int sys_write(int filehandle, const void *buf, size_t size);
 int sys_read(int filehandle, void *buf, size_t size, int *retval);
+int sys___time(time_t *secs, unsigned long *nsecs, int32_t *retval);
 int sys_fork(struct trapframe *tf, int32_t *retval);
 int sys_getpid(int32_t *retval);
 int sys_waitpid(pid_t child_pid, struct trapframe *tf, int32_t *retval);
 int sys__exit(struct trapframe *tf, int32_t *retval, int code);
 int sys_execv(char *prog, char *const *args, int32_t *retval);
 int sys_sbrk(int size, int32_t *retval);
+int sys_spawn(char *prog, char *const *args, int32_t *retval);
+
+/* Print per-syscall call/error counts and latencies (menu: syscallstats) */
+void syscall_printstats(void);
 
 #endif /* _SYSCALL_H_ */
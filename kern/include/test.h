@@ -17,6 +17,8 @@ int createcars(int, char **);
 /* lib tests */
 int arraytest(int, char **);
 int bitmaptest(int, char **);
+int hashtest(int, char **);
+int listtest(int, char **);
 int queuetest(int, char **);
 
 /* thread tests */
@@ -51,9 +53,14 @@ struct runprogram_info {
 	char *progname;
 	int argc;
 	char **argv;
+	/* exec staging buffer, kfree'd once the args are on the user stack */
+	char *kbuf;
 };
 
 /* Routine for running userlevel test code. */
 int runprogram(struct runprogram_info *prog_info);
+/* The loading half of runprogram, without the jump to usermode. */
+int load_program(struct runprogram_info *prog_info, vaddr_t *entrypoint,
+		 vaddr_t *stackptr);
 
 #endif /* _TEST_H_ */
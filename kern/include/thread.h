@@ -8,6 +8,7 @@
 /* Get machine-dependent stuff */
 #include <machine/pcb.h>
 #include <types.h>
+#include <list.h>
 
 #define MAX_PID 1000
 
@@ -21,6 +22,7 @@ struct thread {
 	struct pcb t_pcb;
 	char *t_name;
 	const void *t_sleepaddr;
+	struct list_entry t_sleeplink;	/* on the sleepers list */
 	char *t_stack;
 	
 	/**********************************************************/
@@ -77,8 +79,6 @@ void init_pid();
 
 struct thread* get_curthread();
 
-struct array* get_sleepers(void);
-
 struct array* get_zombies(void); 
 
 /* Call once during startup to allocate data structures. */
@@ -132,6 +132,12 @@ void thread_sleep(const void *addr);
  */
 void thread_wakeup(const void *addr);
 
+/*
+ * Same, but only the one that has been asleep longest.
+ * Interrupts must be disabled.
+ */
+void thread_wakeup_one(const void *addr);
+
 void print_all_thread(void);
 
 /*
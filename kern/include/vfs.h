@@ -24,6 +24,8 @@ struct vnode;  /* abstract structure for an on-disk file (vnode.h) */
  *    vfs_clearcurdir - change current directory of current thread to "none"
  *    vfs_getcurdir - retrieve vnode of current directory of current thread
  *    vfs_sync      - force all dirty buffers to disk
+ *    vfs_syncer_kick - have the syncer thread run vfs_sync soon
+ *    vfs_syncer_tick - count a clock tick towards the next periodic sync
  *    vfs_getroot   - get root vnode for the filesystem named DEVNAME
  *    vfs_getdevname - get mounted device name for the filesystem passed in
  */
@@ -32,6 +34,8 @@ int vfs_setcurdir(struct vnode *dir);
 int vfs_clearcurdir(void);
 int vfs_getcurdir(struct vnode **retdir);
 int vfs_sync(void);
+void vfs_syncer_kick(void);
+void vfs_syncer_tick(void);
 int vfs_getroot(const char *devname, struct vnode **result);
 const char *vfs_getdevname(struct fs *fs);
 
@@ -50,6 +54,26 @@ int vfs_lookup(char *path, struct vnode **result);
 int vfs_lookparent(char *path, struct vnode **result,
 		   char *buf, size_t buflen);
 
+/*
+ * Name cache used by vfs_lookup and vfs_lookparent.
+ *
+ *    vfs_ncache_begin   - Call before any operation that creates,
+ *                         removes, or renames a name. Lookups that
+ *                         overlap it aren't cached.
+ *    vfs_ncache_purge   - Forget NAME in directory DIR. Must be called
+ *                         after any such operation, before
+ *                         vfs_ncache_end.
+ *    vfs_ncache_end     - Call when the operation and purge are done.
+ *    vfs_ncache_purgefs - Forget everything cached for FS, dropping the
+ *                         vnode references the cache holds. Called
+ *                         before unmounting.
+ */
+
+void vfs_ncache_begin(void);
+void vfs_ncache_purge(struct vnode *dir, const char *name);
+void vfs_ncache_end(void);
+void vfs_ncache_purgefs(struct fs *fs);
+
 /*
  * VFS layer high-level operations on pathnames
  * Because namei may destroy pathnames, these all may too.
@@ -93,6 +117,12 @@ int vfs_getcwd(struct uio *buf);
  *                    bootfs-related structures. (Called from 
  *                    vfs_bootstrap.)
  *
+ *    vfs_syncer_bootstrap - Call during system initialization, once
+ *                    threads work, to start the syncer thread.
+ *
+ *    vfs_initncache - Call during system initialization to set up the
+ *                    name cache. (Called from vfs_bootstrap.)
+ *
  *    vfs_setbootfs - Set the filesystem that paths beginning with a
  *                    slash are sent to. If not set, these paths fail
  *                    with ENOENT. The argument should be the device
@@ -135,6 +165,8 @@ int vfs_getcwd(struct uio *buf);
 void vfs_bootstrap(void);
 
 void vfs_initbootfs(void);
+void vfs_initncache(void);
+void vfs_syncer_bootstrap(void);
 int vfs_setbootfs(const char *fsname);
 void vfs_clearbootfs(void);
 
@@ -54,9 +54,20 @@ struct lock *load_evict_lock;
 #define PPAGE_TEMP_FIXED     3
 /* kernel alloc page, should not be swapped out in any circumstances */
 #define PPAGE_K_FIXED        4
+/* free, already cleared, and held for zero-fill faults (see ram.c) */
+#define PPAGE_ZEROED         5
 
 #define PPAGE_REFERENCED     100
 
+/*
+ * the block length above is one decimal digit, so no kseg0 block can
+ * be longer than this; bigger kernel allocations go through kseg2
+ */
+#define KPAGES_MAXCONTIG     9
+
+/* size of the kseg2 region for alloc_kpages_mapped (4M) */
+#define KSEG2_NPAGES         1024
+
 /*
  * total number of entries in coremap
  */
@@ -80,9 +91,15 @@ paddr_t firstpaddr_init;
  * 	third bit: reference bit (LRU algorithm)
  *		   (set in vm_fault, clear in find_victim)
  */
+/*
+ * cmap_pageref_entry: for kernel pages carved up by the subpage
+ * 	allocator, the pageref that manages the page (see kheap.c);
+ * 	NULL for every other page
+ */
 int *coremap_entry;
 struct addrspace **cmap_as_entry;
 vaddr_t **cmap_pte_entry;
+struct pageref **cmap_pageref_entry;
 
 /* Initialization function */
 void vm_bootstrap(void);
@@ -92,17 +109,36 @@ void get_pt_index(struct addrspace *as, vaddr_t vaddr, int *master_i, int *secon
 /* Fault handling function called by trap code */
 int vm_fault(int faulttype, vaddr_t faultaddress);
 
+/*
+ * Pin/unpin the frame behind a user address of the current process,
+ * for copying through kseg0 (see copyin_bulk). Call at splhigh.
+ */
+int vm_pin_user(vaddr_t va, int faulttype, vaddr_t *kva, int *oldstatus);
+void vm_unpin_user(vaddr_t kva, int oldstatus);
+
 /* Allocate/free kernel heap pages (called by kmalloc/kfree) */
 vaddr_t alloc_kpages(int npages);
 /* dumbvm version: only to be called before coremap_bootstrap()*/
 vaddr_t alloc_kpages_dumb(int npages);
+/*
+ * same, but from frames that need not be contiguous, mapped in kseg2.
+ * Slower to use (TLB misses), so kmalloc only falls back to it.
+ */
+vaddr_t alloc_kpages_mapped(int npages);
+void free_kpages_mapped(vaddr_t addr);
 
 paddr_t getppages(unsigned long npages);
 /* getppages_status can set the status bit of coremap according to input arg */
 paddr_t getppages_status(unsigned long npages, int status);
 paddr_t as_getppages_status(unsigned long npages, int status, struct addrspace *as);
+/* one page, cleared: from the pre-zeroed pool if possible */
+paddr_t as_getppages_zeroed(int status, struct addrspace *as);
 // paddr_t as_getppages(unsigned long npages, struct addrspace *as, int status);
 
 void free_kpages(vaddr_t addr);
 
+/* Copy/zero one page; faster than memcpy/bzero for page-aligned frames */
+void memcpy_page(void *dst, const void *src);
+void bzero_page(void *page);
+
 #endif /* _VM_H_ */
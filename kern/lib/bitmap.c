@@ -14,6 +14,11 @@
  * because if one uses any data type more than a single byte wide,
  * bitmap data saved on disk becomes endian-dependent, which is a
  * severe nuisance.
+ *
+ * The searches still go 32 bits at a time where they can, by loading
+ * four bytes at once and comparing against all-zeros or all-ones.
+ * That test comes out the same in either byte order. kmalloc returns
+ * memory aligned well enough for it.
  */
 
 
@@ -21,8 +26,20 @@
 #define WORD_TYPE       unsigned char
 #define WORD_ALLBITS    (0xff)
 
+#define CHUNK_BITS      32
+#define CHUNK_ALLBITS   (0xffffffff)
+#define CHUNK(b, bitno) (((u_int32_t *)(b)->v)[(bitno) / CHUNK_BITS])
+
+/*
+ * lowfree: every bit below it is set, so no search needs to look
+ * there. It is only a lower bound, and may lag behind.
+ * hint: where bitmap_alloc_run starts looking, just past its last
+ * allocation, so it doesn't rescan the bits it has just filled.
+ */
 struct bitmap {
 	u_int32_t nbits;
+	u_int32_t lowfree;
+	u_int32_t hint;
 	WORD_TYPE *v;
 };
 
@@ -46,6 +63,8 @@ bitmap_create(u_int32_t nbits)
 
 	bzero(b->v, words*sizeof(WORD_TYPE));
 	b->nbits = nbits;
+	b->lowfree = 0;
+	b->hint = 0;
 
 	/* Mark any leftover bits at the end in use */
 	if (nbits / BITS_PER_WORD < words) {
@@ -69,28 +88,206 @@ bitmap_getdata(struct bitmap *b)
 	return b->v;
 }
 
+/*
+ * Index of the lowest set bit of a nonzero word.
+ */
+static
+inline
+u_int32_t
+bitmap_lowbit(WORD_TYPE w)
+{
+	w &= -w;
+	return ((w & 0xf0) != 0)*4 + ((w & 0xcc) != 0)*2 + ((w & 0xaa) != 0);
+}
+
+/*
+ * Number of set bits in X.
+ */
+static
+inline
+u_int32_t
+bitmap_popcount(u_int32_t x)
+{
+	x = x - ((x >> 1) & 0x55555555);
+	x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+	x = (x + (x >> 4)) & 0x0f0f0f0f;
+	return (x * 0x01010101) >> 24;
+}
+
+/*
+ * Find the first bit in [FROM, TO) that is set (if SET) or clear (if
+ * not). Returns TO if there isn't one.
+ */
+static
+u_int32_t
+bitmap_scan(struct bitmap *b, u_int32_t from, u_int32_t to, int set)
+{
+	u_int32_t skip = set ? 0 : CHUNK_ALLBITS;
+	u_int32_t bitno = from;
+	WORD_TYPE w;
+
+	while (bitno < to) {
+		if (bitno % CHUNK_BITS == 0) {
+			while (bitno + CHUNK_BITS <= to &&
+			       CHUNK(b, bitno) == skip) {
+				bitno += CHUNK_BITS;
+			}
+			if (bitno >= to) {
+				break;
+			}
+		}
+
+		w = b->v[bitno / BITS_PER_WORD];
+		if (!set) {
+			w = ~w;
+		}
+		w &= (WORD_TYPE)(WORD_ALLBITS << (bitno % BITS_PER_WORD));
+		if (w != 0) {
+			bitno -= bitno % BITS_PER_WORD;
+			bitno += bitmap_lowbit(w);
+			return bitno < to ? bitno : to;
+		}
+		bitno += BITS_PER_WORD - bitno % BITS_PER_WORD;
+	}
+	return to;
+}
+
+/*
+ * Find a clear bit at or after START, wrapping around at the end.
+ * Returns nbits if they're all set.
+ */
+static
+u_int32_t
+bitmap_findfree(struct bitmap *b, u_int32_t start)
+{
+	u_int32_t bitno;
+
+	if (start <= b->lowfree || start >= b->nbits) {
+		bitno = bitmap_scan(b, b->lowfree, b->nbits, 0);
+		b->lowfree = bitno;
+		return bitno;
+	}
+
+	bitno = bitmap_scan(b, start, b->nbits, 0);
+	if (bitno < b->nbits) {
+		return bitno;
+	}
+	bitno = bitmap_scan(b, b->lowfree, start, 0);
+	b->lowfree = bitno;
+	return bitno < start ? bitno : b->nbits;
+}
+
+/*
+ * Find N clear bits in a row within [FROM, TO). Returns TO if there
+ * aren't any.
+ */
+static
+u_int32_t
+bitmap_findrun(struct bitmap *b, u_int32_t from, u_int32_t to, u_int32_t n)
+{
+	u_int32_t start, end;
+
+	while (1) {
+		start = bitmap_scan(b, from, to, 0);
+		if (start == to || to - start < n) {
+			return to;
+		}
+		end = bitmap_scan(b, start, start + n, 1);
+		if (end == start + n) {
+			return start;
+		}
+		from = end;
+	}
+}
+
+static
+inline
+void
+bitmap_setbit(struct bitmap *b, u_int32_t bitno)
+{
+	b->v[bitno / BITS_PER_WORD] |= ((WORD_TYPE)1) << (bitno % BITS_PER_WORD);
+	if (bitno == b->lowfree) {
+		b->lowfree++;
+	}
+}
+
 int
 bitmap_alloc(struct bitmap *b, u_int32_t *index)
 {
-	u_int32_t ix;
-	u_int32_t maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
-	u_int32_t offset;
+	u_int32_t bitno;
 
-	for (ix=0; ix<maxix; ix++) {
-		if (b->v[ix]!=WORD_ALLBITS) {
-			for (offset = 0; offset < BITS_PER_WORD; offset++) {
-				WORD_TYPE mask = ((WORD_TYPE)1)<<offset;
-				if ((b->v[ix] & mask)==0) {
-					b->v[ix] |= mask;
-					*index = (ix*BITS_PER_WORD)+offset;
-					assert(*index < b->nbits);
-					return 0;
-				}
-			}
-			assert(0);
+	/* Lowest free bit, so callers like the swap map stay compact */
+	bitno = bitmap_findfree(b, 0);
+	if (bitno == b->nbits) {
+		return ENOSPC;
+	}
+	bitmap_setbit(b, bitno);
+	*index = bitno;
+	return 0;
+}
+
+int
+bitmap_alloc_from(struct bitmap *b, u_int32_t start, u_int32_t *index)
+{
+	u_int32_t bitno;
+
+	bitno = bitmap_findfree(b, start);
+	if (bitno == b->nbits) {
+		return ENOSPC;
+	}
+	bitmap_setbit(b, bitno);
+	*index = bitno;
+	return 0;
+}
+
+int
+bitmap_alloc_run(struct bitmap *b, u_int32_t n, u_int32_t *index)
+{
+	u_int32_t bitno, i, start;
+
+	assert(n > 0);
+	start = b->hint < b->lowfree ? b->lowfree : b->hint;
+
+	/* From the hint to the end, then from the start up to the hint */
+	bitno = bitmap_findrun(b, start, b->nbits, n);
+	if (bitno == b->nbits) {
+		u_int32_t to = start + n - 1;
+		if (to > b->nbits) {
+			to = b->nbits;
+		}
+		bitno = bitmap_findrun(b, b->lowfree, to, n);
+		if (bitno == to) {
+			return ENOSPC;
 		}
 	}
-	return ENOSPC;
+
+	for (i=0; i<n; i++) {
+		bitmap_setbit(b, bitno + i);
+	}
+	b->hint = bitno + n;
+	*index = bitno;
+	return 0;
+}
+
+u_int32_t
+bitmap_count(struct bitmap *b)
+{
+	u_int32_t bitno = 0, count = 0;
+	WORD_TYPE w;
+
+	while (bitno + CHUNK_BITS <= b->nbits) {
+		count += bitmap_popcount(CHUNK(b, bitno));
+		bitno += CHUNK_BITS;
+	}
+	while (bitno < b->nbits) {
+		w = b->v[bitno / BITS_PER_WORD];
+		if (b->nbits - bitno < BITS_PER_WORD) {
+			w &= (WORD_TYPE)((1 << (b->nbits - bitno)) - 1);
+		}
+		count += bitmap_popcount(w);
+		bitno += BITS_PER_WORD;
+	}
+	return count;
 }
 
 static
@@ -115,6 +312,9 @@ bitmap_mark(struct bitmap *b, u_int32_t index)
 	assert((b->v[ix] & mask)==0);
 
 	b->v[ix] |= mask;
+	if (index == b->lowfree) {
+		b->lowfree++;
+	}
 }
 
 void
@@ -128,6 +328,9 @@ bitmap_unmark(struct bitmap *b, u_int32_t index)
 	assert((b->v[ix] & mask)!=0);
 
 	b->v[ix] &= ~mask;
+	if (index < b->lowfree) {
+		b->lowfree = index;
+	}
 }
 
 
@@ -45,6 +45,7 @@
 #include <vm.h>
 #include <thread.h>
 #include <curthread.h>
+#include <machine/spl.h>
 
 /*
  * Recovery function. If a fatal fault occurs during copyin, copyout,
@@ -174,6 +175,116 @@ copyout(const void *src, userptr_t userdest, size_t len)
 	return 0;
 }
 
+/*
+ * Most pages copybulk pins at once. Pinned frames can't be evicted, so
+ * this bounds how much memory one copy can hold down.
+ */
+#define COPY_MAXPIN 8
+
+/*
+ * Common bulk copying function for copyin_bulk and copyout_bulk.
+ *
+ * Rather than touching user memory through its user address, which
+ * takes a TLB miss (and a trip through vm_fault) on every page, look
+ * each page up in the page table once, pin it, and copy through its
+ * kseg0 address, which can't fault at all. Pages are done COPY_MAXPIN
+ * at a time; the copying itself runs at the caller's spl.
+ */
+static
+int
+copybulk(vaddr_t uaddr, char *kbuf, size_t len, int touser)
+{
+	vaddr_t kva[COPY_MAXPIN];
+	int status[COPY_MAXPIN];
+	size_t amt[COPY_MAXPIN];
+	int faulttype = touser ? VM_FAULT_WRITE : VM_FAULT_READ;
+	int i, n, spl, result;
+
+	while (len > 0) {
+		result = 0;
+		spl = splhigh();
+		for (n=0; n<COPY_MAXPIN && len > 0; n++) {
+			result = vm_pin_user(uaddr, faulttype, &kva[n], &status[n]);
+			if (result) {
+				break;
+			}
+			amt[n] = PAGE_SIZE - (uaddr & ~(vaddr_t)PAGE_FRAME);
+			if (amt[n] > len) {
+				amt[n] = len;
+			}
+			uaddr += amt[n];
+			len -= amt[n];
+		}
+		splx(spl);
+
+		for (i=0; i<n && result == 0; i++) {
+			if (touser) {
+				memcpy((void *)kva[i], kbuf, amt[i]);
+			}
+			else {
+				memcpy(kbuf, (const void *)kva[i], amt[i]);
+			}
+			kbuf += amt[i];
+		}
+
+		spl = splhigh();
+		for (i=0; i<n; i++) {
+			vm_unpin_user(kva[i], status[i]);
+		}
+		splx(spl);
+
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * copyin_bulk
+ *
+ * Same as copyin, but meant for large buffers: see copybulk.
+ */
+int
+copyin_bulk(const_userptr_t usersrc, void *dest, size_t len)
+{
+	int result;
+	size_t stoplen;
+
+	result = copycheck(usersrc, len, &stoplen);
+	if (result) {
+		return result;
+	}
+	if (stoplen != len) {
+		return EFAULT;
+	}
+
+	return copybulk((vaddr_t)usersrc, dest, len, 0);
+}
+
+/*
+ * copyout_bulk
+ *
+ * Same as copyout, but meant for large buffers: see copybulk.
+ */
+int
+copyout_bulk(const void *src, userptr_t userdest, size_t len)
+{
+	int result;
+	size_t stoplen;
+
+	result = copycheck(userdest, len, &stoplen);
+	if (result) {
+		return result;
+	}
+	if (stoplen != len) {
+		return EFAULT;
+	}
+
+	/* copybulk only reads through kbuf in this direction */
+	return copybulk((vaddr_t)userdest, (char *)src, len, 1);
+}
+
 /*
  * Common string copying function that behaves the way that's desired
  * for copyinstr and copyoutstr.
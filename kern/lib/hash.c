@@ -0,0 +1,269 @@
+/*
+ * Open-addressing hash table. See hash.h.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <hash.h>
+
+/* Smallest table; sizes are always powers of 2 */
+#define HASH_MINSIZE  16
+
+/* Old slots moved to the new table per call while resizing */
+#define HASH_MIGRATE  4
+
+/*
+ * A slot is empty if its key is NULL, and deleted if its key is
+ * HASH_TOMB. Deleted slots have to be skipped over rather than
+ * treated as empty, or lookups would stop short of keys that
+ * probed past them.
+ */
+static const char hash_tombstone;
+#define HASH_TOMB ((const void *)&hash_tombstone)
+
+struct hash_slot {
+	const void *hs_key;
+	void *hs_val;
+};
+
+struct hash {
+	u_int32_t (*h_hashfn)(const void *);
+	int (*h_eqfn)(const void *, const void *);
+
+	struct hash_slot *h_tab;
+	u_int32_t h_size;	/* slots in h_tab */
+	u_int32_t h_used;	/* slots in h_tab not empty, deleted ones too */
+	u_int32_t h_count;	/* entries, in both tables */
+
+	/* During a resize: the table being moved out of */
+	struct hash_slot *h_old;
+	u_int32_t h_oldsize;
+	u_int32_t h_oldpos;	/* slots below this are done */
+};
+
+struct hash *
+hash_create(u_int32_t (*hashfn)(const void *),
+	    int (*eqfn)(const void *, const void *))
+{
+	struct hash *h;
+
+	h = kmalloc(sizeof(struct hash));
+	if (h == NULL) {
+		return NULL;
+	}
+	h->h_tab = kmalloc(HASH_MINSIZE * sizeof(struct hash_slot));
+	if (h->h_tab == NULL) {
+		kfree(h);
+		return NULL;
+	}
+	bzero(h->h_tab, HASH_MINSIZE * sizeof(struct hash_slot));
+
+	h->h_hashfn = hashfn;
+	h->h_eqfn = eqfn;
+	h->h_size = HASH_MINSIZE;
+	h->h_used = 0;
+	h->h_count = 0;
+	h->h_old = NULL;
+	h->h_oldsize = 0;
+	h->h_oldpos = 0;
+	return h;
+}
+
+u_int32_t
+hash_count(struct hash *h)
+{
+	return h->h_count;
+}
+
+/*
+ * Find the slot holding KEY in TAB, or NULL.
+ */
+static
+struct hash_slot *
+hash_lookup(struct hash *h, struct hash_slot *tab, u_int32_t size,
+	    const void *key)
+{
+	u_int32_t i, n;
+
+	i = h->h_hashfn(key) & (size - 1);
+	for (n = 0; n < size; n++) {
+		if (tab[i].hs_key == NULL) {
+			return NULL;
+		}
+		if (tab[i].hs_key != HASH_TOMB && h->h_eqfn(tab[i].hs_key, key)) {
+			return &tab[i];
+		}
+		i = (i + 1) & (size - 1);
+	}
+	return NULL;
+}
+
+/*
+ * Put KEY into h_tab, which must not already hold it and must have a
+ * free slot.
+ */
+static
+void
+hash_insert(struct hash *h, const void *key, void *val)
+{
+	u_int32_t i;
+
+	i = h->h_hashfn(key) & (h->h_size - 1);
+	while (h->h_tab[i].hs_key != NULL && h->h_tab[i].hs_key != HASH_TOMB) {
+		i = (i + 1) & (h->h_size - 1);
+	}
+	if (h->h_tab[i].hs_key == NULL) {
+		h->h_used++;
+	}
+	h->h_tab[i].hs_key = key;
+	h->h_tab[i].hs_val = val;
+}
+
+/*
+ * Move up to N slots' worth of entries out of the old table, and free
+ * it once it is empty.
+ */
+static
+void
+hash_migrate(struct hash *h, u_int32_t n)
+{
+	struct hash_slot *s;
+
+	while (h->h_old != NULL && n-- > 0) {
+		s = &h->h_old[h->h_oldpos];
+		if (s->hs_key != NULL && s->hs_key != HASH_TOMB) {
+			hash_insert(h, s->hs_key, s->hs_val);
+			/* so lookups in the old table don't find it again */
+			s->hs_key = HASH_TOMB;
+		}
+		if (++h->h_oldpos == h->h_oldsize) {
+			kfree(h->h_old);
+			h->h_old = NULL;
+			h->h_oldsize = 0;
+			h->h_oldpos = 0;
+		}
+	}
+}
+
+/*
+ * Start moving to a new table: twice the size, or the same size if
+ * it's mostly deleted slots that are filling this one.
+ */
+static
+int
+hash_grow(struct hash *h)
+{
+	struct hash_slot *tab;
+	u_int32_t size;
+
+	/* Finish off any resize still going on */
+	hash_migrate(h, h->h_oldsize);
+
+	size = h->h_size;
+	if (h->h_count * 4 >= h->h_size) {
+		size *= 2;
+	}
+	tab = kmalloc(size * sizeof(struct hash_slot));
+	if (tab == NULL) {
+		return ENOMEM;
+	}
+	bzero(tab, size * sizeof(struct hash_slot));
+
+	h->h_old = h->h_tab;
+	h->h_oldsize = h->h_size;
+	h->h_oldpos = 0;
+	h->h_tab = tab;
+	h->h_size = size;
+	h->h_used = 0;
+	return 0;
+}
+
+void *
+hash_find(struct hash *h, const void *key)
+{
+	struct hash_slot *s;
+
+	hash_migrate(h, HASH_MIGRATE);
+
+	s = hash_lookup(h, h->h_tab, h->h_size, key);
+	if (s == NULL && h->h_old != NULL) {
+		s = hash_lookup(h, h->h_old, h->h_oldsize, key);
+	}
+	return s != NULL ? s->hs_val : NULL;
+}
+
+int
+hash_add(struct hash *h, const void *key, void *val)
+{
+	int result;
+
+	assert(key != NULL && key != HASH_TOMB);
+	assert(val != NULL);
+
+	if (hash_find(h, key) != NULL) {
+		return EEXIST;
+	}
+
+	if ((h->h_used + 1) * 2 > h->h_size) {
+		result = hash_grow(h);
+		if (result) {
+			return result;
+		}
+	}
+
+	hash_insert(h, key, val);
+	h->h_count++;
+	return 0;
+}
+
+void *
+hash_remove(struct hash *h, const void *key)
+{
+	struct hash_slot *s;
+	void *val;
+
+	hash_migrate(h, HASH_MIGRATE);
+
+	s = hash_lookup(h, h->h_tab, h->h_size, key);
+	if (s == NULL && h->h_old != NULL) {
+		s = hash_lookup(h, h->h_old, h->h_oldsize, key);
+	}
+	if (s == NULL) {
+		return NULL;
+	}
+
+	val = s->hs_val;
+	s->hs_key = HASH_TOMB;
+	s->hs_val = NULL;
+	assert(h->h_count > 0);
+	h->h_count--;
+	return val;
+}
+
+void
+hash_destroy(struct hash *h)
+{
+	if (h->h_old != NULL) {
+		kfree(h->h_old);
+	}
+	kfree(h->h_tab);
+	kfree(h);
+}
+
+u_int32_t
+hash_u32(const void *key)
+{
+	u_int32_t x = *(const u_int32_t *)key;
+
+	/* mix the high bits down, since only the low ones pick the slot */
+	x ^= x >> 16;
+	x *= 0x45d9f3b;
+	x ^= x >> 16;
+	return x;
+}
+
+int
+hash_u32eq(const void *key1, const void *key2)
+{
+	return *(const u_int32_t *)key1 == *(const u_int32_t *)key2;
+}
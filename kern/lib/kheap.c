@@ -39,7 +39,11 @@ fill_deadbeef(void *vptr, size_t len)
 //    The free counts and addresses of the pages are maintained in
 //    another list.  Maintaining this table is a nuisance, because it
 //    cannot recursively use the subpage allocator. (We could probably
-//    make that work, but it would be painful.)
+//    make that work, but it would be painful.) So its entries, the
+//    pagerefs, come a whole page at a time straight from alloc_kpages.
+//
+//    The coremap records the pageref of each page in use here, so
+//    kfree finds it without searching.
 //
 
 #undef  SLOW	/* consistency checks */
@@ -69,7 +73,9 @@ struct freelist {
 
 struct pageref {
 	struct pageref *next_samesize;
+	struct pageref **pprev_samesize;
 	struct pageref *next_all;
+	struct pageref **pprev_all;
 	vaddr_t pageaddr_and_blocktype;
 	u_int16_t freelist_offset;
 	u_int16_t nfree;
@@ -84,67 +90,75 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * This is cheesy. 
- *
- * The problem is not that it's wasteful - we can only allocate whole
- * pages of pageref structures at a time anyway. The problem is that
- * we really ought to be able to have more than one of these pages.
- *
- * However, for the time being, one page worth of pagerefs gives us
- * 256 pagerefs; this lets us manage 256 * 4k = 1M of kernel heap.
- * That would be twice as much memory as we get for *everything*.
- * Thus, we will cheat and not allow any mechanism for having a second
- * page of pageref structs.
- *
- * Then, since the size is fixed at one page, we'll simplify a bit
- * further by allocating the page in the kernel BSS instead of calling
- * alloc_kpages to get it.
+ * Pagerefs not in use. They come in pages of NPAGEREFS, which are
+ * never given back; each one can manage 4k of heap, so a page of
+ * them manages 1M and is cheap to keep around.
  */
 
 #define NPAGEREFS (PAGE_SIZE / sizeof(struct pageref))
-static struct pageref pagerefs[NPAGEREFS];
-
-#define INUSE_WORDS (NPAGEREFS/32)
-static u_int32_t pagerefs_inuse[INUSE_WORDS];
+static struct pageref *freepagerefs;
+static unsigned npagerefpages;	/* pages of pagerefs */
+static unsigned npagerefs;	/* pagerefs in use */
 
 static
 struct pageref *
 allocpageref(void)
 {
-	unsigned i,j;
-	u_int32_t k;
+	struct pageref *prs;
+	vaddr_t page;
+	unsigned i;
 
-	for (i=0; i<INUSE_WORDS; i++) {
-		if (pagerefs_inuse[i]==0xffffffff) {
-			/* full */
-			continue;
+	if (freepagerefs == NULL) {
+		/* Before coremap_bootstrap, pages have to be stolen */
+		if (coremap_entry == NULL) {
+			page = alloc_kpages_dumb(1);
 		}
-		for (k=1,j=0; k!=0; k<<=1,j++) {
-			if ((pagerefs_inuse[i] & k)==0) {
-				pagerefs_inuse[i] |= k;
-				return &pagerefs[i*32 + j];
-			}
+		else {
+			page = alloc_kpages(1);
 		}
-		assert(0);
+		if (page == 0) {
+			/* ran out */
+			return NULL;
+		}
+
+		prs = (struct pageref *)page;
+		for (i=0; i<NPAGEREFS; i++) {
+			prs[i].next_samesize = freepagerefs;
+			freepagerefs = &prs[i];
+		}
+		npagerefpages++;
 	}
 
-	/* ran out */
-	return NULL;
+	prs = freepagerefs;
+	freepagerefs = prs->next_samesize;
+	npagerefs++;
+	return prs;
 }
 
 static
 void
 freepageref(struct pageref *p)
 {
-	size_t i, j;
-	u_int32_t k;
-
-	j = p-pagerefs;
-	assert(j < NPAGEREFS);  /* note: j is unsigned, don't test < 0 */
-	i = j/32;
-	k = ((u_int32_t)1) << (j%32);
-	assert((pagerefs_inuse[i] & k) != 0);
-	pagerefs_inuse[i] &= ~k;
+	assert(npagerefs > 0);
+	npagerefs--;
+	p->next_samesize = freepagerefs;
+	freepagerefs = p;
+}
+
+/*
+ * Record in the coremap which pageref, if any, a page belongs to.
+ * Pages handed out before the coremap existed aren't in it.
+ */
+static
+void
+setpageref(vaddr_t prpage, struct pageref *pr)
+{
+	paddr_t pa = KVADDR_TO_PADDR(prpage);
+
+	if (coremap_entry != NULL && pa >= firstpaddr_init) {
+		assert((pa - firstpaddr_init)/PAGE_SIZE < ram_npages);
+		cmap_pageref_entry[(pa - firstpaddr_init)/PAGE_SIZE] = pr;
+	}
 }
 
 ////////////////////////////////////////
@@ -152,6 +166,74 @@ freepageref(struct pageref *p)
 static struct pageref *sizebases[NSIZES];
 static struct pageref *allbase;
 
+/*
+ * Object caches. A cache's pages (slabs) are managed with pagerefs
+ * like the subpage allocator's, with block types from NSIZES up, so
+ * they're found the same way. Slabs with free objects are on
+ * kc_partial and the rest on kc_full, both via next_samesize.
+ *
+ * If the cache has a constructor, free objects are kept constructed,
+ * so the freelist link goes in an extra word after each object
+ * instead of in the first word. A slab with only one object doesn't
+ * need the link at all.
+ */
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_size;			/* object size */
+	size_t kc_stride;		/* distance between objects */
+	size_t kc_linkoff;		/* where the freelist link goes */
+	unsigned kc_perslab;		/* objects per slab */
+	unsigned kc_maxempty;		/* empty slabs worth keeping */
+	int (*kc_ctor)(void *obj);
+	void (*kc_dtor)(void *obj);
+	struct pageref *kc_partial;	/* slabs with free objects */
+	struct pageref *kc_full;	/* slabs without */
+	unsigned kc_nslabs;
+	unsigned kc_nempty;		/* slabs with no objects in use */
+	unsigned kc_inuse;		/* objects handed out */
+	unsigned kc_nallocs;		/* kmem_cache_alloc calls */
+	unsigned kc_nslaballocs;	/* ... that needed a new slab */
+};
+
+#define KMEM_NCACHES 32
+
+/* Keep empty slabs for about this many objects; kmem_reclaim frees them */
+#define KMEM_KEEPOBJS 8
+static struct kmem_cache kmem_caches[KMEM_NCACHES];
+
+#define KC_BLOCKTYPE(kc)  ((vaddr_t)(NSIZES + ((kc) - kmem_caches)))
+#define PR_CACHE(pr)      (&kmem_caches[PR_BLOCKTYPE(pr) - NSIZES])
+
+/*
+ * Find the pageref for the page holding PTRADDR, or NULL if it's not
+ * a subpage allocation.
+ */
+static
+struct pageref *
+findpageref(vaddr_t ptraddr)
+{
+	struct pageref *pr;
+	paddr_t pa;
+
+	if (ptraddr < MIPS_KSEG0 || ptraddr >= MIPS_KSEG1) {
+		return NULL;
+	}
+
+	pa = KVADDR_TO_PADDR(ptraddr) & PAGE_FRAME;
+	if (coremap_entry != NULL && pa >= firstpaddr_init) {
+		assert((pa - firstpaddr_init)/PAGE_SIZE < ram_npages);
+		return cmap_pageref_entry[(pa - firstpaddr_init)/PAGE_SIZE];
+	}
+
+	/* Stolen before coremap_bootstrap; there are only a few */
+	for (pr = allbase; pr != NULL; pr = pr->next_all) {
+		if (PR_PAGEADDR(pr) == (ptraddr & PAGE_FRAME)) {
+			return pr;
+		}
+	}
+	return NULL;
+}
+
 ////////////////////////////////////////
 
 /* SLOWER implies SLOW */
@@ -181,6 +263,13 @@ checksubpage(struct pageref *pr)
 	prpage = PR_PAGEADDR(pr);
 	blktype = PR_BLOCKTYPE(pr);
 
+	if (blktype >= NSIZES) {
+		/* object cache slab; see kmem_cache_alloc */
+		assert(pr->nfree <= PR_CACHE(pr)->kc_perslab);
+		assert(pr->freelist_offset % PR_CACHE(pr)->kc_stride == 0);
+		return;
+	}
+
 	assert(pr->freelist_offset < PAGE_SIZE);
 	assert(pr->freelist_offset % sizes[blktype] == 0);
 
@@ -215,18 +304,26 @@ checksubpages(void)
 	for (i=0; i<NSIZES; i++) {
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
 			checksubpage(pr);
-			assert(sc < NPAGEREFS);
+			assert(*pr->pprev_samesize == pr);
+			assert(sc < npagerefs);
 			sc++;
 		}
 	}
 
+	for (i=0; i<KMEM_NCACHES; i++) {
+		sc += kmem_caches[i].kc_nslabs;
+	}
+
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		checksubpage(pr);
-		assert(ac < NPAGEREFS);
+		assert(*pr->pprev_all == pr);
+		assert(findpageref(PR_PAGEADDR(pr)) == pr);
+		assert(ac < npagerefs);
 		ac++;
 	}
 
 	assert(sc==ac);
+	assert(ac==npagerefs);
 }
 #else
 #define checksubpages() 
@@ -293,10 +390,30 @@ kheap_printstats(void)
 	/* print the whole thing with interrupts off */
 	int spl = splhigh();
 
-	kprintf("Subpage allocator status:\n");
+	struct kmem_cache *kc;
+	unsigned i;
+
+	kprintf("Subpage allocator status: %u pages, %u pages of pagerefs\n",
+		npagerefs, npagerefpages);
 
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
-		dumpsubpage(pr);
+		if (PR_BLOCKTYPE(pr) < NSIZES) {
+			dumpsubpage(pr);
+		}
+	}
+
+	kprintf("Object caches:\n");
+	kprintf("  %-16s %5s %6s %6s %6s %8s %6s\n", "name", "size",
+		"inuse", "free", "slabs", "allocs", "grows");
+	for (i=0; i<KMEM_NCACHES; i++) {
+		kc = &kmem_caches[i];
+		if (kc->kc_name == NULL) {
+			continue;
+		}
+		kprintf("  %-16s %5u %6u %6u %6u %8u %6u\n", kc->kc_name,
+			kc->kc_size, kc->kc_inuse,
+			kc->kc_nslabs * kc->kc_perslab - kc->kc_inuse,
+			kc->kc_nslabs, kc->kc_nallocs, kc->kc_nslaballocs);
 	}
 
 	splx(spl);
@@ -306,29 +423,69 @@ kheap_printstats(void)
 
 static
 void
-remove_lists(struct pageref *pr, int blktype)
+samesize_insert(struct pageref **head, struct pageref *pr)
 {
-	struct pageref **guy;
+	pr->next_samesize = *head;
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->pprev_samesize = &pr->next_samesize;
+	}
+	pr->pprev_samesize = head;
+	*head = pr;
+}
 
-	assert(blktype>=0 && blktype<NSIZES);
+static
+void
+samesize_remove(struct pageref *pr)
+{
+	*pr->pprev_samesize = pr->next_samesize;
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->pprev_samesize = pr->pprev_samesize;
+	}
+}
 
-	for (guy = &sizebases[blktype]; *guy; guy = &(*guy)->next_samesize) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_samesize;
-			break;
-		}
+static
+void
+all_insert(struct pageref *pr)
+{
+	pr->next_all = allbase;
+	if (pr->next_all != NULL) {
+		pr->next_all->pprev_all = &pr->next_all;
 	}
+	pr->pprev_all = &allbase;
+	allbase = pr;
+}
 
-	for (guy = &allbase; *guy; guy = &(*guy)->next_all) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_all;
-			break;
-		}
+static
+void
+all_remove(struct pageref *pr)
+{
+	*pr->pprev_all = pr->next_all;
+	if (pr->next_all != NULL) {
+		pr->next_all->pprev_all = pr->pprev_all;
 	}
 }
 
+static
+void
+add_lists(struct pageref *pr, int blktype)
+{
+	assert(blktype>=0 && blktype<NSIZES);
+
+	samesize_insert(&sizebases[blktype], pr);
+	all_insert(pr);
+}
+
+static
+void
+remove_lists(struct pageref *pr, int blktype)
+{
+	assert(blktype>=0 && blktype<NSIZES);
+	checksubpage(pr);
+
+	samesize_remove(pr);
+	all_remove(pr);
+}
+
 static
 inline
 int blocktype(size_t sz)
@@ -449,11 +606,8 @@ subpage_kmalloc(size_t sz)
 	pr->freelist_offset = fla - prpage;
 	assert(pr->freelist_offset == (pr->nfree-1)*sizes[blktype]);
 
-	pr->next_samesize = sizebases[blktype];
-	sizebases[blktype] = pr;
-
-	pr->next_all = allbase;
-	allbase = pr;
+	add_lists(pr, blktype);
+	setpageref(prpage, pr);
 
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
@@ -569,11 +723,8 @@ subpage_kmalloc_dumb(size_t sz)
 	pr->freelist_offset = fla - prpage;
 	assert(pr->freelist_offset == (pr->nfree-1)*sizes[blktype]);
 
-	pr->next_samesize = sizebases[blktype];
-	sizebases[blktype] = pr;
-
-	pr->next_all = allbase;
-	allbase = pr;
+	add_lists(pr, blktype);
+	setpageref(prpage, pr);
 
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
@@ -598,25 +749,25 @@ subpage_kfree(void *ptr)
 
 	checksubpages();
 
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-
-		/* check for corruption */
-		assert(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
-
+	pr = findpageref(ptraddr);
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
 		splx(spl);
 		return -1;
 	}
 
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+
+	if (blktype >= NSIZES) {
+		panic("kfree: %p belongs to object cache %s\n", ptr,
+		      PR_CACHE(pr)->kc_name);
+	}
+
+	/* check for corruption */
+	assert(blktype>=0 && blktype<NSIZES);
+	checksubpage(pr);
+
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
@@ -649,6 +800,7 @@ subpage_kfree(void *ptr)
 	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
 		/* Whole page is free. */
 		remove_lists(pr, blktype);
+		setpageref(prpage, NULL);
 		free_kpages(prpage);
 		freepageref(pr);
 	}
@@ -659,6 +811,290 @@ subpage_kfree(void *ptr)
 	return 0;
 }
 
+////////////////////////////////////////
+//
+// Object caches.
+
+/*
+ * Make a cache of objects of SIZE bytes. CTOR, if not NULL, is run on
+ * each object when its slab is made, and may fail with an error code;
+ * DTOR is run when the slab is given back. Objects handed back with
+ * kmem_cache_free must be in their constructed state again.
+ */
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size,
+		  int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kmem_cache *kc = NULL;
+	unsigned i;
+	int spl;
+
+	assert(size > 0 && size <= PAGE_SIZE);
+
+	spl = splhigh();
+	for (i=0; i<KMEM_NCACHES; i++) {
+		if (kmem_caches[i].kc_name == NULL) {
+			kc = &kmem_caches[i];
+			break;
+		}
+	}
+	if (kc == NULL) {
+		splx(spl);
+		kprintf("kmem_cache_create: no room for cache %s\n", name);
+		return NULL;
+	}
+
+	bzero(kc, sizeof(*kc));
+	kc->kc_name = name;
+	kc->kc_size = size;
+	kc->kc_ctor = ctor;
+	kc->kc_dtor = dtor;
+
+	/* Keep objects 8-byte aligned, like kmalloc's */
+	kc->kc_stride = (size + 7) & ~(size_t)7;
+	if (kc->kc_stride < sizeof(struct freelist)) {
+		kc->kc_stride = sizeof(struct freelist);
+	}
+	kc->kc_linkoff = 0;
+	if (ctor != NULL && PAGE_SIZE / kc->kc_stride > 1) {
+		kc->kc_linkoff = kc->kc_stride;
+		kc->kc_stride = (kc->kc_linkoff + sizeof(struct freelist) + 7)
+			& ~(size_t)7;
+	}
+	kc->kc_perslab = PAGE_SIZE / kc->kc_stride;
+	assert(kc->kc_perslab > 0);
+	kc->kc_maxempty = (KMEM_KEEPOBJS + kc->kc_perslab - 1) / kc->kc_perslab;
+
+	splx(spl);
+	return kc;
+}
+
+/* The freelist link of the free object at OBJ */
+#define KC_LINK(kc, obj) \
+	((struct freelist *)((obj) + (kc)->kc_linkoff))
+
+/*
+ * Give a slab with no objects in use back to the page allocator.
+ */
+static
+void
+kmem_slab_destroy(struct kmem_cache *kc, struct pageref *pr)
+{
+	vaddr_t prpage = PR_PAGEADDR(pr);
+	unsigned i;
+
+	assert(pr->nfree == kc->kc_perslab);
+
+	if (kc->kc_dtor != NULL) {
+		for (i=0; i<kc->kc_perslab; i++) {
+			kc->kc_dtor((void *)(prpage + i*kc->kc_stride));
+		}
+	}
+
+	samesize_remove(pr);
+	all_remove(pr);
+	setpageref(prpage, NULL);
+	free_kpages(prpage);
+	freepageref(pr);
+	kc->kc_nslabs--;
+}
+
+/*
+ * Make a new slab for a cache, with every object constructed and on
+ * the freelist, and put it on kc_partial.
+ */
+static
+struct pageref *
+kmem_slab_create(struct kmem_cache *kc)
+{
+	struct pageref *pr;
+	vaddr_t prpage, obj;
+	unsigned i, j;
+
+	pr = allocpageref();
+	if (pr == NULL) {
+		kprintf("kmem_cache_alloc: couldn't get pageref\n");
+		return NULL;
+	}
+	prpage = alloc_kpages(1);
+	if (prpage == 0) {
+		freepageref(pr);
+		return NULL;
+	}
+
+	if (kc->kc_ctor != NULL) {
+		for (i=0; i<kc->kc_perslab; i++) {
+			if (kc->kc_ctor((void *)(prpage + i*kc->kc_stride))) {
+				for (j=0; j<i && kc->kc_dtor != NULL; j++) {
+					kc->kc_dtor((void *)(prpage +
+							    j*kc->kc_stride));
+				}
+				free_kpages(prpage);
+				freepageref(pr);
+				return NULL;
+			}
+		}
+	}
+
+	/* Chain the objects together, first one first */
+	for (i=0; i<kc->kc_perslab; i++) {
+		obj = prpage + i*kc->kc_stride;
+		if (kc->kc_perslab > 1) {
+			KC_LINK(kc, obj)->next = (i+1 < kc->kc_perslab) ?
+				(struct freelist *)(obj + kc->kc_stride) : NULL;
+		}
+	}
+
+	pr->pageaddr_and_blocktype = MKPAB(prpage, KC_BLOCKTYPE(kc));
+	pr->nfree = kc->kc_perslab;
+	pr->freelist_offset = 0;
+
+	samesize_insert(&kc->kc_partial, pr);
+	all_insert(pr);
+	setpageref(prpage, pr);
+	kc->kc_nslabs++;
+	kc->kc_nempty++;
+	kc->kc_nslaballocs++;
+	return pr;
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct pageref *pr;
+	struct freelist *next;
+	vaddr_t prpage, obj;
+	int spl;
+
+	spl = splhigh();
+
+	kc->kc_nallocs++;
+
+	pr = kc->kc_partial;
+	if (pr == NULL) {
+		pr = kmem_slab_create(kc);
+		if (pr == NULL) {
+			splx(spl);
+			return NULL;
+		}
+	}
+	checksubpage(pr);
+	assert(pr->nfree > 0);
+
+	prpage = PR_PAGEADDR(pr);
+	obj = prpage + pr->freelist_offset;
+	next = (kc->kc_perslab > 1) ? KC_LINK(kc, obj)->next : NULL;
+
+	if (pr->nfree == kc->kc_perslab) {
+		assert(kc->kc_nempty > 0);
+		kc->kc_nempty--;
+	}
+	pr->nfree--;
+	if (next != NULL) {
+		assert(pr->nfree > 0);
+		pr->freelist_offset = (vaddr_t)next - prpage;
+	}
+	else {
+		assert(pr->nfree == 0);
+		pr->freelist_offset = INVALID_OFFSET;
+		samesize_remove(pr);
+		samesize_insert(&kc->kc_full, pr);
+	}
+
+	kc->kc_inuse++;
+	splx(spl);
+	return (void *)obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *ptr)
+{
+	struct pageref *pr;
+	vaddr_t prpage, offset;
+	int spl;
+
+	if (ptr == NULL) {
+		return;
+	}
+
+	spl = splhigh();
+
+	pr = findpageref((vaddr_t)ptr);
+	if (pr == NULL || PR_BLOCKTYPE(pr) != KC_BLOCKTYPE(kc)) {
+		panic("kmem_cache_free: %p is not from cache %s\n", ptr,
+		      kc->kc_name);
+	}
+	prpage = PR_PAGEADDR(pr);
+	offset = (vaddr_t)ptr - prpage;
+	if (offset % kc->kc_stride != 0) {
+		panic("kmem_cache_free: invalid addr %p\n", ptr);
+	}
+
+	/* Constructed objects must be left alone */
+	if (kc->kc_ctor == NULL) {
+		fill_deadbeef(ptr, kc->kc_size);
+	}
+
+	if (kc->kc_perslab > 1) {
+		KC_LINK(kc, (vaddr_t)ptr)->next =
+			(pr->freelist_offset == INVALID_OFFSET) ? NULL :
+			(struct freelist *)(prpage + pr->freelist_offset);
+	}
+	pr->freelist_offset = offset;
+	pr->nfree++;
+	assert(pr->nfree <= kc->kc_perslab);
+	assert(kc->kc_inuse > 0);
+	kc->kc_inuse--;
+
+	if (pr->nfree == 1) {
+		/* was full */
+		samesize_remove(pr);
+		samesize_insert(&kc->kc_partial, pr);
+	}
+	if (pr->nfree == kc->kc_perslab) {
+		/* Keep a few empty slabs around, so we don't thrash */
+		if (kc->kc_nempty >= kc->kc_maxempty) {
+			kmem_slab_destroy(kc, pr);
+		}
+		else {
+			kc->kc_nempty++;
+		}
+	}
+
+	splx(spl);
+}
+
+/*
+ * Give back one empty slab from any cache. Returns 1 if it found one.
+ * Called by the VM system when it runs out of free pages.
+ */
+int
+kmem_reclaim(void)
+{
+	struct kmem_cache *kc;
+	struct pageref *pr;
+	unsigned i;
+	int spl;
+
+	spl = splhigh();
+	for (i=0; i<KMEM_NCACHES; i++) {
+		kc = &kmem_caches[i];
+		if (kc->kc_name == NULL || kc->kc_nempty == 0) {
+			continue;
+		}
+		for (pr = kc->kc_partial; pr != NULL; pr = pr->next_samesize) {
+			if (pr->nfree == kc->kc_perslab) {
+				kc->kc_nempty--;
+				kmem_slab_destroy(kc, pr);
+				splx(spl);
+				return 1;
+			}
+		}
+	}
+	splx(spl);
+	return 0;
+}
+
 //
 ////////////////////////////////////////////////////////////
 
@@ -672,6 +1108,10 @@ kmalloc(size_t sz)
 		/* Round up to a whole number of pages. */
 		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
 		address = alloc_kpages(npages);
+		if (address==0 && npages > 1) {
+			/* no contiguous run free; map scattered frames */
+			address = alloc_kpages_mapped(npages);
+		}
 		if (address==0) {
 			return NULL;
 		}
@@ -714,12 +1154,17 @@ kfree(void *ptr)
 {
 	/*
 	 * Try subpage first; if that fails, assume it's a big allocation.
+	 * Either way the coremap tells us straight off.
 	 */
 	if (ptr == NULL) {
 		return;
 	} else if (subpage_kfree(ptr)) {
 		assert((vaddr_t)ptr%PAGE_SIZE==0);
-		free_kpages((vaddr_t)ptr);
+		if ((vaddr_t)ptr >= MIPS_KSEG2) {
+			free_kpages_mapped((vaddr_t)ptr);
+		} else {
+			free_kpages((vaddr_t)ptr);
+		}
 	}
 }
 
@@ -0,0 +1,98 @@
+/*
+ * Intrusive doubly linked list. See list.h.
+ */
+#include <types.h>
+#include <lib.h>
+#include <list.h>
+
+void
+list_init(struct list *l)
+{
+	l->l_head.le_next = &l->l_head;
+	l->l_head.le_prev = &l->l_head;
+	l->l_count = 0;
+}
+
+int
+list_empty(struct list *l)
+{
+	return l->l_head.le_next == &l->l_head;
+}
+
+int
+list_count(struct list *l)
+{
+	return l->l_count;
+}
+
+/*
+ * Link E in between PREV and NEXT.
+ */
+static
+void
+list_link(struct list *l, struct list_entry *prev, struct list_entry *e,
+	  struct list_entry *next)
+{
+	assert(e->le_next == NULL && e->le_prev == NULL);
+
+	e->le_prev = prev;
+	e->le_next = next;
+	prev->le_next = e;
+	next->le_prev = e;
+	l->l_count++;
+}
+
+void
+list_addhead(struct list *l, struct list_entry *e)
+{
+	list_link(l, &l->l_head, e, l->l_head.le_next);
+}
+
+void
+list_addtail(struct list *l, struct list_entry *e)
+{
+	list_link(l, l->l_head.le_prev, e, &l->l_head);
+}
+
+void
+list_remove(struct list *l, struct list_entry *e)
+{
+	assert(e != &l->l_head);
+	assert(e->le_next != NULL && e->le_prev != NULL);
+	assert(l->l_count > 0);
+
+	e->le_prev->le_next = e->le_next;
+	e->le_next->le_prev = e->le_prev;
+	e->le_next = e->le_prev = NULL;
+	l->l_count--;
+}
+
+struct list_entry *
+list_remhead(struct list *l)
+{
+	struct list_entry *e;
+
+	e = list_first(l);
+	if (e != NULL) {
+		list_remove(l, e);
+	}
+	return e;
+}
+
+struct list_entry *
+list_first(struct list *l)
+{
+	if (list_empty(l)) {
+		return NULL;
+	}
+	return l->l_head.le_next;
+}
+
+struct list_entry *
+list_next(struct list *l, struct list_entry *e)
+{
+	if (e->le_next == &l->l_head) {
+		return NULL;
+	}
+	return e->le_next;
+}
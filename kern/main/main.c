@@ -14,6 +14,7 @@
 #include <dev.h>
 #include <vfs.h>
 #include <vm.h>
+#include <buf.h>
 #include <syscall.h>
 #include <version.h>
 
@@ -77,11 +78,19 @@ boot(void)
 	vfs_bootstrap();
 	dev_bootstrap();
 	vm_bootstrap();
+	buf_bootstrap();
 	kprintf_bootstrap();
 	
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
 
+	/*
+	 * After the bootfs, so the syncer inherits it as its current
+	 * directory: evicting a page from a sync opens the swap file by
+	 * a relative name.
+	 */
+	vfs_syncer_bootstrap();
+
 
 	/*
 	 * Make sure various things aren't screwed up.
@@ -21,6 +21,7 @@
 #include <curthread.h>
 #include <machine/tlb.h>
 #include <vm.h>
+#include <buf.h>
 #include <machine/spl.h>
 #include <db-helper.h>
 // ===================================
@@ -84,6 +85,7 @@ cmd_progthread(void *ptr, unsigned long nargs)
 	prog_info->progname = progname;
 	prog_info->argc = nargs;
 	prog_info->argv = args;
+	prog_info->kbuf = NULL;
 	result = runprogram(prog_info);
 	if (result) {
 		kprintf("Running program %s failed: %s\n", args[0],
@@ -479,6 +481,53 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Command for printing the per-syscall counters.
+ */
+static
+int
+cmd_syscallstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	syscall_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for printing the buffer cache counters.
+ */
+static
+int
+cmd_bufstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	buf_printstats();
+
+	return 0;
+}
+
+#if OPT_SFS
+/*
+ * Command for printing the SFS loaded-inode table counters.
+ */
+static
+int
+cmd_sfsstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	sfs_printstats();
+
+	return 0;
+}
+#endif
+
 
 /*
  * the function for printing tlb & coremap are not static
@@ -562,6 +611,7 @@ cmd_coremapstats(int nargs, char **args)
 			kprintf("\n");
 		}
 	}
+	ram_zeropool_stats();
 
 	splx(spl);
 
@@ -624,6 +674,8 @@ cmd_opsmenu(int n, char **a)
 static const char *testmenu[] = {
 	"[at]  Array test                    ",
 	"[bt]  Bitmap test                   ",
+	"[ht]  Hash table test               ",
+	"[lt]  List test                     ",
 	"[qt]  Queue test                    ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
@@ -672,6 +724,11 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[tlb] print out tlb                 ",
 	"[cmap] print out coremap            ",
+	"[syscallstats] Syscall stats        ",
+	"[bufstats] Buffer cache stats       ",
+#if OPT_SFS
+	"[sfsstats] SFS vnode table stats    ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -731,10 +788,17 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "tlb",        cmd_tlbstats   },
 	{ "cmap",       cmd_coremapstats},
+	{ "syscallstats", cmd_syscallstats},
+	{ "bufstats",   cmd_bufstats},
+#if OPT_SFS
+	{ "sfsstats",   cmd_sfsstats},
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "bt",		bitmaptest },
+	{ "ht",		hashtest },
+	{ "lt",		listtest },
 	{ "qt",		queuetest },
 	{ "km1",	malloctest },
 	{ "km2",	mallocstress },
@@ -1,5 +1,6 @@
 #include <types.h>
 #include <lib.h>
+#include <kern/errno.h>
 #include <bitmap.h>
 #include <test.h>
 
@@ -11,7 +12,7 @@ bitmaptest(int nargs, char **args)
 	struct bitmap *b;
 	char data[TESTSIZE];
 	u_int32_t x;
-	int i;
+	int i, n;
 
 	(void)nargs;
 	(void)args;
@@ -29,11 +30,14 @@ bitmaptest(int nargs, char **args)
 		assert(bitmap_isset(b, i)==0);
 	}
 
+	n = 0;
 	for (i=0; i<TESTSIZE; i++) {
 		if (data[i]) {
 			bitmap_mark(b, i);
+			n++;
 		}
 	}
+	assert(bitmap_count(b) == (u_int32_t)n);
 	for (i=0; i<TESTSIZE; i++) {
 		if (data[i]) {
 			assert(bitmap_isset(b, i));
@@ -71,6 +75,28 @@ bitmaptest(int nargs, char **args)
 		assert(bitmap_isset(b, i));
 		assert(data[i]==0);
 	}
+	assert(bitmap_count(b) == TESTSIZE);
+
+	/* Free every other bit, and one run of 40 near the end */
+	for (i=0; i<TESTSIZE; i+=2) {
+		bitmap_unmark(b, i);
+	}
+	for (i=TESTSIZE-50; i<TESTSIZE-10; i++) {
+		if (bitmap_isset(b, i)) {
+			bitmap_unmark(b, i);
+		}
+	}
+	/* (the even bit just before it would make it 41) */
+	bitmap_mark(b, TESTSIZE-51);
+	assert(bitmap_alloc_run(b, 41, &x) == ENOSPC);
+	assert(bitmap_alloc_run(b, 40, &x) == 0);
+	assert(x == TESTSIZE-50);
+	for (i=TESTSIZE-50; i<TESTSIZE-10; i++) {
+		assert(bitmap_isset(b, i));
+	}
+	assert(bitmap_alloc_run(b, 2, &x) == ENOSPC);
+	assert(bitmap_alloc_run(b, 1, &x) == 0);
+	assert(x % 2 == 0);
 
 	kprintf("Bitmap test complete\n");
 	return 0;
@@ -0,0 +1,156 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <hash.h>
+#include <test.h>
+
+#define TESTSIZE 1000
+#define BENCHSIZE 2000
+
+/*
+ * Keys are spread out so they don't hash into a neat sequence.
+ */
+#define KEY(i) ((u_int32_t)(i) * 2654435761U)
+
+static
+void
+testh(struct hash *h, u_int32_t *keys)
+{
+	u_int32_t k;
+	int i, result;
+
+	assert(hash_count(h) == 0);
+
+	/* all of them, which takes several resizes */
+	for (i=0; i<TESTSIZE; i++) {
+		result = hash_add(h, &keys[i], &keys[i]);
+		assert(result == 0);
+		assert(hash_count(h) == (u_int32_t)i+1);
+	}
+	for (i=0; i<TESTSIZE; i++) {
+		assert(hash_find(h, &keys[i]) == &keys[i]);
+		/* looked up by value, not by address */
+		k = keys[i];
+		assert(hash_find(h, &k) == &keys[i]);
+	}
+	k = KEY(TESTSIZE);
+	assert(hash_find(h, &k) == NULL);
+	assert(hash_add(h, &keys[0], &keys[0]) == EEXIST);
+
+	/* drop the odd ones */
+	for (i=1; i<TESTSIZE; i+=2) {
+		assert(hash_remove(h, &keys[i]) == &keys[i]);
+	}
+	assert(hash_remove(h, &keys[1]) == NULL);
+	assert(hash_count(h) == TESTSIZE/2);
+	for (i=0; i<TESTSIZE; i++) {
+		if (i % 2) {
+			assert(hash_find(h, &keys[i]) == NULL);
+		}
+		else {
+			assert(hash_find(h, &keys[i]) == &keys[i]);
+		}
+	}
+
+	/* put them back, reusing deleted slots */
+	for (i=1; i<TESTSIZE; i+=2) {
+		result = hash_add(h, &keys[i], &keys[i]);
+		assert(result == 0);
+	}
+	for (i=0; i<TESTSIZE; i++) {
+		assert(hash_remove(h, &keys[i]) == &keys[i]);
+	}
+	assert(hash_count(h) == 0);
+}
+
+/*
+ * Time BENCHSIZE lookups in a table of BENCHSIZE entries against a
+ * linear search of an array.
+ */
+static
+void
+benchh(struct hash *h)
+{
+	u_int32_t *keys;
+	time_t s1, s2, secs;
+	u_int32_t ns1, ns2, nsecs;
+	int i, j, result;
+
+	keys = kmalloc(BENCHSIZE * sizeof(u_int32_t));
+	if (keys == NULL) {
+		kprintf("hashtest: out of memory, skipping benchmark\n");
+		return;
+	}
+	for (i=0; i<BENCHSIZE; i++) {
+		keys[i] = KEY(i);
+		result = hash_add(h, &keys[i], &keys[i]);
+		if (result) {
+			kprintf("hashtest: %s, skipping benchmark\n",
+				strerror(result));
+			kfree(keys);
+			return;
+		}
+	}
+
+	gettime(&s1, &ns1);
+	for (i=0; i<BENCHSIZE; i++) {
+		for (j=0; keys[j] != KEY(i); j++) {
+			/* search */
+		}
+		assert(j == i);
+	}
+	gettime(&s2, &ns2);
+	getinterval(s1, ns1, s2, ns2, &secs, &nsecs);
+	kprintf("hashtest: array: %lu.%09lu seconds\n",
+		(unsigned long) secs, (unsigned long) nsecs);
+
+	gettime(&s1, &ns1);
+	for (i=0; i<BENCHSIZE; i++) {
+		u_int32_t k = KEY(i);
+		assert(hash_find(h, &k) == &keys[i]);
+	}
+	gettime(&s2, &ns2);
+	getinterval(s1, ns1, s2, ns2, &secs, &nsecs);
+	kprintf("hashtest: hash:  %lu.%09lu seconds\n",
+		(unsigned long) secs, (unsigned long) nsecs);
+
+	for (i=0; i<BENCHSIZE; i++) {
+		hash_remove(h, &keys[i]);
+	}
+	kfree(keys);
+}
+
+int
+hashtest(int nargs, char **args)
+{
+	struct hash *h;
+	u_int32_t *keys;
+	int i;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Beginning hash test...\n");
+
+	keys = kmalloc(TESTSIZE * sizeof(u_int32_t));
+	assert(keys != NULL);
+	for (i=0; i<TESTSIZE; i++) {
+		keys[i] = KEY(i);
+	}
+
+	h = hash_create(hash_u32, hash_u32eq);
+	assert(h != NULL);
+
+	testh(h, keys);
+	/* again, in a table that has been through it all once */
+	testh(h, keys);
+
+	benchh(h);
+
+	hash_destroy(h);
+	kfree(keys);
+
+	kprintf("Hash test complete\n");
+	return 0;
+}
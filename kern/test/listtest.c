@@ -0,0 +1,153 @@
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <array.h>
+#include <list.h>
+#include <test.h>
+
+#define TESTSIZE 73
+#define BENCHSIZE 2000
+
+struct item {
+	int it_val;
+	struct list_entry it_link;
+};
+
+static
+void
+testl(struct list *l, struct item *items)
+{
+	struct list_entry *e, *next;
+	struct item *it;
+	int i;
+
+	assert(list_empty(l));
+	assert(list_first(l) == NULL);
+
+	/* odd values at the front in reverse, even ones at the back */
+	for (i=0; i<TESTSIZE; i++) {
+		items[i].it_val = i;
+		items[i].it_link.le_next = items[i].it_link.le_prev = NULL;
+		if (i % 2) {
+			list_addhead(l, &items[i].it_link);
+		}
+		else {
+			list_addtail(l, &items[i].it_link);
+		}
+		assert(list_count(l) == i+1);
+	}
+
+	i = TESTSIZE % 2 ? TESTSIZE-2 : TESTSIZE-1;
+	for (e = list_first(l); e != NULL; e = list_next(l, e)) {
+		it = LIST_ITEM(e, struct item, it_link);
+		assert(it->it_val == i);
+		i = (i % 2) ? (i == 1 ? 0 : i-2) : i+2;
+	}
+	assert(i == TESTSIZE + TESTSIZE % 2);
+
+	/* drop the odd ones from the middle of the walk */
+	for (e = list_first(l); e != NULL; e = next) {
+		next = list_next(l, e);
+		it = LIST_ITEM(e, struct item, it_link);
+		if (it->it_val % 2) {
+			list_remove(l, e);
+			assert(e->le_next == NULL && e->le_prev == NULL);
+		}
+	}
+	assert(list_count(l) == (TESTSIZE+1)/2);
+
+	for (i=0; i<TESTSIZE; i+=2) {
+		e = list_remhead(l);
+		assert(e != NULL);
+		it = LIST_ITEM(e, struct item, it_link);
+		assert(it->it_val == i);
+	}
+	assert(list_remhead(l) == NULL);
+	assert(list_empty(l));
+	assert(list_count(l) == 0);
+}
+
+/*
+ * Time taking BENCHSIZE objects off a list in an order other than the
+ * one they were added in, against doing the same with an array.
+ */
+static
+void
+benchl(void)
+{
+	struct item *items;
+	struct array *a;
+	struct list l;
+	time_t s1, s2, secs;
+	u_int32_t ns1, ns2, nsecs;
+	int i, j, k, r;
+
+	items = kmalloc(BENCHSIZE * sizeof(struct item));
+	a = array_create();
+	if (items == NULL || a == NULL) {
+		kprintf("listtest: out of memory, skipping benchmark\n");
+		kfree(items);
+		if (a != NULL) {
+			array_destroy(a);
+		}
+		return;
+	}
+
+	list_init(&l);
+	for (i=0; i<BENCHSIZE; i++) {
+		items[i].it_val = i;
+		items[i].it_link.le_next = items[i].it_link.le_prev = NULL;
+		list_addtail(&l, &items[i].it_link);
+		r = array_add(a, &items[i]);
+		assert(r == 0);
+	}
+
+	/* every seventh item, round and round */
+	gettime(&s1, &ns1);
+	for (i=0, k=0; i<BENCHSIZE; i++, k = (k+7) % BENCHSIZE) {
+		for (j=0; array_getguy(a, j) != &items[k]; j++) {
+			/* search */
+		}
+		array_remove(a, j);
+	}
+	gettime(&s2, &ns2);
+	getinterval(s1, ns1, s2, ns2, &secs, &nsecs);
+	kprintf("listtest: array: %lu.%09lu seconds\n",
+		(unsigned long) secs, (unsigned long) nsecs);
+
+	gettime(&s1, &ns1);
+	for (i=0, k=0; i<BENCHSIZE; i++, k = (k+7) % BENCHSIZE) {
+		list_remove(&l, &items[k].it_link);
+	}
+	gettime(&s2, &ns2);
+	getinterval(s1, ns1, s2, ns2, &secs, &nsecs);
+	kprintf("listtest: list:  %lu.%09lu seconds\n",
+		(unsigned long) secs, (unsigned long) nsecs);
+
+	assert(array_getnum(a) == 0);
+	assert(list_empty(&l));
+	array_destroy(a);
+	kfree(items);
+}
+
+int
+listtest(int nargs, char **args)
+{
+	struct item items[TESTSIZE];
+	struct list l;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Beginning list test...\n");
+
+	list_init(&l);
+	testl(&l, items);
+	/* again, on the same list */
+	testl(&l, items);
+
+	benchl();
+
+	kprintf("List test complete\n");
+	return 0;
+}
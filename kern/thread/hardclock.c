@@ -3,6 +3,7 @@
 #include <machine/spl.h>
 #include <thread.h>
 #include <clock.h>
+#include <vfs.h>
 
 /* 
  * The address of lbolt has thread_wakeup called on it once a second.
@@ -29,6 +30,8 @@ hardclock(void)
 		thread_wakeup(&lbolt);
 	}
 
+	vfs_syncer_tick();
+
 	thread_yield();
 }
 
@@ -11,6 +11,7 @@
 #include <thread.h>
 #include <machine/spl.h>
 #include <queue.h>
+#include <vm.h>
 
 /*
  *  Scheduler data
@@ -91,7 +92,18 @@ scheduler(void)
 	assert(curspl>0);
 	
 	while (q_empty(runqueue)) {
-		cpu_idle();
+		/*
+		 * Nothing to run: clear a page for zero-fill faults if the
+		 * pool is short, and then let in any interrupt that came up
+		 * meanwhile, as cpu_idle would. Otherwise really idle.
+		 */
+		if (ram_prezero()) {
+			spl0();
+			splhigh();
+		}
+		else {
+			cpu_idle();
+		}
 	}
 
 	// You can actually uncomment this to see what the scheduler's
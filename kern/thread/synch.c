@@ -247,31 +247,10 @@ void
 cv_signal(struct cv *cv, struct lock *lock)
 {
 	int spl;
-	int i, result;
-	struct array* sleepers;
 	assert(lock != NULL);
 	spl = splhigh();
-	sleepers = get_sleepers();
 	// wake up one thread
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
-		if (t->t_sleepaddr == cv) {
-			
-			// Remove from list
-			array_remove(sleepers, i);
-			
-			// must look at the same sleepers[i] again
-			i--;
-
-			/*
-			 * Because we preallocate during thread_fork,
-			 * this should never fail.
-			 */
-			result = make_runnable(t);
-			assert(result==0);
-			break;
-		}
-	}
+	thread_wakeup_one(cv);
 	lock_release(lock);
 	// actually, we should directly call spl0(), rather than call
 	// splx() implicitly. Cuz we don't have the thread_yield()
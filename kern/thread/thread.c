@@ -13,6 +13,7 @@
 #include <addrspace.h>
 #include <vnode.h>
 #include <queue.h>
+#include <list.h>
 #include <process_helper.h>
 #include "opt-synchprobs.h"
 
@@ -27,8 +28,8 @@ typedef enum {
 /* Global variable for the thread currently executing at any given time. */
 struct thread *curthread;
 
-/* Table of sleeping threads. */
-static struct array *sleepers;
+/* List of sleeping threads, linked through t_sleeplink. */
+static struct list *sleepers;
 
 /* List of dead threads to be disposed of. */
 static struct array *zombies;
@@ -36,6 +37,10 @@ static struct array *zombies;
 /* Total number of outstanding threads. Does not count zombies[]. */
 static int numthreads;
 
+/* Where struct thread and struct process come from. */
+static struct kmem_cache *thread_cache;
+static struct kmem_cache *process_cache;
+
 //static pid_t zombie_pid;
 
 void init_pid() {
@@ -46,10 +51,6 @@ void init_pid() {
 	}
 }
 
-struct array* get_sleepers(void) {
-	return sleepers;
-}
-
 struct thread* get_curthread(void) {
 	return curthread;
 }
@@ -66,17 +67,18 @@ static
 struct thread *
 thread_create(const char *name)
 {
-	struct thread *thread = kmalloc(sizeof(struct thread));
+	struct thread *thread = kmem_cache_alloc(thread_cache);
 	if (thread==NULL) {
 		kprintf("**** thread: fail to alloc thread\n");
 		return NULL;
 	}
 	thread->t_name = kstrdup(name);
 	if (thread->t_name==NULL) {
-		kfree(thread);
+		kmem_cache_free(thread_cache, thread);
 		return NULL;
 	}
 	thread->t_sleepaddr = NULL;
+	thread->t_sleeplink.le_next = thread->t_sleeplink.le_prev = NULL;
 	thread->t_stack = NULL;
 	
 	thread->t_vmspace = NULL;
@@ -86,9 +88,11 @@ thread_create(const char *name)
 	// If you add things to the thread structure, be sure to initialize
 	// them here.
 	
-	thread->process = (struct process *)kmalloc(sizeof(struct process));
+	thread->process = kmem_cache_alloc(process_cache);
 	if (thread->process == NULL) {
 		kprintf("**** thread: fail to alloc process\n");
+		kfree(thread->t_name);
+		kmem_cache_free(thread_cache, thread);
 		return NULL;
 	}
 	thread->process->thread = thread;
@@ -128,10 +132,10 @@ thread_destroy(struct thread *thread)
 	 * after thread becomes zombie. so cannot free process->... here
 	 * do we need to free it before process = 0xdeadbeef ?
 	 */
-	kfree(thread->process);
+	kmem_cache_free(process_cache, thread->process);
 	// ================================================
 	kfree(thread->t_name);
-	kfree(thread);
+	kmem_cache_free(thread_cache, thread);
 }
 
 
@@ -165,7 +169,7 @@ static
 void
 thread_killall(void)
 {
-	int i, result;
+	struct list_entry *e;
 
 	assert(curspl>0);
 
@@ -174,8 +178,8 @@ thread_killall(void)
 	 * wake up while we're shutting down.
 	 */
 
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
+	while ((e = list_remhead(sleepers)) != NULL) {
+		struct thread *t = LIST_ITEM(e, struct thread, t_sleeplink);
 		kprintf("sleep: Dropping thread %s\n", t->t_name);
 
 		/*
@@ -187,10 +191,6 @@ thread_killall(void)
 		 * array_add(zombies, t);
 		 */
 	}
-
-	result = array_setsize(sleepers, 0);
-	/* shrinking array: not supposed to fail */
-	assert(result==0);
 }
 
 /*
@@ -215,6 +215,7 @@ void process_bootstrap(struct thread *menu) {
 	pid_occupied[1] = 1;
 	menu->process->pid = 1;
 	menu->process->ppid = 0;
+	fork_bootstrap();
 }
 
 /*
@@ -226,15 +227,24 @@ thread_bootstrap(void)
 	struct thread *me;
 
 	/* Create the data structures we need. */
-	sleepers = array_create();
+	sleepers = kmalloc(sizeof(struct list));
 	if (sleepers==NULL) {
-		panic("Cannot create sleepers array\n");
+		panic("Cannot create sleepers list\n");
 	}
+	list_init(sleepers);
 
 	zombies = array_create();
 	if (zombies==NULL) {
 		panic("Cannot create zombies array\n");
 	}
+
+	thread_cache = kmem_cache_create("thread", sizeof(struct thread),
+					 NULL, NULL);
+	process_cache = kmem_cache_create("process", sizeof(struct process),
+					  NULL, NULL);
+	if (thread_cache==NULL || process_cache==NULL) {
+		panic("Cannot create thread caches\n");
+	}
 	
 	/*
 	 * Create the thread structure for the first thread
@@ -271,7 +281,7 @@ thread_bootstrap(void)
 void
 thread_shutdown(void)
 {
-	array_destroy(sleepers);
+	kfree(sleepers);
 	sleepers = NULL;
 	array_destroy(zombies);
 	zombies = NULL;
@@ -314,7 +324,8 @@ thread_fork(const char *name,
 	newguy->t_stack = kmalloc(STACK_SIZE);
 	if (newguy->t_stack==NULL) {
 		kfree(newguy->t_name);
-		kfree(newguy);
+		kmem_cache_free(process_cache, newguy->process);
+		kmem_cache_free(thread_cache, newguy);
 		kprintf("**** thread: fail to alloc t_stack\n");
 		return ENOMEM;
 	}
@@ -341,10 +352,6 @@ thread_fork(const char *name,
 	 * Make sure our data structures have enough space, so we won't
 	 * run out later at an inconvenient time.
 	 */
-	result = array_preallocate(sleepers, numthreads+1);
-	if (result) {
-		goto fail;
-	}
 	result = array_preallocate(zombies, numthreads+1);
 	if (result) {
 		goto fail;
@@ -392,7 +399,8 @@ thread_fork(const char *name,
 	}
 	kfree(newguy->t_stack);
 	kfree(newguy->t_name);
-	kfree(newguy);
+	kmem_cache_free(process_cache, newguy->process);
+	kmem_cache_free(thread_cache, newguy);
 
 	return result;
 }
@@ -444,11 +452,8 @@ mi_switch(threadstate_t nextstate)
 		result = make_runnable(cur);
 	}
 	else if (nextstate==S_SLEEP) {
-		/*
-		 * Because we preallocate sleepers[] during thread_fork,
-		 * this should never fail.
-		 */
-		result = array_add(sleepers, cur);
+		list_addtail(sleepers, &cur->t_sleeplink);
+		result = 0;
 	}
 	else {
 		assert(nextstate==S_ZOMB);
@@ -596,22 +601,17 @@ thread_sleep(const void *addr)
 void
 thread_wakeup(const void *addr)
 {
-	int i, result;
+	struct list_entry *e, *next;
+	int result;
 	
 	// meant to be called with interrupts off
 	assert(curspl>0);
 	
-	// This is inefficient. Feel free to improve it.
-	
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
+	for (e = list_first(sleepers); e != NULL; e = next) {
+		struct thread *t = LIST_ITEM(e, struct thread, t_sleeplink);
+		next = list_next(sleepers, e);
 		if (t->t_sleepaddr == addr) {
-			
-			// Remove from list
-			array_remove(sleepers, i);
-			
-			// must look at the same sleepers[i] again
-			i--;
+			list_remove(sleepers, e);
 
 			/*
 			 * Because we preallocate during thread_fork,
@@ -623,10 +623,34 @@ thread_wakeup(const void *addr)
 	}
 }
 
+/*
+ * Wake up the thread that has been sleeping longest on ADDR, if any.
+ */
+void
+thread_wakeup_one(const void *addr)
+{
+	struct list_entry *e;
+	int result;
+
+	// meant to be called with interrupts off
+	assert(curspl>0);
+
+	for (e = list_first(sleepers); e != NULL; e = list_next(sleepers, e)) {
+		struct thread *t = LIST_ITEM(e, struct thread, t_sleeplink);
+		if (t->t_sleepaddr == addr) {
+			list_remove(sleepers, e);
+			result = make_runnable(t);
+			assert(result==0);
+			return;
+		}
+	}
+}
+
 // =============================================
 // DEBUG: student defined function
 // =============================================
 void print_all_thread (void) {
+	struct list_entry *e;
 	int i;
 	int spl;
 	spl=splhigh();
@@ -647,9 +671,10 @@ void print_all_thread (void) {
 	}
 	
 	kprintf("=============== SLEEP QUEUE =================\n");
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
-		kprintf("  %2d: %s %p\n", i, t->t_name, t->t_sleepaddr);
+	i = 0;
+	for (e = list_first(sleepers); e != NULL; e = list_next(sleepers, e)) {
+		struct thread *t = LIST_ITEM(e, struct thread, t_sleeplink);
+		kprintf("  %2d: %s %p\n", i++, t->t_name, t->t_sleepaddr);
 
 	}
 	
@@ -670,13 +695,13 @@ void print_all_thread (void) {
 int
 thread_hassleepers(const void *addr)
 {
-	int i;
+	struct list_entry *e;
 	
 	// meant to be called with interrupts off
 	assert(curspl>0);
 	
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
+	for (e = list_first(sleepers); e != NULL; e = list_next(sleepers, e)) {
+		struct thread *t = LIST_ITEM(e, struct thread, t_sleeplink);
 		if (t->t_sleepaddr == addr) {
 			return 1;
 		}
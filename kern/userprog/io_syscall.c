@@ -8,6 +8,7 @@
 #include <vnode.h>
 #include <vfs.h>
 #include <test.h>
+#include <clock.h>
 
 // write 6
 int sys_write(int filehandle, const void *buf, size_t size) {
@@ -38,3 +39,28 @@ int sys_read(int filehandle, void *buf, size_t size, int *retval) {
 }
 
 
+
+// __time 28
+int sys___time(time_t *secs, unsigned long *nsecs, int32_t *retval) {
+	time_t s;
+	u_int32_t ns;
+	unsigned long uns;
+	int result;
+
+	gettime(&s, &ns);
+	if (secs != NULL) {
+		result = copyout(&s, (userptr_t)secs, sizeof(s));
+		if (result) {
+			return result;
+		}
+	}
+	if (nsecs != NULL) {
+		uns = ns;
+		result = copyout(&uns, (userptr_t)nsecs, sizeof(uns));
+		if (result) {
+			return result;
+		}
+	}
+	*retval = (int32_t)s;
+	return 0;
+}
@@ -10,6 +10,30 @@
 #include <machine/spl.h>
 #include <machine/tlb.h>
 #include <vm.h>
+#include <synch.h>
+#include <test.h>
+
+struct kmem_cache *trapframe_cache;
+struct kmem_cache *forkinfo_cache;
+static struct kmem_cache *child_cache;
+
+/*
+ * create the caches for the structures fork and exit go through,
+ * so they don't have to come from the general heap every time.
+ * called once, from process_bootstrap.
+ */
+void fork_bootstrap(void) {
+	trapframe_cache = kmem_cache_create("trapframe",
+		sizeof(struct trapframe), NULL, NULL);
+	forkinfo_cache = kmem_cache_create("fork_parent_info",
+		sizeof(struct fork_parent_info), NULL, NULL);
+	child_cache = kmem_cache_create("child_list",
+		sizeof(struct child_list), NULL, NULL);
+	if (trapframe_cache == NULL || forkinfo_cache == NULL ||
+	    child_cache == NULL) {
+		panic("fork_bootstrap: cannot create caches\n");
+	}
+}
 
 int print_non_zero_pid() {
 	int spl = splhigh();
@@ -42,7 +66,7 @@ void add_child(struct child_list **header, struct thread *new_child, pid_t child
 		new_child->process->pid = child_pid;
 		new_child->process->ppid = parent_pid;
 	}
-	struct child_list *new_child_node = (struct child_list *)kmalloc(sizeof(struct child_list));
+	struct child_list *new_child_node = kmem_cache_alloc(child_cache);
 	new_child_node->child = new_child;
 	new_child_node->child_pid = child_pid;
 	new_child_node->next = *header;
@@ -109,10 +133,52 @@ void fork_child_setup(void *p_info, unsigned long unused) {
 	 * 	after entering usermode, execution will start at epc
 	 * 	so child has everything set up and will resume at next inst of fork
  	 */ 
-	kfree(parent_info->parent_tf_cp);
-	kfree(parent_info);
+	kmem_cache_free(trapframe_cache, parent_info->parent_tf_cp);
+	kmem_cache_free(forkinfo_cache, parent_info);
 	mips_usermode(&tf);
 }
+
+/*
+ * first function run by a child created by sys_spawn:
+ * load the program into a fresh as (nothing is copied from the parent),
+ * tell the parent how it went, then warp to user mode.
+ */
+void spawn_child_setup(void *s_info, unsigned long unused) {
+	(void)unused;
+	struct spawn_info *info = (struct spawn_info *)s_info;
+	struct runprogram_info *prog_info = info->prog_info;
+	vaddr_t entrypoint, stackptr;
+	int result, argc;
+
+	curthread->process->pid = info->child_pid;
+	curthread->process->ppid = info->child_ppid;
+
+	result = load_program(prog_info, &entrypoint, &stackptr);
+	argc = prog_info->argc;
+	kfree(prog_info->kbuf);
+	kfree(prog_info);
+
+	if (result) {
+		/*
+		 * tear down the half-built as here, so thread_exit does
+		 * not mark our pid as a zombie; the parent frees the pid.
+		 */
+		if (curthread->t_vmspace != NULL) {
+			struct addrspace *as = curthread->t_vmspace;
+			curthread->t_vmspace = NULL;
+			as_destroy(as);
+		}
+	}
+	info->result = result;
+	V(info->loaded);
+	/* info may be gone from here on */
+
+	if (result) {
+		thread_exit();
+	}
+	md_usermode(argc, (userptr_t)stackptr, stackptr, entrypoint);
+}
+
 // no use
 void update_pid_occupied_list() {
 	
@@ -142,48 +208,12 @@ void clearup_zombies(struct child_list *zombie_list) {
 	p_next = p;
 	while (p != NULL) {
 		p_next = p->next;
-		kfree(p);
+		kmem_cache_free(child_cache, p);
 		p = p_next;
 	}
 }
 
 
-/*
- * this is used to set up args for sys_execv
- */
-vaddr_t translate_args_vaddr(vaddr_t userv, struct addrspace *as, int *index) {
-
-	assert(curspl > 0);
-
-	int master_i, secondary_i;
-	int result = vm_fault(0, userv);
-	if (result) {
-		kprintf("**** sys_execv vm_fault err: %d\n", result);
-		return 0;
-	}
-	get_pt_index(as, userv, &master_i, &secondary_i);
-
-	paddr_t paddr;
-//	assert((as->pt_entry[master_i]->pt_entry[secondary_i] & TLBLO_VALID) != 0);
-	if ((as->pt_entry[master_i]->pt_entry[secondary_i] & TLBLO_VALID) == 0) {
-		vm_fault(0, userv);
-	}
-	paddr = as->pt_entry[master_i]->pt_entry[secondary_i];
-	paddr &= (PAGE_FRAME & ~(vaddr_t)SWAP_FRAME);
-
-	if (index != NULL) {
-		assert(paddr > firstpaddr_init);	
-		*index = (paddr - firstpaddr_init) / PAGE_SIZE;
-		assert(*index > 0);
-		assert(*index < ram_npages);
-	}
-	/* add offset */
-	paddr += (userv & ~(vaddr_t)PAGE_FRAME);
-
-	return PADDR_TO_KVADDR(paddr);
-}
-
-
 void init_heap_start(struct addrspace *as) {
 	/* find heap_start first if heap_start is not initialized */
 	int i;
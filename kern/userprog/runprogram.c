@@ -27,12 +27,8 @@ int stack_size(struct runprogram_info *prog_info) {
 	char **argv = prog_info->argv;
 	int argc = prog_info->argc;
 	for (i = 0; i < argc; i++) {
-		// add 1 for null terminated char
-		int x = (strlen(*(argv+i))+1)/4;
-		size += 4*x;
-		if ((strlen(*(argv+i))+1)%4 != 0) {
-			size += 4;
-		}
+		// add 1 for null terminated char, then word align
+		size += ROUNDUP(strlen(*(argv+i))+1, 4);
 	}
 	return size;
 }
@@ -41,86 +37,27 @@ int stack_size(struct runprogram_info *prog_info) {
  * build a stack in kernel
  * set up the contents in terms of user address
  * this is to be copied into user stack by copyout()
+ *
+ *	argv[0] ... argv[argc-1], NULL <-- ks_start (user stackptr)
+ *	string of argv[0], word aligned
+ *	...
+ *	string of argv[argc-1], word aligned
+ *
+ * the pointers and the strings are filled in the same pass.
+ * returns NULL if out of memory.
  */
 void *setup_args_mem(struct runprogram_info *prog_info, vaddr_t *usr_stack, size_t *len) {
-	unsigned int i;
-	unsigned long argc = prog_info->argc;
+	int i;
+	int argc = prog_info->argc;
 	char **argv = prog_info->argv;
-	/*
-	 * .
-	 * .
-	 * .
-	 * s
-	 * g
-	 * r
-	 * a
-	 * l
-	 * a
-	 * e
-	 * r
-	 * ---
-	 * ---
-	 * ---
-	 * *(argv+argc-1) -> translate to user stack
-	 * ........
-	 * ---
-	 * ---
-	 * ---
-	 * *(argv+1) -> translate to user stack
-	 * ---
-	 * ---
-	 * ---
-	 * *(argv+0) -> translate to user stack
-	 * ---
-	 * ---
-	 * ---
-	 * argc <-- ks_start
-	 */
-	// start addr of the user stack copy in kernel
-	*len = stack_size(prog_info);
-	int *ks_start = (int *)kmalloc(*len);
-	
-	unsigned long arg_offset[argc];
-	/*
-	 * offset in terms of num of words
-	 */
-	// arg[0] is always there, it stores the program name
-	arg_offset[0] = (unsigned int)argc + 1;
-	// offset of argv[i]: offset of argv[i-1] + len of argv[i-1]
-	for (i = 1; i < argc; i++) {
-		int len_arg = (strlen(*(argv+i-1))+1)/4;
-		if ((strlen(*(argv+i-1))+1)%4 != 0) {
-			len_arg ++ ;
-		}
-		arg_offset[i] = arg_offset[i-1] + len_arg;
-	}
+	char *ks_start;
+	vaddr_t *uargv;
+	size_t offset, arglen;
 
-	//int *ks = ks_start + 1;
-	
-	//*ks_start = argc;
-	
-	/*
-	 * setup the pointer address to point to the addr on the user stack
-	 */
-	// the stack size in terms of words
-	int s_size_w = (*len)/4;
-	for (i = 0; i < argc; i++) {
-		*(ks_start + i) = (arg_offset[i] - s_size_w) + (int *)(*usr_stack);
-	}
-	
-	*(ks_start + argc) = NULL;
-	
-	/*
-	 * set up the actual contents in argvs
-	 */
-	for (i = 0; i < argc; i++) {
-		char *argi = (char *)(arg_offset[i] + ks_start);
-		char **x = (char **)(argv+i);
-		int arglen = (strlen(*(argv+i))+1)/4;
-		if ((strlen(*(argv+i))+1)%4 != 0) {
-			arglen ++ ;
-		}
-		memmove((void *)argi, (void *)*x, 4*arglen);
+	*len = stack_size(prog_info);
+	ks_start = (char *)kmalloc(*len);
+	if (ks_start == NULL) {
+		return NULL;
 	}
 	/*
 	 * ks_start will passed to copyout
@@ -128,32 +65,40 @@ void *setup_args_mem(struct runprogram_info *prog_info, vaddr_t *usr_stack, size
 	 * basically they all point to the beginning of the stack
 	 * ks_stack is in kernel, usr_stack is in user as
 	 */
-	// *usr_stack is int, so offset it with respect to num of bytes (*len)
 	*usr_stack = *usr_stack - *len;
+
+	uargv = (vaddr_t *)ks_start;
+	offset = (argc + 1)*4;
+	for (i = 0; i < argc; i++) {
+		arglen = strlen(*(argv+i)) + 1;
+		uargv[i] = *usr_stack + offset;
+		memcpy(ks_start + offset, *(argv+i), arglen);
+		/* don't leak kernel memory through the alignment padding */
+		while (arglen % 4 != 0) {
+			*(ks_start + offset + arglen) = '\0';
+			arglen++;
+		}
+		offset += arglen;
+	}
+	uargv[argc] = 0;
 	return (void *)ks_start;
 }
 
 /*
- * Load program "progname" and start running it in usermode.
- * Does not return except on error.
+ * Load program "progname" into a fresh addrspace for curthread and
+ * copy its args onto the new user stack. The entry point and the user
+ * stackptr (which is also argv) come back in *entrypoint and *stackptr.
+ * prog_info itself is left to the caller.
  *
  * Calls vfs_open on progname and thus may destroy it.
  */
-// yes, it should never return, but how it is realized?
-// the last valid instruction is md_usermode
-
-/*
- * runprogram is run from menu, and its arguments 
- * are passed by thread_fork (a ptr & a int)
- * so we need to construct a struct to store progname and args
- */
 int
-runprogram(struct runprogram_info *prog_info)
+load_program(struct runprogram_info *prog_info, vaddr_t *entrypoint,
+	     vaddr_t *stackptr)
 {
 	char *progname = prog_info->progname;
 
 	struct vnode *v;
-	vaddr_t entrypoint, stackptr;
 	int result;
 
 	/* Open the file. */
@@ -191,7 +136,7 @@ runprogram(struct runprogram_info *prog_info)
 
 	/* Load the executable. */
 	// entrypoint is set by load_elf
-	result = load_elf(v, &entrypoint);
+	result = load_elf(v, entrypoint);
 	
 	// ===========================================
 	/*
@@ -213,38 +158,61 @@ runprogram(struct runprogram_info *prog_info)
 	vfs_close(v);
 
 	/* Define the user stack in the address space */
-	result = as_define_stack(curthread->t_vmspace, &stackptr);
+	result = as_define_stack(curthread->t_vmspace, stackptr);
 	if (result) {
 		/* thread_exit destroys curthread->t_vmspace */
 		return result;
 	}
 	// ============================================
 	size_t len;
-	void *ks_start = setup_args_mem(prog_info, &stackptr, &len);
-	int err = copyout(ks_start, stackptr, len);
+	void *ks_start = setup_args_mem(prog_info, stackptr, &len);
+	if (ks_start == NULL) {
+		return ENOMEM;
+	}
+	int err = copyout(ks_start, (userptr_t)*stackptr, len);
 	if (err != 0) {
 		panic("runprogram: copyout err!\n");
 	}
-	/*
-	int i;
-	for (i = 0; i < len/4; i++) {
-		//i in terms of word
-		//kfree will free 4 bytes at a time?
-		kfree((int *)((int *)ks_start+i));
-	}
-	*/
 	kfree(ks_start);
-	//kprintf("copyout result: %d\n", err);
-	// ============================================
+	return 0;
+}
+
+/*
+ * Load program "progname" and start running it in usermode.
+ * Does not return except on error.
+ *
+ * Calls vfs_open on progname and thus may destroy it.
+ */
+// yes, it should never return, but how it is realized?
+// the last valid instruction is md_usermode
+
+/*
+ * runprogram is run from menu, and its arguments 
+ * are passed by thread_fork (a ptr & a int)
+ * so we need to construct a struct to store progname and args
+ */
+int
+runprogram(struct runprogram_info *prog_info)
+{
+	vaddr_t entrypoint, stackptr;
+	int result;
+
+	result = load_program(prog_info, &entrypoint, &stackptr);
+	if (result) {
+		return result;
+	}
+
 	/* Warp to user mode. */
 	int nargc = prog_info->argc;
+	if (prog_info->kbuf != NULL) {
+		kfree(prog_info->kbuf);
+	}
 	kfree(prog_info);
 	//cmd_coremapstats(1, NULL);
-	md_usermode(nargc /*argc*/, stackptr /*userspace addr of argv*/,
+	md_usermode(nargc /*argc*/, (userptr_t)stackptr /*userspace addr of argv*/,
 		    stackptr, entrypoint);
 	
 	/* md_usermode does not return */
 	panic("md_usermode returned\n");
 	return EINVAL;
 }
-
@@ -15,8 +15,9 @@
 #include <vfs.h>
 #include <vnode.h>
 #include <uio.h>
+#include <synch.h>
 
-#define MAXARG 10
+#include <kern/limits.h>
 
 /*
  * FORK (trapframe is automatically passed in?):
@@ -62,7 +63,7 @@ int sys_fork(struct trapframe *tf, int32_t *retval) {
 			return as_err;
 		}
 		// tf
-		struct trapframe *child_tf = (struct trapframe *)kmalloc(sizeof(struct trapframe));
+		struct trapframe *child_tf = kmem_cache_alloc(trapframe_cache);
 		if (child_tf == NULL){
 			kprintf("**** sys_fork failure: out of mem\n");
 			*retval = -1;
@@ -72,9 +73,10 @@ int sys_fork(struct trapframe *tf, int32_t *retval) {
 		//tf_copy(child_tf, tf);
 		*child_tf = *tf;
 		// 
-		struct fork_parent_info *parent_info = (struct fork_parent_info *)kmalloc(sizeof(struct fork_parent_info));
+		struct fork_parent_info *parent_info = kmem_cache_alloc(forkinfo_cache);
 		if (parent_info == NULL) {
 			kprintf("**** sys_fork failure: out of mem\n");
+			kmem_cache_free(trapframe_cache, child_tf);
 			*retval = -1;
 			pid_occupied[new_pid] = 0;
 			return ENOMEM;
@@ -97,8 +99,8 @@ int sys_fork(struct trapframe *tf, int32_t *retval) {
 		} else {
 			//TODO: how to set retval?
 			*retval = -1;
-			kfree(child_tf);
-			kfree(parent_info);
+			kmem_cache_free(trapframe_cache, child_tf);
+			kmem_cache_free(forkinfo_cache, parent_info);
 			pid_occupied[new_pid] = 0;
 			return t_fork_err;
 		}
@@ -264,12 +266,12 @@ int sys__exit(struct trapframe *tf, int32_t *retval, int code) {
 	 */
 	while (p != NULL) {
 		if (pid_occupied[p->child_pid] == 1) {
-			struct trapframe *dummytf = (struct trapframe *)kmalloc(sizeof(struct trapframe));
+			struct trapframe *dummytf = kmem_cache_alloc(trapframe_cache);
 			int dummy;
 			if (sys_waitpid(p->child_pid, dummytf, &dummy) == 1) {
 				return 1;
 			}
-			kfree(dummytf);
+			kmem_cache_free(trapframe_cache, dummytf);
 		} // else: pid_occupiedp[p->child_pid] == 2 (zombie)
 		// update pid_occupied global list
 		pid_occupied[p->child_pid] = 0;
@@ -292,274 +294,238 @@ int sys__exit(struct trapframe *tf, int32_t *retval, int code) {
 	return 0;
 }
 /*
- * note: args is user mode addr
- * need to translate it and copy it to kernel
+ * note: prog and args are user mode addrs
+ *
+ * everything is staged in one ARG_MAX kernel buffer, so that it survives
+ * runprogram destroying the old addrspace:
+ *	progname and the arg strings are packed upward from the bottom
+ *	(each word aligned, so runprogram can copy them straight out),
+ *	the argv pointers grow downward from the top.
+ * copyin/copyinstr take care of faulting the user pages in, so there is
+ * no need to flush the tlb or pin frames in the coremap here.
+ *
+ * on success *ret owns the buffer (prog_info->kbuf); used by execv and spawn.
  */
-int sys_execv(char *prog, char *const *args, int32_t *retval) {
-	
-	struct runprogram_info *prog_info = (struct runprogram_info *)kmalloc(sizeof(struct runprogram_info));
-	if (prog_info == NULL) {
-		kprintf("**** execv: failed to alloc\n");
-		*retval = -1;
-		return ENOMEM;
+static
+int
+stage_args(char *prog, char *const *args, struct runprogram_info **ret)
+{
+	struct runprogram_info *prog_info;
+	char *kbuf;
+	char **kargv;
+	char *uarg;
+	size_t used, got, ptrbytes;
+	int argc, i, result;
+
+	if (prog == NULL || args == NULL) {
+		return EFAULT;
 	}
-	
-	int spl = splhigh();
 
-	vaddr_t kvaddr;
-	int index;
-
-	/*
-	 * flush tlb first: to avoid repeated entry after the vm_fault below
-	 */
-	int tlbi;
-	for (tlbi=0; tlbi<NUM_TLB; tlbi++) {
-		TLB_Write(TLBHI_INVALID(tlbi), TLBLO_INVALID(), tlbi);
+	prog_info = (struct runprogram_info *)kmalloc(sizeof(struct runprogram_info));
+	kbuf = (char *)kmalloc(ARG_MAX);
+	if (prog_info == NULL || kbuf == NULL) {
+		kprintf("**** stage_args: failed to alloc\n");
+		result = ENOMEM;
+		goto fail;
 	}
 
-	/* need to translate prog */
-	kvaddr = translate_args_vaddr((vaddr_t)prog, curthread->t_vmspace, &index);
-	if (kvaddr == 0) {
-		return 1;
+	result = copyinstr((const_userptr_t)prog, kbuf, PATH_MAX, &got);
+	if (result) {
+		goto fail;
 	}
-	int len = strlen((char *)kvaddr);
-	/* temp_fix the page so that the following kmalloc (or the context switch caused by it) will not evcit it */
-	int status = *(coremap_entry + index) % 10;
-	assert(status != PPAGE_K_FIXED);
-	*(coremap_entry + index) -= status;
-	*(coremap_entry + index) += PPAGE_TEMP_FIXED;
+	used = ROUNDUP(got, 4);
 
-	char *name = (char *)kmalloc(len+1);
+	/* arg i's pointer goes i slots down from the top; flipped once at the end */
+	kargv = (char **)(kbuf + ARG_MAX) - 1;
+	argc = 0;
+	while (1) {
+		/* keep room for this pointer and the terminating NULL */
+		ptrbytes = (argc + 2) * sizeof(char *);
+		if (used + ptrbytes > ARG_MAX) {
+			result = E2BIG;
+			goto fail;
+		}
+		result = copyin((const_userptr_t)(args + argc), &uarg, sizeof(uarg));
+		if (result) {
+			goto fail;
+		}
+		if (uarg == NULL) {
+			break;
+		}
+		result = copyinstr((const_userptr_t)uarg, kbuf + used,
+				   ARG_MAX - used - ptrbytes, &got);
+		if (result == ENAMETOOLONG) {
+			result = E2BIG;
+		}
+		if (result) {
+			goto fail;
+		}
+		*(kargv - argc) = kbuf + used;
+		used += ROUNDUP(got, 4);
+		argc++;
+	}
 
-	memmove((void *)name, (const void *)kvaddr, len);
-	*(name+len) = '\0';
+	/* flip the pointer slots into argv order and terminate the array */
+	kargv -= argc;
+	for (i = 0; i < argc/2; i++) {
+		char *tmp = kargv[1 + i];
+		kargv[1 + i] = kargv[argc - i];
+		kargv[argc - i] = tmp;
+	}
+	for (i = 0; i < argc; i++) {
+		kargv[i] = kargv[i + 1];
+	}
+	kargv[argc] = NULL;
 
-	*(coremap_entry + index) -= PPAGE_TEMP_FIXED;
-	*(coremap_entry + index) += status;
+	prog_info->progname = kbuf;
+	prog_info->argc = argc;
+	prog_info->argv = kargv;
+	prog_info->kbuf = kbuf;
+	*ret = prog_info;
+	return 0;
 
-	/* need to translate args */
-	kvaddr = translate_args_vaddr((vaddr_t)args, curthread->t_vmspace, NULL);
-	if (kvaddr == 0) {
-		return 1;
+fail:
+	if (kbuf != NULL) {
+		kfree(kbuf);
 	}
-	int count = 0;
-	char *temp[MAXARG];
-	vaddr_t argaddr[MAXARG];
-	/* load all arg addr first, in case the page is swapped out in the second loop */
-	while (1) {
-		// 4 is for word alignment
-		if (*((char **)(kvaddr + 4*count)) != NULL) {
-			/* here for simplicity, we assume all *arg are on the same page (which may be wrong strictly)*/
-			argaddr[count] = *((char **)(kvaddr + 4*count));
-			count++;
-		} else {
-			break;
-		}
+	if (prog_info != NULL) {
+		kfree(prog_info);
 	}
-	int i;
-	for (i=0; i<MAXARG; i++) {
-		if (i < count) {
-			int tlbi;
-			for (tlbi=0; tlbi<NUM_TLB; tlbi++) {
-				TLB_Write(TLBHI_INVALID(tlbi), TLBLO_INVALID(), tlbi);
-			}
-			kvaddr = translate_args_vaddr(argaddr[i], curthread->t_vmspace, &index);
-			if (kvaddr == 0) {
-				return 1;
-			}
+	return result;
+}
 
-			int len = strlen((char *)kvaddr);
+int sys_execv(char *prog, char *const *args, int32_t *retval) {
+	struct runprogram_info *prog_info;
+	int result;
 
-			/* temp_fix the page so that the following kmalloc (or the context switch caused by it) will not evcit it */
-			int status = *(coremap_entry + index) % 10;
-			*(coremap_entry + index) -= status;
-			*(coremap_entry + index) += PPAGE_TEMP_FIXED;
-			temp[i] = (char *)kmalloc(len+1);
+	*retval = -1;
+	result = stage_args(prog, args, &prog_info);
+	if (result) {
+		return result;
+	}
+	/* do the actual loading; runprogram frees prog_info and kbuf on success */
+	result = runprogram(prog_info);
 
-			memmove((void *)temp[i], (const void *)kvaddr, len);
-			*(temp[i] + len) = '\0';
+	kfree(prog_info->kbuf);
+	kfree(prog_info);
+	return result;
+}
 
-			*(coremap_entry + index) -= PPAGE_TEMP_FIXED;
-			*(coremap_entry + index) += status;
-		} else {
-			temp[i] = NULL;
-		}
+/*
+ * SPAWN:
+ *	1. stage prog and args in kernel (same as execv)
+ *	2. thread_fork -> spawn_child_setup, which runs load_program
+ *	   in a fresh as (the parent's as is never copied)
+ *	3. wait until the child reports whether the load worked,
+ *	   so that e.g. ENOENT comes back to the caller like execv
+ *	4. update child process list
+ */
+int sys_spawn(char *prog, char *const *args, int32_t *retval) {
+	struct runprogram_info *prog_info;
+	struct spawn_info *info;
+	struct thread *child;
+	pid_t new_pid;
+	int result;
+
+	*retval = -1;
+	result = stage_args(prog, args, &prog_info);
+	if (result) {
+		return result;
+	}
+
+	info = (struct spawn_info *)kmalloc(sizeof(struct spawn_info));
+	if (info == NULL) {
+		kprintf("**** sys_spawn failure: out of mem\n");
+		kfree(prog_info->kbuf);
+		kfree(prog_info);
+		return ENOMEM;
+	}
+	info->loaded = sem_create("spawn", 0);
+	if (info->loaded == NULL) {
+		kfree(info);
+		kfree(prog_info->kbuf);
+		kfree(prog_info);
+		return ENOMEM;
 	}
-	splx(spl);
 
-	prog_info->progname = name;
-	prog_info->argc = count;
-	prog_info->argv = &temp;
-	/* do the actual loading */
-	int result = runprogram(prog_info);
+	if ((new_pid = alloc_new_pid()) == -1) {
+		sem_destroy(info->loaded);
+		kfree(info);
+		kfree(prog_info->kbuf);
+		kfree(prog_info);
+		return EAGAIN;
+	}
+	info->prog_info = prog_info;
+	info->child_pid = new_pid;
+	info->child_ppid = curthread->process->pid;
+	info->result = 0;
 
+	/* prog_info belongs to the child from here on */
+	result = thread_fork("new process", (void*)info, 0, spawn_child_setup, &child);
 	if (result) {
+		sem_destroy(info->loaded);
+		kfree(info);
+		kfree(prog_info->kbuf);
 		kfree(prog_info);
-		for (i=0; i<MAXARG; i++) {
-			if (temp[i] != NULL) {
-				kfree(temp[i]);
-			}
-		}
+		pid_occupied[new_pid] = 0;
 		return result;
 	}
-	kfree(prog_info->progname);
-	kfree(prog_info);
-	for (i=0; i<MAXARG; i++) {
-		if (temp[i] != NULL) {
-			kfree(temp[i]);
-		}
+
+	P(info->loaded);
+	result = info->result;
+	sem_destroy(info->loaded);
+	kfree(info);
+	if (result) {
+		/* child has torn down its as and is exiting on its own */
+		pid_occupied[new_pid] = 0;
+		return result;
 	}
-	*retval = 0;
+
+	struct child_list *head = curthread->process->child_list;
+	add_child(&head, child, new_pid, curthread->process->pid);
+	curthread->process->child_list = head;
+	*retval = (int32_t)new_pid;
 	return 0;
 }
 /*
  * we need to support non-page-aligned malloc
+ *
+ * sbrk only moves heap_end: growing reserves the range purely virtually
+ * (vm_fault hands out a zero-filled page on first touch), shrinking
+ * frees the frames and swap slots of the pages that drop out right away.
  */
 int sys_sbrk(int size, int32_t *retval) {
 	struct addrspace *as = curthread->t_vmspace;
+	vaddr_t old_end, brk;
+
 	/* first init heap_start */
 	if (as->heap_start == 0) { 
 		init_heap_start(as);
 	} 
 	assert(as->heap_start != 0);
 
-	vaddr_t brk = as->heap_end + size;
-	
-	if (brk < as->heap_start) {
-		*retval = -1;
-		return EINVAL;
-	}
-		
-	int master1, secondary1;
-	int master2, secondary2;
-	if (size >= 0) {
-		if ((as->heap_end % PAGE_SIZE) == 0) {
-			get_pt_index(as, as->heap_end, &master1, &secondary1);
-		} else {
-			get_pt_index(as, as->heap_end+PAGE_SIZE, &master1, &secondary1);
-		}
-		if (brk % PAGE_SIZE == 0) {
-			get_pt_index(as, brk-PAGE_SIZE, &master2, &secondary2);
-		} else {
-			get_pt_index(as, brk, &master2, &secondary2);
-		}
-	} else {
-		if ((as->heap_end % PAGE_SIZE) == 0) {
-			get_pt_index(as, as->heap_end-PAGE_SIZE, &master1, &secondary1);
-		} else {
-			get_pt_index(as, as->heap_end, &master1, &secondary1);
-		}
-		if (brk % PAGE_SIZE == 0) {
-			get_pt_index(as, brk, &master2, &secondary2);
-		} else {
-			get_pt_index(as, brk+PAGE_SIZE, &master2, &secondary2);
-		}
-
-	}
-	
-	if ((brk - as->heap_end)/PAGE_SIZE >= 256) {
-	/* has to set a limit of max malloc size */
-		*retval = -1;
-		return EINVAL;
-	}
-
-	*retval = as->heap_end;
-	as->heap_end = brk;
-
-	/* update page table */
-	int i, k;
-	/* for positive size */
-	if (size >= 0) {
-		for (i=master1; i<=master2; i++) {
-			if (as->pt_entry[i] == NULL) {
-				as->pt_entry[i] = (struct secondary_pt *)kmalloc(sizeof(struct secondary_pt));
-				int j;
-				for (j=0; j<1024; j++) {
-					as->pt_entry[i]->pt_entry[j] = 0;
-				}
-			}
-			if (master1 == master2) {
-				for (k=secondary1; k<=secondary2; k++) {
-					as->pt_entry[i]->pt_entry[k] = TLBLO_DIRTY;
-				}
-			} else if (i == master1) {
-				for (k=secondary1; k<=1023; k++) {
-					as->pt_entry[i]->pt_entry[k] = TLBLO_DIRTY;
-				}
-			} else if (i == master2) {
-				for (k=0; k<=secondary2; k++) {
-					as->pt_entry[i]->pt_entry[k] = TLBLO_DIRTY;
-				}
-			} else {
-				for (k=0; k<=1023; k++) {
-					as->pt_entry[i]->pt_entry[k] = TLBLO_DIRTY;
-				}
-			}
+	old_end = as->heap_end;
+	brk = old_end + size;
 
+	if (size < 0) {
+		if (brk > old_end || brk < as->heap_start) {
+			*retval = -1;
+			return EINVAL;
 		}
 	} else {
-		/* for negative size */
-		for (i=master2; i<=master1; i++) {
-			assert(as->pt_entry[i] != NULL);
-			if (master1 == master2) {
-				for (k=secondary2; k<=secondary1; k++) {
-					as->pt_entry[i]->pt_entry[k] = 0;
-				}
-			} else if (i == master2) {
-				for (k=secondary2; k<=1023; k++) {
-					as->pt_entry[i]->pt_entry[k] = 0;
-				}
-			} else if (i == master1) {
-				for (k=0; k<=secondary1; k++) {
-					as->pt_entry[i]->pt_entry[k] = 0;
-				}
-			} else {
-				for (k=0; k<=1023; k++) {
-					as->pt_entry[i]->pt_entry[k] = 0;
-				}
-			}
-
+		/* don't wrap around or run into the stack */
+		if (brk < old_end || brk > USERSTACK - MAXSTACK*PAGE_SIZE) {
+			*retval = -1;
+			return ENOMEM;
 		}
 	}
 
-	return 0;
-	/*
-
-	int num_secondary_pt;
-	if (num_page%1024 == 0) {
-		num_secondary_pt = num_page / 1024;
-	} else {
-		num_secondary_pt = num_page / 1024 + 1;
-	}
+	*retval = old_end;
+	as->heap_end = brk;
 
-	int i;
-	for (i=0; i<num_secondary_pt; i++) {
-		if (as->pt_entry[master_i + i] == NULL) {
-			as->pt_entry[master_i + i] = (struct secondary_pt *)kmalloc(sizeof(struct secondary_pt));
-			int k;
-			int range;
-			if (i<num_secondary_pt-1) {
-				range = 1024;
-			} else {
-				range = num_page - 1024*i;
-			}
-			for (k=0; k<range; k++) {
-				// page base of 0x000ff000 is a special num to tell vm_fault that this is valid page
-				as->pt_entry[master_i + i]->pt_entry[k] = (TLBLO_DIRTY | (PAGE_FRAME & ~(vaddr_t)SWAP_FRAME));
-			}
-		} else {
-			// this assertion is only because the find_block algorithm we choose 
-			assert(i == 0);
-			int k;
-			for (k=secondary_i; k<secondary_i+num_page-1; k++) {
-				// page base of 0x000ff000 is a special num to tell vm_fault that this is valid page 
-				as->pt_entry[master_i + i]->pt_entry[k] = (TLBLO_DIRTY | (PAGE_FRAME & ~(vaddr_t)SWAP_FRAME));
-			}
-		}
+	if (size < 0) {
+		as_release_pages(as, ROUNDUP(brk, PAGE_SIZE),
+				 ROUNDUP(old_end, PAGE_SIZE));
 	}
-	// set up retval 
-	*retval = master_i*4194304 + secondary_i*4096;
 	return 0;
-	*/
 }
-
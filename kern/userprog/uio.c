@@ -57,11 +57,12 @@ uiomove(void *ptr, size_t n, struct uio *uio)
 			    break;
 		    case UIO_USERSPACE:	// don't have the priority to move ?
 		    case UIO_USERISPACE:
+			    /* no TLB miss per page: see copybulk */
 			    if (uio->uio_rw == UIO_READ) {
-				    result = copyout(ptr, iov->iov_ubase,size);
+				    result = copyout_bulk(ptr, iov->iov_ubase,size);
 			    }
 			    else {
-				    result = copyin(iov->iov_ubase, ptr, size);
+				    result = copyin_bulk(iov->iov_ubase, ptr, size);
 			    }
 			    if (result) {
 				    return result;
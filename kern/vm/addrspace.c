@@ -15,6 +15,7 @@
 #include <vnode.h>
 #include <kern/unistd.h>
 #include <kern/stat.h>
+#include <bitmap.h>
 #include "opt-dumbvm.h"
 
 /* coremap debug */
@@ -24,25 +25,67 @@
  * now we temporarily use the as functions written in dumbvm.c
  */
 
+/*
+ * addrspaces and secondary page tables come from their own caches.
+ * free ones are kept constructed: an addrspace with its filelock and
+ * no secondary PTs, a secondary PT all zero. as_destroy puts them
+ * back that way.
+ */
+static struct kmem_cache *as_cache;
+static struct kmem_cache *pt_cache;
+
+static
+int
+as_ctor(void *obj)
+{
+	struct addrspace *as = obj;
+	int i;
+
+	as->filelock = lock_create("as_filelock");
+	if (as->filelock == NULL) {
+		return ENOMEM;
+	}
+	for (i = 0; i < 512; i++) {
+		as->pt_entry[i] = NULL;
+	}
+	return 0;
+}
+
+static
+int
+pt_ctor(void *obj)
+{
+	bzero(obj, sizeof(struct secondary_pt));
+	return 0;
+}
+
+void
+as_bootstrap(void)
+{
+	/*
+	 * no destructor for as_cache: as in as_destroy, the filelock
+	 * may still be held by eviction() when the as goes away.
+	 */
+	as_cache = kmem_cache_create("addrspace", sizeof(struct addrspace),
+				     as_ctor, NULL);
+	pt_cache = kmem_cache_create("secondary_pt", sizeof(struct secondary_pt),
+				     pt_ctor, NULL);
+	if (as_cache == NULL || pt_cache == NULL) {
+		panic("as_bootstrap: cannot create caches\n");
+	}
+}
+
 struct addrspace *
 as_create(void)
 {
-	struct addrspace *as = kmalloc(sizeof(struct addrspace));
+	struct addrspace *as = kmem_cache_alloc(as_cache);
 	if (as==NULL) {
 		/*
 		 * eviction is dealt with within kmalloc
 		 */
 		return NULL;
 	}
-	as->filelock = lock_create("as_filelock");
-	if (as->filelock == NULL) {
-		kfree(as);
-		return NULL;
-	}
-	int i;
-	for (i = 0; i < 512; i++) {
-		as->pt_entry[i] = NULL;
-	}
+	/* filelock and pt_entry[] are set up by as_ctor */
 	as->child = NULL;
 
 	as->heap_start = 0;
@@ -59,11 +102,19 @@ as_create(void)
 	
 	splx(spl);
 
+	as->swapmap = bitmap_create(SWAP_NSLOTS);
+	if (as->swapmap == NULL) {
+		kmem_cache_free(as_cache, as);
+		return NULL;
+	}
+
 	struct vnode *v;
 	int result = vfs_open(swapname, O_RDWR | O_CREAT | O_TRUNC, &v);
 	if (result) {
 		kprintf("**** as: swap file create failure, err: %d\n", result);
-		vfs_close(v);
+		/* v was never set; there's nothing to close */
+		bitmap_destroy(as->swapmap);
+		kmem_cache_free(as_cache, as);
 		return NULL;
 	}
 	vfs_close(v);
@@ -87,8 +138,11 @@ as_destroy(struct addrspace *as)
 					assert(paddr < 0x80000000);
 					kfree(PADDR_TO_KVADDR(paddr));
 				}
+				/* back to the state pt_ctor left it in */
+				as->pt_entry[i]->pt_entry[k] = 0;
 			}
-			kfree(as->pt_entry[i]);
+			kmem_cache_free(pt_cache, as->pt_entry[i]);
+			as->pt_entry[i] = NULL;
 		}
 	}
 	/* 
@@ -96,12 +150,14 @@ as_destroy(struct addrspace *as)
 	 * maybe no need: cuz as_create will open this as O_TRUNC
 	 */
 	// you cannot free this lock, cuz someone might be holding it (or waiting on it) in eviction()
+	// it stays with the as in as_cache, and is used again by the next as_create
 	/*
 	if (as->filelock->held == 0) {
 		kfree(as->filelock);
 	}
 	*/
-	kfree(as);
+	bitmap_destroy(as->swapmap);
+	kmem_cache_free(as_cache, as);
 	splx(spl);
 }
 
@@ -156,7 +212,7 @@ as_prepare_load(struct addrspace *as, vaddr_t vaddr, size_t sz,
 	/* this allocation will occupy only one master page table entry */
 		if (as->pt_entry[master_i] == NULL) {
 		/* you don't have the secondary page table yet */
-			as->pt_entry[master_i] = (struct secondary_pt *)kmalloc(sizeof(struct secondary_pt));
+			as->pt_entry[master_i] = kmem_cache_alloc(pt_cache);
 			if (as->pt_entry[master_i] == NULL) {
 				/*
 				 * eviction is dealt with within kmalloc
@@ -166,17 +222,13 @@ as_prepare_load(struct addrspace *as, vaddr_t vaddr, size_t sz,
 #endif
 				return ENOMEM;
 			}
-			int i;
-			for (i = 0; i < 1024; i++) {
-				as->pt_entry[master_i]->pt_entry[i] = 0;
-			}
 		} else {
 		/* the secondary page table is already there */
 		}
 	} else {
 	/* this allocation will occupy 2 master page table entries */
 		if (as->pt_entry[master_i] == NULL) {
-			as->pt_entry[master_i] = (struct secondary_pt *)kmalloc(sizeof(struct secondary_pt));
+			as->pt_entry[master_i] = kmem_cache_alloc(pt_cache);
 			if (as->pt_entry[master_i] == NULL) {
 				/*
 				 * eviction is dealt with within kmalloc
@@ -186,14 +238,10 @@ as_prepare_load(struct addrspace *as, vaddr_t vaddr, size_t sz,
 #endif
 				return ENOMEM;
 			}
-			int i;
-			for (i = 0; i < 1024; i++) {
-				as->pt_entry[master_i]->pt_entry[i] = 0;
-			}
 
 		}
 		if (as->pt_entry[master_i+1] == NULL) {
-			as->pt_entry[master_i+1] = (struct secondary_pt *)kmalloc(sizeof(struct secondary_pt));
+			as->pt_entry[master_i+1] = kmem_cache_alloc(pt_cache);
 			if (as->pt_entry[master_i+1] == NULL) {
 				/*
 				 * eviction is dealt with within kmalloc
@@ -203,10 +251,6 @@ as_prepare_load(struct addrspace *as, vaddr_t vaddr, size_t sz,
 #endif
 				return ENOMEM;
 			}
-			int i;
-			for (i = 0; i < 1024; i++) {
-				as->pt_entry[master_i+1]->pt_entry[i] = 0;
-			}
 		}
 	}
 		
@@ -225,9 +269,9 @@ as_prepare_load(struct addrspace *as, vaddr_t vaddr, size_t sz,
 			// it is called by vm_fault, so actually get page
 				assert(npages == 1);
 				/*
-				 * eviction is dealt with within as_getppages_status
+				 * eviction is dealt with within as_getppages_zeroed
 				 */
-				paddr_t pbase = as_getppages_status(1, status, as);
+				paddr_t pbase = as_getppages_zeroed(status, as);
 				as->pt_entry[master_i]->pt_entry[secondary_i + i] |= pbase;
 				*(cmap_pte_entry + (pbase - firstpaddr_init)/PAGE_SIZE) = &(as->pt_entry[master_i]->pt_entry[secondary_i + i]);
 				if (as->pt_entry[master_i]->pt_entry[secondary_i + i] == 0){
@@ -266,9 +310,9 @@ as_prepare_load(struct addrspace *as, vaddr_t vaddr, size_t sz,
 			//assert((paddr & PAGE_FRAME & ~(vaddr_t)SWAP_FRAME) == paddr);
 			if (mode == GETPAGE) {
 				/*
-				 * eviction is dealt with within as_getppages_status
+				 * eviction is dealt with within as_getppages_zeroed
 				 */
-				paddr_t pbase = as_getppages_status(1, status, as);
+				paddr_t pbase = as_getppages_zeroed(status, as);
 				as->pt_entry[master_i]->pt_entry[i] |= pbase;
 				*(cmap_pte_entry + (pbase - firstpaddr_init)/PAGE_SIZE) = &(as->pt_entry[master_i]->pt_entry[i]);
 				assert(npages == 1);
@@ -297,9 +341,9 @@ as_prepare_load(struct addrspace *as, vaddr_t vaddr, size_t sz,
 			assert((as->pt_entry[master_i+1]->pt_entry[i] & TLBLO_VALID) == 0);
 			if (mode == GETPAGE) {
 				/*
-				 * eviction is dealt with within as_getppages_status
+				 * eviction is dealt with within as_getppages_zeroed
 				 */
-				paddr_t pbase = as_getppages_status(1, status, as);
+				paddr_t pbase = as_getppages_zeroed(status, as);
 				as->pt_entry[master_i+1]->pt_entry[i] |= pbase;
 				*(cmap_pte_entry + (pbase - firstpaddr_init)/PAGE_SIZE) = &(as->pt_entry[master_i+1]->pt_entry[i]);
 				assert(npages == 1);
@@ -358,6 +402,60 @@ as_complete_load(struct addrspace *as, int status, int master_i, int secondary_i
 	return 0;
 }
 
+/*
+ * drop the pages in [start, end) (both page aligned):
+ * resident frames go back to the coremap, swap slots go back to
+ * as->swapmap, and the PTEs are cleared so a later touch faults
+ * like an unmapped address.
+ */
+void
+as_release_pages(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+	int spl = splhigh();
+	int master_i, secondary_i;
+	int tlbi;
+	paddr_t pte, paddr;
+	vaddr_t vaddr;
+
+	assert(start % PAGE_SIZE == 0);
+	assert(end % PAGE_SIZE == 0);
+
+	for (vaddr = start; vaddr < end; vaddr += PAGE_SIZE) {
+		get_pt_index(as, vaddr, &master_i, &secondary_i);
+		if (as->pt_entry[master_i] == NULL) {
+			/* skip the rest of this secondary PT */
+			vaddr |= ~(vaddr_t)PT_MASTER & PAGE_FRAME;
+			continue;
+		}
+		/* wait for an eviction still writing this page out */
+		while (as->pt_entry[master_i]->pt_entry[secondary_i] & PTE_LOCK) {
+			thread_yield();
+		}
+		pte = as->pt_entry[master_i]->pt_entry[secondary_i];
+		if (pte == 0) {
+			continue;
+		}
+		as->pt_entry[master_i]->pt_entry[secondary_i] = 0;
+
+		if (pte & TLBLO_VALID) {
+			if (curthread->t_vmspace == as) {
+				tlbi = TLB_Probe(vaddr, 0);
+				if (tlbi >= 0) {
+					TLB_Write(TLBHI_INVALID(tlbi), TLBLO_INVALID(), tlbi);
+				}
+			}
+			paddr = pte & PAGE_FRAME & ~(vaddr_t)SWAP_FRAME;
+			assert(paddr < 0x80000000);
+			kfree((void *)PADDR_TO_KVADDR(paddr));
+		}
+		if (pte & SWAP_FRAME) {
+			bitmap_unmark(as->swapmap, (pte & SWAP_FRAME)/1048576 - 1);
+		}
+	}
+
+	splx(spl);
+}
+
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
@@ -393,6 +491,9 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	 */
 	int oldoffset;	
 
+	new->heap_start = old->heap_start;
+	new->heap_end = old->heap_end;
+
 	int i = 0;
 	int k = 0;
 	for (i = 0; i < 512; i++) {
@@ -400,7 +501,7 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 			new->pt_entry[i] = NULL;
 			continue;
 		} 
-		new->pt_entry[i] = (struct secondary_pt *)kmalloc(sizeof(struct secondary_pt));
+		new->pt_entry[i] = kmem_cache_alloc(pt_cache);
 		if (new->pt_entry[i] == NULL) {
 			/*
 			 * eviction is dealt with within kmalloc
@@ -413,11 +514,7 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 
 			return ENOMEM;
 		}
-		int init;
-		/* initialize */
-		for (init = 0; init < 1024; init ++) {
-			new->pt_entry[i]->pt_entry[init] = 0;
-		}
+		/* pt_ctor has zeroed it */
 		for (k = 0; k < 1024; k++) {
 			/* case 1, vop_write from swap file */
 			if (((old->pt_entry[i]->pt_entry[k] & TLBLO_VALID) == 0) &&
@@ -521,9 +618,8 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 		
 					paddr_t old_paddr = old->pt_entry[i]->pt_entry[k] & PAGE_FRAME & ~(vaddr_t)SWAP_FRAME;
 					paddr_t new_paddr = new->pt_entry[i]->pt_entry[k] & PAGE_FRAME & ~(vaddr_t)SWAP_FRAME;
-					memmove((void *)PADDR_TO_KVADDR(new_paddr),
-						(const void *)PADDR_TO_KVADDR(old_paddr),
-						PAGE_SIZE);
+					memcpy_page((void *)PADDR_TO_KVADDR(new_paddr),
+						    (const void *)PADDR_TO_KVADDR(old_paddr));
 					new->pt_entry[i]->pt_entry[k] |= (old->pt_entry[i]->pt_entry[k] & ~(vaddr_t)PAGE_FRAME);
 					new->pt_entry[i]->pt_entry[k] |= TLBLO_VALID;
 					new->pt_entry[i]->pt_entry[k] |= TLBLO_DIRTY;
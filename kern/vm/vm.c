@@ -23,7 +23,6 @@
 
 #define DUMBVM 0
 #define DIRTY 1
-#define MAXSTACK 64
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -43,6 +42,7 @@ vm_bootstrap(void)
 	//tlb_lock = lock_create("tlb lock");
 	//load_evict_lock = lock_create("load_evict_lock");
 	swapfilecount = 0;
+	as_bootstrap();
 }
 
 paddr_t
@@ -58,9 +58,12 @@ getppages_status(unsigned long npages, int status)
 	 */
 	addr = ram_allocmem(npages, status);
 
-	int i = (addr - firstpaddr_init)/PAGE_SIZE;
-	assert(i >= 0);
-	assert((size_t)i < ram_npages);	
+	/* 0 means no contiguous run could be found; the caller copes */
+	if (addr != 0) {
+		int i = (addr - firstpaddr_init)/PAGE_SIZE;
+		assert(i >= 0);
+		assert((size_t)i < ram_npages);
+	}
 	
 	splx(spl);
 	return addr;
@@ -85,6 +88,17 @@ as_getppages_status(unsigned long npages, int status, struct addrspace *as)
 	return addr;
 }
 
+paddr_t
+as_getppages_zeroed(int status, struct addrspace *as)
+{
+	int spl;
+	paddr_t addr;
+
+	spl = splhigh();
+	addr = as_ram_allocmem_zeroed(status, as);
+	splx(spl);
+	return addr;
+}
 
 paddr_t
 getppages(unsigned long npages) {
@@ -116,6 +130,10 @@ vaddr_t
 alloc_kpages(int npages)
 {
 	paddr_t pa;
+	/* the coremap can't record a longer block */
+	if (npages > KPAGES_MAXCONTIG) {
+		return 0;
+	}
 	/* kernel pages are always fixed */
 	pa = getppages_status(npages, PPAGE_K_FIXED);
 	if (pa==0) {
@@ -180,11 +198,205 @@ free_kpages(vaddr_t addr)
 		}
 		*(cmap_as_entry+page_num+i) = NULL;
 		*(cmap_pte_entry+page_num+i) = NULL;
+		assert(*(cmap_pageref_entry+page_num+i) == NULL);
+	}
+
+	splx(spl);
+}
+
+/*
+ * Copy or zero one whole page. The addresses are page aligned, so
+ * unlike memcpy and bzero these need no alignment or length checks,
+ * and go eight words per loop iteration.
+ */
+void
+memcpy_page(void *dst, const void *src)
+{
+	u_int32_t *d = dst;
+	const u_int32_t *s = src;
+	u_int32_t *end = d + PAGE_SIZE/sizeof(u_int32_t);
+	u_int32_t w0, w1, w2, w3, w4, w5, w6, w7;
+
+	assert((vaddr_t)dst % PAGE_SIZE == 0);
+	assert((vaddr_t)src % PAGE_SIZE == 0);
+
+	while (d < end) {
+		w0 = s[0];
+		w1 = s[1];
+		w2 = s[2];
+		w3 = s[3];
+		w4 = s[4];
+		w5 = s[5];
+		w6 = s[6];
+		w7 = s[7];
+		d[0] = w0;
+		d[1] = w1;
+		d[2] = w2;
+		d[3] = w3;
+		d[4] = w4;
+		d[5] = w5;
+		d[6] = w6;
+		d[7] = w7;
+		d += 8;
+		s += 8;
+	}
+}
+
+void
+bzero_page(void *page)
+{
+	u_int32_t *p = page;
+	u_int32_t *end = p + PAGE_SIZE/sizeof(u_int32_t);
+
+	assert((vaddr_t)page % PAGE_SIZE == 0);
+
+	while (p < end) {
+		p[0] = 0;
+		p[1] = 0;
+		p[2] = 0;
+		p[3] = 0;
+		p[4] = 0;
+		p[5] = 0;
+		p[6] = 0;
+		p[7] = 0;
+		p += 8;
+	}
+}
+
+/*
+ * Kernel page table for kseg2.
+ *
+ * Multi-page kernel allocations normally live in kseg0, which needs
+ * physically contiguous frames. Once memory is fragmented there may be
+ * no such run, and ram_allocmem can't evict one into existence, so
+ * kmalloc falls back to alloc_kpages_mapped: it takes the frames one
+ * at a time (evicting user pages like any single-page allocation) and
+ * maps them at consecutive kseg2 addresses. TLB misses there come to
+ * vm_fault, which loads the entry from kseg2_pt.
+ *
+ * Entry i maps MIPS_KSEG2 + i*PAGE_SIZE and is kept ready to load into
+ * the TLB (frame | TLBLO_VALID | TLBLO_DIRTY). KSEG2_LAST marks the last
+ * page of an allocation, so free_kpages_mapped knows where to stop, and
+ * KSEG2_RESERVED holds a slot while its frame is being found - that can
+ * sleep on eviction I/O.
+ *
+ * Nothing that the exception path itself touches may live here: a
+ * kernel stack in kseg2 would fault while saving the trapframe. Thread
+ * stacks are a single page, which kmalloc never maps.
+ */
+#define KSEG2_LAST     0x001
+#define KSEG2_RESERVED 0x002
+
+static u_int32_t kseg2_pt[KSEG2_NPAGES];
+
+/*
+ * Unmap one kseg2 page and drop any TLB entry for it.
+ */
+static
+void
+kseg2_unmap(int i)
+{
+	vaddr_t vaddr = MIPS_KSEG2 + i*PAGE_SIZE;
+	int tlbi;
+
+	assert(curspl > 0);
+	tlbi = TLB_Probe(vaddr, 0);
+	if (tlbi >= 0) {
+		TLB_Write(TLBHI_INVALID(tlbi), TLBLO_INVALID(), tlbi);
+	}
+	if (kseg2_pt[i] & TLBLO_VALID) {
+		free_kpages(PADDR_TO_KVADDR(kseg2_pt[i] & PAGE_FRAME));
+	}
+	kseg2_pt[i] = 0;
+}
+
+vaddr_t
+alloc_kpages_mapped(int npages)
+{
+	int spl = splhigh();
+	int start, i, count;
+	paddr_t pa;
+
+	/* first fit over the free slots */
+	count = 0;
+	for (start = 0; start < KSEG2_NPAGES; start++) {
+		if (kseg2_pt[start] != 0) {
+			count = 0;
+			continue;
+		}
+		if (++count == npages) {
+			break;
+		}
+	}
+	if (npages <= 0 || start == KSEG2_NPAGES) {
+		splx(spl);
+		return 0;
+	}
+	start -= npages - 1;
+
+	for (i = start; i < start + npages; i++) {
+		kseg2_pt[i] = KSEG2_RESERVED;
 	}
+	kseg2_pt[start + npages - 1] |= KSEG2_LAST;
+
+	for (i = start; i < start + npages; i++) {
+		pa = getppages_status(1, PPAGE_K_FIXED);
+		if (pa == 0) {
+			for (i = start; i < start + npages; i++) {
+				kseg2_unmap(i);
+			}
+			splx(spl);
+			return 0;
+		}
+		kseg2_pt[i] = (kseg2_pt[i] & KSEG2_LAST) | pa
+			| TLBLO_VALID | TLBLO_DIRTY;
+	}
+
+	splx(spl);
+	return MIPS_KSEG2 + start*PAGE_SIZE;
+}
+
+void
+free_kpages_mapped(vaddr_t addr)
+{
+	int spl = splhigh();
+	int i, last;
+
+	assert(addr >= MIPS_KSEG2 && addr%PAGE_SIZE == 0);
+	i = (addr - MIPS_KSEG2)/PAGE_SIZE;
+	assert(i < KSEG2_NPAGES);
+	assert(i == 0 || kseg2_pt[i-1] == 0 || (kseg2_pt[i-1] & KSEG2_LAST));
+
+	do {
+		assert(kseg2_pt[i] & TLBLO_VALID);
+		last = kseg2_pt[i] & KSEG2_LAST;
+		kseg2_unmap(i);
+		i++;
+	} while (!last);
 
 	splx(spl);
 }
 
+/*
+ * TLB miss on a kseg2 address.
+ */
+static
+int
+kseg2_fault(vaddr_t faultaddress)
+{
+	int spl = splhigh();
+	int i = (faultaddress - MIPS_KSEG2)/PAGE_SIZE;
+
+	if (i >= KSEG2_NPAGES || (kseg2_pt[i] & TLBLO_VALID) == 0) {
+		splx(spl);
+		return EFAULT;
+	}
+	TLB_Random(faultaddress & PAGE_FRAME,
+		   kseg2_pt[i] & (TLBLO_PPAGE | TLBLO_VALID | TLBLO_DIRTY));
+	splx(spl);
+	return 0;
+}
+
 /*
  * get the index for master & secondary page table
  * return: both index
@@ -203,6 +415,71 @@ void get_pt_index(struct addrspace *as, vaddr_t vaddr, int *master_i, int *secon
 }
 
 
+/*
+ * Make the page holding user address VA of the current address space
+ * resident, faulting it in if need be, and pin it (TEMP_FIXED) so the
+ * kernel can copy through its kseg0 address without taking faults and
+ * without it being evicted underneath. Returns that address in *KVA
+ * and the coremap status to hand back to vm_unpin_user in *OLDSTATUS.
+ * FAULTTYPE is VM_FAULT_WRITE if the kernel is going to write the
+ * page, which then counts as dirty.
+ */
+int
+vm_pin_user(vaddr_t va, int faulttype, vaddr_t *kva, int *oldstatus)
+{
+	struct addrspace *as = curthread->t_vmspace;
+	int master_i, secondary_i, result;
+	paddr_t *pte, pbase;
+	size_t index;
+
+	assert(curspl > 0);
+	assert(va < USERTOP);
+
+	get_pt_index(as, va, &master_i, &secondary_i);
+	if (as->pt_entry[master_i] == NULL ||
+	    (as->pt_entry[master_i]->pt_entry[secondary_i] & TLBLO_VALID) == 0) {
+		/* we're at splhigh, so it's still there when this returns */
+		result = vm_fault(faulttype, va);
+		if (result) {
+			return result;
+		}
+	}
+	pte = &as->pt_entry[master_i]->pt_entry[secondary_i];
+	assert(*pte & TLBLO_VALID);
+	if (faulttype == VM_FAULT_WRITE) {
+		*pte |= TLBLO_DIRTY;
+	}
+
+	pbase = *pte & PAGE_FRAME & ~(vaddr_t)SWAP_FRAME;
+	index = (pbase - firstpaddr_init) / PAGE_SIZE;
+
+	/* load_elf copies into pages it already holds TEMP_FIXED */
+	*oldstatus = *(coremap_entry + index) % 10;
+	if (*oldstatus != PPAGE_TEMP_FIXED) {
+		*(coremap_entry + index) += PPAGE_TEMP_FIXED - *oldstatus;
+	}
+	if (*(coremap_entry + index)/100 == 0) {
+		*(coremap_entry + index) += PPAGE_REFERENCED;
+	}
+
+	*kva = PADDR_TO_KVADDR(pbase) + (va & ~(vaddr_t)PAGE_FRAME);
+	return 0;
+}
+
+void
+vm_unpin_user(vaddr_t kva, int oldstatus)
+{
+	size_t index;
+
+	assert(curspl > 0);
+
+	index = (KVADDR_TO_PADDR(kva & PAGE_FRAME) - firstpaddr_init) / PAGE_SIZE;
+	assert(*(coremap_entry + index) % 10 == PPAGE_TEMP_FIXED);
+	if (oldstatus != PPAGE_TEMP_FIXED) {
+		*(coremap_entry + index) += oldstatus - PPAGE_TEMP_FIXED;
+	}
+}
+
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
@@ -210,6 +487,12 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 
 	DEBUG(DB_VM, "normalvm: fault: 0x%x\n", faultaddress);
 
+	if (faultaddress >= MIPS_KSEG2) {
+		/* kernel mapped pages are always writable */
+		splx(spl);
+		return kseg2_fault(faultaddress);
+	}
+
 	if (faultaddress == 0) {
 	// fault on null
 		splx(spl);
@@ -338,10 +621,9 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 				valid_prepare_load = 1;
 			} else if ((as->pt_entry[master_i] != NULL) && (as->pt_entry[master_i]->pt_entry[secondary_i] != 0)) { 
 				valid_prepare_load = 1;
-			} else if ((as->pt_entry[master_i] != NULL) &&
-				   (faultaddress >= as->heap_start) &&
-				   (faultaddress <= as->heap_end)){
-				/* this is malloced */
+			} else if ((faultaddress >= as->heap_start) &&
+				   (faultaddress < as->heap_end)){
+				/* this is malloced: sbrk only reserves the range, the page comes now */
 				valid_prepare_load = 1;
 			} else {
 				valid_prepare_load = 0;
@@ -354,6 +636,10 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 					splx(spl);
 					return ENOMEM;
 				}
+				/*
+				 * the page comes zero-filled (GETPAGE), so no
+				 * stale data leaks to user
+				 */
 				//TODO: you cannot call as_complete_load here if this vm_fault is called by load_elf.
 				//otherwise, this page can be evicted in the middle of load_elf
 				as_complete_load(as, PPAGE_OCCUPIED, master_i, secondary_i);
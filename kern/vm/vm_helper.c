@@ -4,6 +4,7 @@
 #include <uio.h>
 #include <kern/stat.h>
 #include <kern/unistd.h>
+#include <bitmap.h>
 #include <curthread.h>
 #include <machine/tlb.h>
 #include <db-helper.h>
@@ -195,10 +196,16 @@ paddr_t eviction(int victim, int status, struct addrspace *as) {
 						// offset should be the starting pos of write
 						offset -= PAGE_SIZE;
 					} else {
-						// append to file
-						offset = p->swapfilesize;
-						p->swapfilesize += PAGE_SIZE;
-						p->pt_entry[i]->pt_entry[k] |= (offset/PAGE_SIZE + 1)*1048576;
+						// take a free slot (slots freed by sbrk are reused)
+						u_int32_t slot;
+						if (bitmap_alloc(p->swapmap, &slot)) {
+							panic("eviction: out of swap slots\n");
+						}
+						offset = slot * PAGE_SIZE;
+						if (offset + PAGE_SIZE > (int)p->swapfilesize) {
+							p->swapfilesize = offset + PAGE_SIZE;
+						}
+						p->pt_entry[i]->pt_entry[k] |= (slot + 1)*1048576;
 					}	
 
 					snprintf(swapname, 15, "SW%lu", p->swapfilecount);
@@ -230,6 +237,8 @@ paddr_t eviction(int victim, int status, struct addrspace *as) {
 					result = vfs_open(swapname, O_RDWR, &v);
 					if (result) {
 						kprintf("**** swap file open failure, err: %d\n", result);
+						/* or the owner hangs in swapin on this page */
+						p->pt_entry[i]->pt_entry[k] &= ~(vaddr_t)PTE_LOCK;
 						return 0;
 					}
 					mk_kuio(&swap_ku, (void *)vbase, PAGE_SIZE, offset, UIO_WRITE);
@@ -244,6 +253,8 @@ paddr_t eviction(int victim, int status, struct addrspace *as) {
 						result = VOP_WRITE(v, &swap_ku);
 						if (result) {
 							kprintf("********* vop write failure, err: %d\n", result);
+							p->pt_entry[i]->pt_entry[k] &= ~(vaddr_t)PTE_LOCK;
+							vfs_close(v);
 							return 0;
 						}
                         // clear PTE_LOCK
@@ -17,39 +17,61 @@
 void *
 memcpy(void *dst, const void *src, size_t len)
 {
-	size_t i;
+	char *d = dst;
+	const char *s = src;
 
 	/*
 	 * memcpy does not support overlapping buffers, so always do it
 	 * forwards. (Don't change this without adjusting memmove.)
 	 *
-	 * For speedy copying, optimize the common case where both pointers
-	 * and the length are word-aligned, and copy word-at-a-time instead
-	 * of byte-at-a-time. Otherwise, copy by bytes.
+	 * For speedy copying: if the two pointers are equally far off
+	 * a word boundary, copy bytes up to the boundary, then words,
+	 * four at a time while there's room, then the leftover bytes.
+	 * The four loads are done before the four stores so none of
+	 * them waits on the one before. If the pointers can never both
+	 * be aligned, copy by bytes.
 	 *
 	 * The alignment logic below should be portable. We rely on
 	 * the compiler to be reasonably intelligent about optimizing
 	 * the divides and modulos out. Fortunately, it is.
 	 */
 
-	if ((uintptr_t)dst % sizeof(long) == 0 &&
-	    (uintptr_t)src % sizeof(long) == 0 &&
-	    len % sizeof(long) == 0) {
+	if (((uintptr_t)d ^ (uintptr_t)s) % sizeof(long) == 0) {
+		long *ld;
+		const long *ls;
+		long w0, w1, w2, w3;
 
-		long *d = dst;
-		const long *s = src;
+		while (len > 0 && (uintptr_t)d % sizeof(long) != 0) {
+			*d++ = *s++;
+			len--;
+		}
 
-		for (i=0; i<len/sizeof(long); i++) {
-			d[i] = s[i];
+		ld = (long *)d;
+		ls = (const long *)s;
+		while (len >= 4*sizeof(long)) {
+			w0 = ls[0];
+			w1 = ls[1];
+			w2 = ls[2];
+			w3 = ls[3];
+			ld[0] = w0;
+			ld[1] = w1;
+			ld[2] = w2;
+			ld[3] = w3;
+			ld += 4;
+			ls += 4;
+			len -= 4*sizeof(long);
+		}
+		while (len >= sizeof(long)) {
+			*ld++ = *ls++;
+			len -= sizeof(long);
 		}
+		d = (char *)ld;
+		s = (const char *)ls;
 	}
-	else {
-		char *d = dst;
-		const char *s = src;
 
-		for (i=0; i<len; i++) {
-			d[i] = s[i];
-		}
+	while (len > 0) {
+		*d++ = *s++;
+		len--;
 	}
 
 	return dst;
@@ -18,7 +18,8 @@
 void *
 memmove(void *dst, const void *src, size_t len)
 {
-	size_t i;
+	char *d;
+	const char *s;
 
 	/*
 	 * If the buffers don't overlap, it doesn't matter what direction
@@ -54,33 +55,50 @@ memmove(void *dst, const void *src, size_t len)
 	}
 
 	/*
-	 * Copy by words in the common case. Look in memcpy.c for more
+	 * Copy by words when we can, the same way memcpy does, but
+	 * working down from the end. Look in memcpy.c for more
 	 * information.
 	 */
 
-	if ((uintptr_t)dst % sizeof(long) == 0 &&
-	    (uintptr_t)src % sizeof(long) == 0 &&
-	    len % sizeof(long) == 0) {
+	d = (char *)dst + len;
+	s = (const char *)src + len;
 
-		long *d = dst;
-		const long *s = src;
+	if (((uintptr_t)d ^ (uintptr_t)s) % sizeof(long) == 0) {
+		long *ld;
+		const long *ls;
+		long w0, w1, w2, w3;
 
-		/*
-		 * The reason we copy index i-1 and test i>0 is that
-		 * i is unsigned - so testing i>=0 doesn't work.
-		 */
+		while (len > 0 && (uintptr_t)d % sizeof(long) != 0) {
+			*--d = *--s;
+			len--;
+		}
 
-		for (i=len/sizeof(long); i>0; i--) {
-			d[i-1] = s[i-1];
+		ld = (long *)d;
+		ls = (const long *)s;
+		while (len >= 4*sizeof(long)) {
+			ld -= 4;
+			ls -= 4;
+			w3 = ls[3];
+			w2 = ls[2];
+			w1 = ls[1];
+			w0 = ls[0];
+			ld[3] = w3;
+			ld[2] = w2;
+			ld[1] = w1;
+			ld[0] = w0;
+			len -= 4*sizeof(long);
 		}
+		while (len >= sizeof(long)) {
+			*--ld = *--ls;
+			len -= sizeof(long);
+		}
+		d = (char *)ld;
+		s = (const char *)ls;
 	}
-	else {
-		char *d = dst;
-		const char *s = src;
 
-		for (i=len; i>0; i--) {
-			d[i-1] = s[i-1];
-		}
+	while (len > 0) {
+		*--d = *--s;
+		len--;
 	}
 
 	return dst;
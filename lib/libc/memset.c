@@ -8,10 +8,38 @@ void *
 memset(void *ptr, int ch, size_t len)
 {
 	char *p = ptr;
-	size_t i;
-	
-	for (i=0; i<len; i++) {
-		p[i] = ch;
+	unsigned long w, *lp;
+
+	/*
+	 * Like bzero: bytes up to a word boundary, then words with the
+	 * byte repeated in each position, then the leftover bytes.
+	 * (~0UL/0xff is 0x0101...01 whatever the size of a long.)
+	 */
+
+	while (len > 0 && (uintptr_t)p % sizeof(long) != 0) {
+		*p++ = ch;
+		len--;
+	}
+
+	w = (unsigned char)ch * (~0UL/0xff);
+	lp = (unsigned long *)p;
+	while (len >= 4*sizeof(long)) {
+		lp[0] = w;
+		lp[1] = w;
+		lp[2] = w;
+		lp[3] = w;
+		lp += 4;
+		len -= 4*sizeof(long);
+	}
+	while (len >= sizeof(long)) {
+		*lp++ = w;
+		len -= sizeof(long);
+	}
+
+	p = (char *)lp;
+	while (len > 0) {
+		*p++ = ch;
+		len--;
 	}
 
 	return ptr;
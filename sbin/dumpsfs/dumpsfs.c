@@ -26,18 +26,48 @@
 
 #include "disk.h"
 
+/* Block size and format version of the volume */
+static u_int32_t fsblocksize = SFS_BLOCKSIZE;
+static int dindirect = 0;
+
+/* Scratch for reading a 512-byte structure out of a bigger block */
+static char blockbuf[SFS_MAXBLOCKSIZE];
+
+static
+void
+readpadded(void *data, size_t len, u_int32_t block)
+{
+	diskread(blockbuf, block);
+	memcpy(data, blockbuf, len);
+}
+
 static
 u_int32_t
-dumpsb(void)
+dumpsb(u_int32_t *jstart, u_int32_t *jblocks)
 {
 	struct sfs_super sp;
+
+	/* The superblock is at the very start, whatever the block size */
 	diskread(&sp, SFS_SB_LOCATION);
-	if (SWAPL(sp.sp_magic) != SFS_MAGIC) {
+	if (SWAPL(sp.sp_magic) == SFS_MAGIC2) {
+		fsblocksize = SWAPL(sp.sp_blocksize);
+		if (fsblocksize < SFS_BLOCKSIZE ||
+		    fsblocksize > SFS_MAXBLOCKSIZE ||
+		    (fsblocksize & (fsblocksize-1)) != 0) {
+			errx(1, "Bad block size %u", fsblocksize);
+		}
+		dindirect = 1;
+		disksetblocksize(fsblocksize);
+	}
+	else if (SWAPL(sp.sp_magic) != SFS_MAGIC) {
 		errx(1, "Not an sfs filesystem");
 	}
 	sp.sp_volname[sizeof(sp.sp_volname)-1] = 0;
-	printf("Volume name: %-40s  %u blocks\n", sp.sp_volname, 
-	       SWAPL(sp.sp_nblocks));
+	printf("Volume name: %-40s  %u blocks of %u bytes\n", sp.sp_volname, 
+	       SWAPL(sp.sp_nblocks), fsblocksize);
+
+	*jstart = SWAPL(sp.sp_jstart);
+	*jblocks = SWAPL(sp.sp_jblocks);
 
 	return SWAPL(sp.sp_nblocks);
 }
@@ -46,8 +76,8 @@ static
 void
 dodirblock(u_int32_t block)
 {
-	struct sfs_dir sds[SFS_BLOCKSIZE/sizeof(struct sfs_dir)];
-	int nsds = SFS_BLOCKSIZE/sizeof(struct sfs_dir);
+	struct sfs_dir sds[SFS_MAXBLOCKSIZE/sizeof(struct sfs_dir)];
+	int nsds = fsblocksize/sizeof(struct sfs_dir);
 	int i;
 
 	diskread(&sds, block);
@@ -65,16 +95,44 @@ dodirblock(u_int32_t block)
 	}
 }
 
+/*
+ * Dump the directory blocks under an indirect block. LEVEL is 1 for
+ * an indirect block and 2 for a double-indirect block. Returns the
+ * number of directory blocks found.
+ */
+static
+u_int32_t
+dodirind(u_int32_t idblock, int level)
+{
+	u_int32_t ib[SFS_MAXBLOCKSIZE/sizeof(u_int32_t)];
+	u_int32_t i, block, nblocks=0;
+
+	diskread(&ib, idblock);
+	for (i=0; i<SFS_DBPERBLOCK(fsblocksize); i++) {
+		block = SWAPL(ib[i]);
+		if (block == 0) {
+			continue;
+		}
+		if (level > 1) {
+			nblocks += dodirind(block, level-1);
+		}
+		else {
+			dodirblock(block);
+			nblocks++;
+		}
+	}
+	return nblocks;
+}
+
 static
 void
 dumpdir(u_int32_t ino)
 {
 	struct sfs_inode sfi;
-	u_int32_t ib[SFS_DBPERIDB];
 	int nentries, i;
 	u_int32_t block, nblocks=0;
 
-	diskread(&sfi, ino);
+	readpadded(&sfi, sizeof(sfi), ino);
 
 	nentries = SWAPL(sfi.sfi_size) / sizeof(struct sfs_dir);
 	if (SWAPL(sfi.sfi_size) % sizeof(struct sfs_dir) != 0) {
@@ -90,14 +148,10 @@ dumpdir(u_int32_t ino)
 		}
 	}
 	if (SWAPL(sfi.sfi_indirect)) {
-		diskread(&ib, SWAPL(sfi.sfi_indirect));
-		for (i=0; i<SFS_DBPERIDB; i++) {
-			block = SWAPL(ib[i]);
-			if (block) {
-				dodirblock(block);
-				nblocks++;
-			}
-		}
+		nblocks += dodirind(SWAPL(sfi.sfi_indirect), 1);
+	}
+	if (dindirect && SWAPL(sfi.sfi_dindirect)) {
+		nblocks += dodirind(SWAPL(sfi.sfi_dindirect), 2);
 	}
 	printf("    %u blocks in directory\n", nblocks);
 }
@@ -106,15 +160,17 @@ static
 void
 dumpbits(u_int32_t fsblocks)
 {
-	u_int32_t nblocks = SFS_BITBLOCKS(fsblocks);
+	u_int32_t nblocks = SFS_BITBLOCKS(fsblocks, fsblocksize);
 	u_int32_t i, j;
-	char data[SFS_BLOCKSIZE];
+	char data[SFS_MAXBLOCKSIZE];
 
-	printf("Freemap: %u blocks (%u %u %u)\n", nblocks, SFS_BITMAPSIZE(fsblocks), fsblocks, SFS_BLOCKBITS);
+	printf("Freemap: %u blocks (%u %u %u)\n", nblocks,
+	       SFS_BITMAPSIZE(fsblocks, fsblocksize), fsblocks,
+	       SFS_BLOCKBITS(fsblocksize));
 
 	for (i=0; i<nblocks; i++) {
 		diskread(data, SFS_MAP_LOCATION+i);
-		for (j=0; j<SFS_BLOCKSIZE; j++) {
+		for (j=0; j<fsblocksize; j++) {
 			printf("%02x", (unsigned char)data[j]);
 			if (j%32==31) {
 				printf("\n");
@@ -124,10 +180,63 @@ dumpbits(u_int32_t fsblocks)
 	printf("\n");
 }
 
+/*
+ * Print where the journal is and the committed transactions in it
+ * that haven't been written in place yet. These would be replayed
+ * at the next mount.
+ */
+static
+void
+dumpjournal(u_int32_t jstart, u_int32_t jblocks)
+{
+	struct sfs_jheader jh;
+	struct sfs_jdesc jd;
+	struct sfs_jcommit jc;
+	u_int32_t seq, pos, n, i;
+
+	if (jblocks == 0) {
+		printf("Journal: none\n");
+		return;
+	}
+
+	readpadded(&jh, sizeof(jh), jstart);
+	if (SWAPL(jh.jh_magic) != SFS_JHDR_MAGIC) {
+		printf("Journal: blocks %u-%u, bad header\n",
+		       jstart, jstart+jblocks-1);
+		return;
+	}
+	seq = SWAPL(jh.jh_seq);
+	printf("Journal: blocks %u-%u, next transaction %u\n",
+	       jstart, jstart+jblocks-1, seq);
+
+	for (pos = 0; pos + 2 <= jblocks-1; pos += n + 2) {
+		readpadded(&jd, sizeof(jd), jstart+1+pos);
+		n = SWAPL(jd.jd_nblocks);
+		if (SWAPL(jd.jd_magic) != SFS_JDESC_MAGIC ||
+		    SWAPL(jd.jd_seq) != seq ||
+		    n == 0 || n > SFS_JDESC_MAX || pos + n + 2 > jblocks-1) {
+			break;
+		}
+		readpadded(&jc, sizeof(jc), jstart+1+pos+n+1);
+		if (SWAPL(jc.jc_magic) != SFS_JCOMMIT_MAGIC ||
+		    SWAPL(jc.jc_seq) != seq || SWAPL(jc.jc_nblocks) != n) {
+			printf("    transaction %u: not committed\n", seq);
+			break;
+		}
+
+		printf("    transaction %u: %u blocks:", seq, n);
+		for (i=0; i<n; i++) {
+			printf(" %u", SWAPL(jd.jd_blocks[i]));
+		}
+		printf("\n");
+		seq++;
+	}
+}
+
 int
 main(int argc, char **argv)
 {
-	u_int32_t nblocks;
+	u_int32_t nblocks, jstart, jblocks;
 
 #ifdef HOST
 	hostcompat_init(argc, argv);
@@ -138,7 +247,8 @@ main(int argc, char **argv)
 	}
 
 	opendisk(argv[1]);
-	nblocks = dumpsb();
+	nblocks = dumpsb(&jstart, &jblocks);
+	dumpjournal(jstart, jblocks);
 	dumpbits(nblocks);
 	dumpdir(SFS_ROOT_LOCATION);
 
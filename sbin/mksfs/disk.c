@@ -19,6 +19,7 @@
 
 static int fd=-1;
 static u_int32_t nblocks;
+static u_int32_t blocksize = BLOCKSIZE;
 
 void
 opendisk(const char *path)
@@ -67,33 +68,57 @@ diskblocksize(void)
 	return BLOCKSIZE;
 }
 
+/*
+ * Read and write in blocks of SIZE bytes from now on, instead of
+ * device sectors. Block numbers and diskblocks() count in those.
+ */
+void
+disksetblocksize(u_int32_t size)
+{
+	assert(fd>=0);
+	assert(size >= BLOCKSIZE && size % BLOCKSIZE == 0);
+	blocksize = size;
+}
+
 u_int32_t
 diskblocks(void)
 {
 	assert(fd>=0);
-	return nblocks;
+	return nblocks / (blocksize / BLOCKSIZE);
 }
 
+/*
+ * Seek to the start of a block.
+ */
+static
 void
-diskwrite(const void *data, u_int32_t block)
+diskseek(u_int32_t block)
 {
-	const char *cdata = data;
-	u_int32_t tot=0;
-	int len;
-
-	assert(fd>=0);
+	off_t pos = (off_t)block * blocksize;
 
 #ifdef HOST
 	// skip over disk file header
-	block++;
+	pos += BLOCKSIZE;
 #endif
 
-	if (lseek(fd, block*BLOCKSIZE, SEEK_SET)<0) {
+	if (lseek(fd, pos, SEEK_SET)<0) {
 		err(1, "lseek");
 	}
+}
+
+void
+diskwrite(const void *data, u_int32_t block)
+{
+	const char *cdata = data;
+	u_int32_t tot=0;
+	int len;
+
+	assert(fd>=0);
 
-	while (tot < BLOCKSIZE) {
-		len = write(fd, cdata + tot, BLOCKSIZE - tot);
+	diskseek(block);
+
+	while (tot < blocksize) {
+		len = write(fd, cdata + tot, blocksize - tot);
 		if (len < 0) {
 			if (errno==EINTR || errno==EAGAIN) {
 				continue;
@@ -116,17 +141,10 @@ diskread(void *data, u_int32_t block)
 
 	assert(fd>=0);
 
-#ifdef HOST
-	// skip over disk file header
-	block++;
-#endif
-
-	if (lseek(fd, block*BLOCKSIZE, SEEK_SET)<0) {
-		err(1, "lseek");
-	}
+	diskseek(block);
 
-	while (tot < BLOCKSIZE) {
-		len = read(fd, cdata + tot, BLOCKSIZE - tot);
+	while (tot < blocksize) {
+		len = read(fd, cdata + tot, blocksize - tot);
 		if (len < 0) {
 			if (errno==EINTR || errno==EAGAIN) {
 				continue;
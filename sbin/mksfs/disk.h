@@ -1,6 +1,7 @@
 void opendisk(const char *path);
 
 u_int32_t diskblocksize(void);
+void disksetblocksize(u_int32_t size);
 u_int32_t diskblocks(void);
 
 void diskwrite(const void *data, u_int32_t block);
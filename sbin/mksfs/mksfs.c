@@ -1,4 +1,5 @@
 #include <sys/types.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <limits.h>
@@ -27,6 +28,23 @@
 
 #define MAXBITBLOCKS 32
 
+/* Block size and format of the volume being made */
+static u_int32_t fsblocksize = SFS_BLOCKSIZE;
+static int version2 = 0;
+
+/* Scratch for writing a 512-byte structure padded out to a block */
+static char blockbuf[SFS_MAXBLOCKSIZE];
+
+static
+void
+writepadded(const void *data, size_t len, u_int32_t block)
+{
+	assert(len <= fsblocksize);
+	bzero(blockbuf, fsblocksize);
+	memcpy(blockbuf, data, len);
+	diskwrite(blockbuf, block);
+}
+
 static
 void
 check(void)
@@ -38,7 +56,8 @@ check(void)
 
 static
 void
-writesuper(const char *volname, u_int32_t nblocks)
+writesuper(const char *volname, u_int32_t nblocks,
+	   u_int32_t jstart, u_int32_t jblocks)
 {
 	struct sfs_super sp;
 
@@ -48,11 +67,19 @@ writesuper(const char *volname, u_int32_t nblocks)
 		errx(1, "Volume name %s too long", volname);
 	}
 
-	sp.sp_magic = SWAPL(SFS_MAGIC);
+	if (!version2) {
+		sp.sp_magic = SWAPL(SFS_MAGIC);
+	}
+	else {
+		sp.sp_magic = SWAPL(SFS_MAGIC2);
+		sp.sp_blocksize = SWAPL(fsblocksize);
+	}
 	sp.sp_nblocks = SWAPL(nblocks);
 	strcpy(sp.sp_volname, volname);
+	sp.sp_jstart = SWAPL(jstart);
+	sp.sp_jblocks = SWAPL(jblocks);
 
-	diskwrite(&sp, SFS_SB_LOCATION);
+	writepadded(&sp, sizeof(sp), SFS_SB_LOCATION);
 }
 
 static
@@ -67,10 +94,10 @@ writerootdir(void)
 	sfi.sfi_type = SWAPS(SFS_TYPE_DIR);
 	sfi.sfi_linkcount = SWAPS(1);
 
-	diskwrite(&sfi, SFS_ROOT_LOCATION);
+	writepadded(&sfi, sizeof(sfi), SFS_ROOT_LOCATION);
 }
 
-static char bitbuf[MAXBITBLOCKS*SFS_BLOCKSIZE];
+static char bitbuf[MAXBITBLOCKS*SFS_MAXBLOCKSIZE];
 
 static
 void
@@ -85,11 +112,11 @@ doallocbit(u_int32_t bit)
 
 static
 void
-writebitmap(u_int32_t fsblocks)
+writebitmap(u_int32_t fsblocks, u_int32_t jstart, u_int32_t jblocks)
 {
 
-	u_int32_t nbits = SFS_BITMAPSIZE(fsblocks);
-	u_int32_t nblocks = SFS_BITBLOCKS(fsblocks);
+	u_int32_t nbits = SFS_BITMAPSIZE(fsblocks, fsblocksize);
+	u_int32_t nblocks = SFS_BITBLOCKS(fsblocks, fsblocksize);
 	char *ptr;
 	u_int32_t i;
 
@@ -103,28 +130,58 @@ writebitmap(u_int32_t fsblocks)
 	for (i=0; i<nblocks; i++) {
 		doallocbit(SFS_MAP_LOCATION+i);
 	}
+	for (i=0; i<jblocks; i++) {
+		doallocbit(jstart+i);
+	}
 	for (i=fsblocks; i<nbits; i++) {
 		doallocbit(i);
 	}
 
 	for (i=0; i<nblocks; i++) {
-		ptr = bitbuf + i*SFS_BLOCKSIZE;
+		ptr = bitbuf + i*fsblocksize;
 		diskwrite(ptr, SFS_MAP_LOCATION+i);
 	}
 }
 
+/*
+ * Write an empty journal: a header, and a log with nothing in it.
+ * The log is zeroed so that nothing left on the disk from before
+ * looks like a transaction.
+ */
+static
+void
+writejournal(u_int32_t jstart, u_int32_t jblocks)
+{
+	struct sfs_jheader jh;
+	static char zeros[SFS_MAXBLOCKSIZE];
+	u_int32_t i;
+
+	assert(sizeof(struct sfs_jheader)==SFS_BLOCKSIZE);
+	assert(sizeof(struct sfs_jdesc)==SFS_BLOCKSIZE);
+	assert(sizeof(struct sfs_jcommit)==SFS_BLOCKSIZE);
+
+	bzero((void *)&jh, sizeof(jh));
+	jh.jh_magic = SWAPL(SFS_JHDR_MAGIC);
+	jh.jh_seq = SWAPL(1);
+	writepadded(&jh, sizeof(jh), jstart);
+
+	for (i=1; i<jblocks; i++) {
+		diskwrite(zeros, jstart+i);
+	}
+}
+
 int
 main(int argc, char **argv)
 {
-	u_int32_t size, blocksize;
+	u_int32_t size, blocksize, bitblocks, jstart, jblocks;
 	char *volname, *s;
 
 #ifdef HOST
 	hostcompat_init(argc, argv);
 #endif
 
-	if (argc!=3) {
-		errx(1, "Usage: mksfs device/diskfile volume-name");
+	if (argc!=3 && argc!=4) {
+		errx(1, "Usage: mksfs device/diskfile volume-name [blocksize]");
 	}
 
 	check();
@@ -153,11 +210,43 @@ main(int argc, char **argv)
 		errx(1, "Device has wrong blocksize %u (should be %u)\n",
 		     blocksize, SFS_BLOCKSIZE);
 	}
+
+	/*
+	 * Giving a block size, even 512, makes a version 2 volume,
+	 * which also allows double-indirect blocks.
+	 */
+	if (argc==4) {
+		fsblocksize = atoi(argv[3]);
+		if (fsblocksize < SFS_BLOCKSIZE ||
+		    fsblocksize > SFS_MAXBLOCKSIZE ||
+		    (fsblocksize & (fsblocksize-1)) != 0) {
+			errx(1, "Illegal block size %s (must be a power of 2 "
+			     "from %u to %u)", argv[3], SFS_BLOCKSIZE,
+			     SFS_MAXBLOCKSIZE);
+		}
+		disksetblocksize(fsblocksize);
+		version2 = 1;
+	}
 	size = diskblocks();
+	bitblocks = SFS_BITBLOCKS(size, fsblocksize);
+
+	/*
+	 * The journal goes right after the freemap. Small volumes get
+	 * a smaller one, or none if it couldn't hold the whole freemap
+	 * in one transaction.
+	 */
+	jstart = SFS_MAP_LOCATION + bitblocks;
+	jblocks = size/8 < SFS_JOURNAL_SIZE ? size/8 : SFS_JOURNAL_SIZE;
+	if (jblocks < bitblocks + 4 || bitblocks + 1 > SFS_JDESC_MAX) {
+		jstart = jblocks = 0;
+	}
 
-	writesuper(volname, size);
+	writesuper(volname, size, jstart, jblocks);
 	writerootdir();
-	writebitmap(size);
+	writebitmap(size, jstart, jblocks);
+	if (jblocks > 0) {
+		writejournal(jstart, jblocks);
+	}
 
 	closedisk();
 
@@ -1,5 +1,7 @@
 /*
- * forkbomb - apply malthus to an operating system ;-)
+ * forkexecbomb - apply malthus to an operating system ;-)
+ *
+ * Odd pids spawn() a new copy of the program, even pids fork().
  *
  * DO NOT RUN THIS ON A REAL SYSTEM - IT WILL GRIND TO A HALT AND
  * PEOPLE WILL COME AFTER YOU WIELDING BASEBALL BATS OR THE AD
@@ -37,21 +39,22 @@ main(int argc, char *argv[])
 
 	while (1) {
                 ppid = getpid();
-		pid = fork();
                 assert(argv != 0);
-
-                if (pid < 0) {
-                        if (errno != ENOMEM)
-                                warn("fork");
-                }
                 if (!argv[0]) {
                         warnx("argv bug: pid = %d, argv = 0x%x", getpid(),
                               (unsigned int)argv);
                 }
+
                 if (ppid % 2) {
-                        execv(argv[0], argv);
-                        if (errno != ENOMEM && errno != ENFILE)
-                                warn("execv");
+                        /* start a fresh copy of ourselves without forking */
+                        pid = spawn(argv[0], argv);
+                        if (pid < 0 && errno != ENOMEM && errno != ENFILE)
+                                warn("spawn");
+                }
+                else {
+                        pid = fork();
+                        if (pid < 0 && errno != ENOMEM)
+                                warn("fork");
                 }
 		pid = getpid();
 		/* Make sure each fork has its own address space. */
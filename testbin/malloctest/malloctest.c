@@ -582,6 +582,67 @@ test7(void)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Test 8
+ *
+ * Allocation throughput benchmark. Does a fixed random mix of malloc
+ * and free over the same sizes as the stress test (so mostly small
+ * blocks, with the odd large one) and reports operations per second,
+ * so that changes to malloc can be compared run to run.
+ */
+
+#define BENCHOPS    200000
+#define BENCHSLOTS  256
+
+static
+void
+test8(void)
+{
+	static const int sizes[8] = { 13, 17, 69, 176, 433, 871, 1150, 6060 };
+	static void *ptrs[BENCHSLOTS];
+	time_t secs1, secs2;
+	unsigned long nsecs1, nsecs2, usecs, opspersec;
+	int i, n, size;
+
+	printf("Beginning malloc test 8\n");
+	srandom(0);
+
+	__time(&secs1, &nsecs1);
+	for (i=0; i<BENCHOPS; i++) {
+		n = random()%BENCHSLOTS;
+		if (ptrs[n] == NULL) {
+			size = sizes[random()%8];
+			ptrs[n] = malloc(size);
+			if (ptrs[n] == NULL) {
+				printf("malloc %u failed\n", size);
+				printf("FAILED malloc test 8\n");
+				return;
+			}
+		}
+		else {
+			free(ptrs[n]);
+			ptrs[n] = NULL;
+		}
+	}
+	__time(&secs2, &nsecs2);
+
+	for (i=0; i<BENCHSLOTS; i++) {
+		if (ptrs[i] != NULL) {
+			free(ptrs[i]);
+			ptrs[i] = NULL;
+		}
+	}
+
+	usecs = (secs2 - secs1)*1000000 + nsecs2/1000 - nsecs1/1000;
+	/* ops per msec first, so this doesn't overflow 32 bits */
+	opspersec = usecs/1000 > 0 ? (BENCHOPS*1000UL)/(usecs/1000) : 0;
+	printf("%d operations in %lu.%06lu seconds: %lu ops/sec\n",
+	       BENCHOPS, usecs/1000000, usecs%1000000, opspersec);
+	printf("Passed malloc test 8\n");
+}
+
+////////////////////////////////////////////////////////////
+
 static struct {
 	int num;
 	const char *desc;
@@ -594,6 +655,7 @@ static struct {
 	{ 5, "Stress test", test5 },
 	{ 6, "Randomized stress test", test6 },
 	{ 7, "Stress test with particular seed", test7 },
+	{ 8, "Allocation throughput benchmark", test8 },
 	{ -1, NULL, NULL }
 };
 
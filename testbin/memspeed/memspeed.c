@@ -0,0 +1,115 @@
+/*
+ * memspeed.c
+ *
+ * Times memcpy, memmove, memset and bzero over a range of sizes, with
+ * the buffers word aligned and then deliberately misaligned, and
+ * prints the throughput of each in KB/sec. Each case moves about
+ * TOTALBYTES bytes in all, whatever the size of one call.
+ *
+ * Usage: memspeed [totalbytes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TOTALBYTES  (1024*1024)
+#define MAXSIZE     16384
+
+/* Room for the largest size plus misalignment; long for the alignment */
+static long srcwords[(MAXSIZE + 8)/sizeof(long)];
+static long dstwords[(MAXSIZE + 8)/sizeof(long)];
+#define srcbuf ((char *)srcwords)
+#define dstbuf ((char *)dstwords)
+
+static const int sizes[] = { 16, 64, 256, 1024, 4096, 16384 };
+#define NSIZES (sizeof(sizes)/sizeof(sizes[0]))
+
+enum { OP_MEMCPY, OP_MEMMOVE, OP_MEMSET, OP_BZERO, NOPS };
+static const char *const opnames[NOPS] = {
+	"memcpy", "memmove", "memset", "bzero",
+};
+
+/*
+ * Run OP on SIZE bytes until TOTAL bytes have gone by. SRCOFF and
+ * DSTOFF are the offsets from word alignment. Returns KB/sec.
+ */
+static
+unsigned long
+runcase(int op, int size, int srcoff, int dstoff, unsigned long total)
+{
+	char *src = srcbuf + srcoff;
+	char *dst = dstbuf + dstoff;
+	unsigned long i, n, usecs;
+	time_t secs1, secs2;
+	unsigned long nsecs1, nsecs2;
+
+	n = total / size;
+	if (n == 0) {
+		n = 1;
+	}
+
+	__time(&secs1, &nsecs1);
+	for (i=0; i<n; i++) {
+		switch (op) {
+		    case OP_MEMCPY:
+			memcpy(dst, src, size);
+			break;
+		    case OP_MEMMOVE:
+			/* overlapping, dst above src: copies backwards */
+			memmove(src + 4, src, size);
+			break;
+		    case OP_MEMSET:
+			memset(dst, i, size);
+			break;
+		    case OP_BZERO:
+			bzero(dst, size);
+			break;
+		}
+	}
+	__time(&secs2, &nsecs2);
+
+	usecs = (secs2 - secs1)*1000000 + nsecs2/1000 - nsecs1/1000;
+	if (usecs == 0) {
+		usecs = 1;
+	}
+	/* KB per msec, times 1000, so this doesn't overflow 32 bits */
+	return usecs/1000 > 0 ? (n*size/1024)*1000 / (usecs/1000) : 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long total = TOTALBYTES;
+	unsigned i;
+	int op;
+
+	if (argc > 1) {
+		total = atoi(argv[1]);
+	}
+
+	/* so the source isn't all zeros */
+	for (i=0; i<sizeof(srcwords); i++) {
+		srcbuf[i] = i;
+	}
+
+	printf("%lu bytes per case; KB/sec, aligned / misaligned\n", total);
+	printf("%-8s", "size");
+	for (op=0; op<NOPS; op++) {
+		printf(" %17s", opnames[op]);
+	}
+	printf("\n");
+
+	for (i=0; i<NSIZES; i++) {
+		printf("%-8d", sizes[i]);
+		for (op=0; op<NOPS; op++) {
+			printf(" %8lu/%-8lu",
+			       runcase(op, sizes[i], 0, 0, total),
+			       runcase(op, sizes[i], 1, 2, total));
+		}
+		printf("\n");
+	}
+
+	return 0;
+}